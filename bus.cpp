@@ -0,0 +1,285 @@
+/**
+ * Emulates the nanomsg/nng bus pattern with ZMQ sockets.  In a bus, every
+ * member can send and every other member receives what's sent.
+ *
+ * ZMQ has no bus socket so we build one from a hub:
+ *
+ * *  An XSUB socket bound to uri that every member's PUB connects to.
+ * *  An XPUB socket bound to a second endpoint that every member's SUB
+ *    connects to.
+ * *  zmq_proxy shovels messages from the XSUB to the XPUB (and subscriptions
+ *    the other way).
+ *
+ * The hub delivers a member's messages back to itself too; members drop
+ * messages that start with their own id.
+ *
+ * Usage:
+ *    bus uri nmembers nmsgs
+ * Where:
+ *    uri - is the endpoint the hub's XSUB binds.  The XPUB binds the
+ *        next port for tcp or uri-1 for the other transports.
+ *    nmembers - Number of bus members (threads).
+ *    nmsgs - Number of messages each member sends.
+ *
+ * @note Since PUB/SUB drops messages sent before the subscriptions reach
+ * the publisher, members first send HELLOs until they have heard from all
+ * of the others and all members have done so.
+ * @note this is not production code so we will segfault if a parameter is missing.
+ */
+#include <thread>
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <set>
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/**
+ *  utility to receive a message string.
+ * @param sock - socket to receive on.
+ * @return std::string - message string received.
+ */
+static std::string
+rcvString(void* sock) {
+
+    // Get the message and require it to be a single part.
+    zmq_msg_t msg;
+    checkError(zmq_msg_init(&msg), "Initializing message");
+
+    checkError(
+        zmq_recvmsg(sock, &msg, 0),
+        "Receiving message part."
+    );
+    int more;
+    size_t morelen(sizeof(more));
+    checkError(
+        zmq_getsockopt(sock, ZMQ_RCVMORE, &more, &morelen),
+        "Failed to get more flag"
+    );
+    if (more) {
+        std::cerr << "Thought I was getting a single part message, got a multipart!\n";
+        exit(EXIT_FAILURE);
+    }
+    // Fetch the string from the message and output to stdout:
+    // Assumes the payload is a cstring.
+    std::string printme(reinterpret_cast<char*>(checkError(
+        zmq_msg_data(&msg),
+        "Failed to get message data."
+    )));
+
+
+    zmq_msg_close(&msg);
+    return printme;
+}
+
+/**
+ * sendString
+ *    Send a string to a socket:
+ * @param sock - socket on which to send it.
+ * @param msg = c ztring to send.
+ */
+static void
+sendString(void* sock, const char* mesg) {
+    zmq_msg_t msg;
+    checkError(
+        zmq_msg_init_size(&msg, strlen(mesg) + 1),
+        "Failed to allocate message copy storage."
+    );
+    strcpy(reinterpret_cast<char*>(zmq_msg_data(&msg)), mesg);   // Copy message in.
+
+    checkError(
+        zmq_sendmsg(sock, &msg, 0),    // I think this does a close eventually.
+        "Sending string message"
+    );
+
+}
+/**
+ * secondEndpoint
+ *    The XPUB's endpoint: next port for tcp, uri-1 otherwise.
+ */
+static std::string
+secondEndpoint(const std::string& uri) {
+    if (uri.compare(0, 6, "tcp://") == 0) {
+        auto colon = uri.rfind(':');
+        int port = atoi(uri.substr(colon + 1).c_str());
+        return uri.substr(0, colon + 1) + std::to_string(port + 1);
+    }
+    return uri + "-1";
+}
+/**
+ * hub
+ *    Runs the proxy until the context is terminated.
+ *
+ * @param xsub - bound XSUB socket the members publish to.
+ * @param xpub - bound XPUB socket the members subscribe to.
+ */
+static void
+hub(void* xsub, void* xpub) {
+    zmq_proxy(xsub, xpub, nullptr);      // Returns when the context terminates.
+    zmq_close(xsub);
+    zmq_close(xpub);
+}
+
+/**
+ * member
+ *    One bus member.
+ *
+ * @param pubUri - endpoint of the hub's XSUB.
+ * @param subUri - endpoint of the hub's XPUB.
+ * @param ctx - shared context.
+ * @param id - our member id.
+ * @param nmembers - size of the bus.
+ * @param nmsgs - number of messages we send.
+ * @param ready - latch all members count down once they've heard from everyone.
+ */
+static void
+member(
+    std::string pubUri, std::string subUri, void* ctx, int id, int nmembers, int nmsgs,
+    std::latch& ready
+) {
+    auto pub = checkError(
+        zmq_socket(ctx, ZMQ_PUB),
+        "Creating member publisher"
+    );
+    checkError(
+        zmq_connect(pub, pubUri.c_str()),
+        "Connecting member publisher to hub"
+    );
+    auto sub = checkError(
+        zmq_socket(ctx, ZMQ_SUB),
+        "Creating member subscriber"
+    );
+    checkError(
+        zmq_setsockopt(sub, ZMQ_SUBSCRIBE, "", 0),
+        "Subscribing to everything"
+    );
+    checkError(
+        zmq_connect(sub, subUri.c_str()),
+        "Connecting member subscriber to hub"
+    );
+    std::string myId = std::to_string(id);
+    std::string hello = myId + " HELLO";
+
+    // Say hello until everyone's heard from everyone.  Data can
+    // arrive from members that finish this first.
+
+    std::set<std::string> heardFrom;
+    int expected = nmsgs*(nmembers - 1);
+    int got(0);
+    bool counted(false);
+    while (!ready.try_wait()) {
+        sendString(pub, hello.c_str());
+        zmq_pollitem_t item = {sub, 0, ZMQ_POLLIN, 0};
+        while (checkError(zmq_poll(&item, 1, 100), "Polling for hellos") > 0) {
+            std::string msg = rcvString(sub);
+            std::string sender = msg.substr(0, msg.find(' '));
+            if (sender == myId) continue;
+            if (msg.find("HELLO") != std::string::npos) {
+                heardFrom.insert(sender);
+            } else {
+                std::cerr << "Member " << id << " got " << msg << std::endl;
+                got++;
+            }
+        }
+        if (!counted && (int)heardFrom.size() == nmembers - 1) {
+            ready.count_down();
+            counted = true;
+        }
+    }
+    // Send our messages:
+
+    for (int i = 0; i < nmsgs; i++) {
+        std::stringstream msg;
+        msg << myId << " message number " << i;
+        sendString(pub, msg.str().c_str());
+    }
+    // Get everyone else's:
+
+    while (got < expected) {
+        std::string msg = rcvString(sub);
+        std::string sender = msg.substr(0, msg.find(' '));
+        if (sender == myId || msg.find("HELLO") != std::string::npos) continue;
+        std::cerr << "Member " << id << " got " << msg << std::endl;
+        got++;
+    }
+
+    checkError(zmq_close(pub), "Closing member publisher");
+    checkError(zmq_close(sub), "Closing member subscriber");
+}
+
+int main(int argc, char** argv) {
+    std::string uri(argv[1]);
+    int nmembers = atoi(argv[2]);
+    int nmsgs = atoi(argv[3]);
+    std::string subUri = secondEndpoint(uri);
+
+    auto context = checkError(
+        zmq_ctx_new(),
+        "Creating context"
+    );
+    // Set up the hub and start it:
+
+    auto xsub = checkError(
+        zmq_socket(context, ZMQ_XSUB),
+        "Creating hub XSUB"
+    );
+    checkError(
+        zmq_bind(xsub, uri.c_str()),
+        "Binding hub XSUB"
+    );
+    auto xpub = checkError(
+        zmq_socket(context, ZMQ_XPUB),
+        "Creating hub XPUB"
+    );
+    checkError(
+        zmq_bind(xpub, subUri.c_str()),
+        "Binding hub XPUB"
+    );
+    std::thread hubThread(hub, xsub, xpub);
+
+    // Start the members and wait for them to be done:
+
+    std::latch ready(nmembers);
+    std::vector<std::thread*> members;
+    for (int i = 0; i < nmembers; i++) {
+        members.push_back(
+            new std::thread(member, uri, subUri, context, i, nmembers, nmsgs, std::ref(ready))
+        );
+    }
+    for (auto p : members) {
+        p->join();
+        delete p;
+    }
+    // Terminating the context stops the proxy which closes the hub sockets:
+
+    checkError(
+        zmq_ctx_term(context),
+        "Terminating context"
+    );
+    hubThread.join();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+/**
+ * codec.h
+ *    A small binary message format to use instead of formatting strings.
+ *
+ * Building a request with a std::stringstream, copying it into a message
+ * with strlen/strcpy and copying it back out into a std::string on receipt
+ * costs several allocations and copies per message.  Here a message is:
+ *
+ * *  A fixed 16 byte header: type, number of fields, sender id and a
+ *    sequence number.
+ * *  Zero or more fields, each a 32 bit length followed by that many bytes.
+ *
+ * Senders size the zmq_msg_t exactly and encode straight into it
+ * (encode).  Receivers keep the zmq_msg_t and read it in place
+ * (Reader/InMessage): the header is copied out (it's 16 bytes and
+ * zmq_msg_data need not be aligned) but fields are std::string_views into
+ * the message data, valid until the message is closed.
+ *
+ * Integers are in host byte order; the examples talk to themselves.
+ *
+ * Functions that call ZMQ return its status (negative on failure, see
+ * zmq_errno) for the caller's checkError.
+ */
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <zmq.h>
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include <initializer_list>
+
+namespace codec {
+
+/**
+ * Header
+ *    The fixed layout at the front of every message.
+ */
+struct Header {
+    uint16_t type;        // What the message is, the application decides.
+    uint16_t nfields;     // Length prefixed fields that follow.
+    uint32_t id;          // Who sent it e.g. requester number.
+    uint64_t sequence;    // e.g. request number.
+};
+static_assert(sizeof(Header) == 16, "Header layout must not have padding");
+
+/**
+ * encodedSize
+ *   @param fields - field contents.
+ *   @return size_t - bytes needed to encode a message with those fields.
+ */
+inline size_t
+encodedSize(std::initializer_list<std::string_view> fields) {
+    size_t size = sizeof(Header);
+    for (auto& f : fields) {
+        size += sizeof(uint32_t) + f.size();
+    }
+    return size;
+}
+
+/**
+ * encode
+ *    Encode into a buffer the caller sized with encodedSize.
+ * @param buffer - where the message goes.
+ * @param type, id, sequence - header contents.
+ * @param fields - field contents.
+ */
+inline void
+encode(
+    void* buffer, uint16_t type, uint32_t id, uint64_t sequence,
+    std::initializer_list<std::string_view> fields
+) {
+    char*  p = static_cast<char*>(buffer);
+    Header header = {type, static_cast<uint16_t>(fields.size()), id, sequence};
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    for (auto& f : fields) {
+        uint32_t len = f.size();
+        memcpy(p, &len, sizeof(len));
+        memcpy(p + sizeof(len), f.data(), len);
+        p += sizeof(len) + len;
+    }
+}
+
+/**
+ * encode
+ *    Initialize a message of exactly the right size and encode into it.
+ * @param msg - uninitialized message; on success the caller sends or closes it.
+ * @return int - zmq_msg_init_size's status.
+ */
+inline int
+encode(
+    zmq_msg_t* msg, uint16_t type, uint32_t id, uint64_t sequence,
+    std::initializer_list<std::string_view> fields
+) {
+    int status = zmq_msg_init_size(msg, encodedSize(fields));
+    if (status == 0) {
+        encode(zmq_msg_data(msg), type, id, sequence, fields);
+    }
+    return status;
+}
+
+/**
+ * send
+ *    Encode a message and send it.
+ * @param socket - where to send it.
+ * @param flags - zmq_msg_send flags.
+ * @return int - negative if ZMQ failed.
+ */
+inline int
+send(
+    void* socket, uint16_t type, uint32_t id, uint64_t sequence,
+    std::initializer_list<std::string_view> fields, int flags = 0
+) {
+    zmq_msg_t msg;
+    int status = encode(&msg, type, id, sequence, fields);
+    if (status < 0) return status;
+    status = zmq_msg_send(&msg, socket, flags);
+    if (status < 0) {
+        zmq_msg_close(&msg);
+    }
+    return status;
+}
+
+/**
+ * Reader
+ *    Reads an encoded message in place.  Fields are returned in order by
+ * next.  A message that is truncated or otherwise malformed makes valid()
+ * false and next() return false.
+ */
+class Reader {
+    const char* m_p;
+    const char* m_end;
+    Header      m_header;
+    int         m_remaining;
+    bool        m_valid;
+public:
+    Reader(const void* data, size_t size) :
+        m_p(static_cast<const char*>(data)), m_end(m_p + size), m_remaining(0),
+        m_valid(size >= sizeof(Header))
+    {
+        if (m_valid) {
+            memcpy(&m_header, m_p, sizeof(m_header));
+            m_p += sizeof(m_header);
+            m_remaining = m_header.nfields;
+        } else {
+            memset(&m_header, 0, sizeof(m_header));
+        }
+    }
+    bool valid() const {
+        return m_valid;
+    }
+    const Header& header() const {
+        return m_header;
+    }
+    /**
+     * next
+     *    Get the next field.
+     * @param field - view of the field's bytes in the message.
+     * @return bool - false if there are no more (or the message is bad).
+     */
+    bool next(std::string_view& field) {
+        uint32_t len;
+        if (!m_valid || m_remaining == 0) return false;
+        if (m_end - m_p < (ptrdiff_t)sizeof(len)) return m_valid = false;
+        memcpy(&len, m_p, sizeof(len));
+        if ((size_t)(m_end - m_p) - sizeof(len) < len) return m_valid = false;
+        field = std::string_view(m_p + sizeof(len), len);
+        m_p += sizeof(len) + len;
+        m_remaining--;
+        return true;
+    }
+};
+
+/**
+ * InMessage
+ *    A received message and a Reader over it.  Keeps the zmq_msg_t open
+ * (and so the field views valid) until destroyed.
+ */
+class InMessage {
+    zmq_msg_t m_msg;
+    int       m_status;
+    Reader    m_reader;
+public:
+    /**
+     * constructor
+     *    Receive a message.
+     * @param socket - socket to receive from.
+     * @param flags - zmq_msg_recv flags.
+     * @note check status() before using the message.
+     */
+    InMessage(void* socket, int flags = 0) :
+        m_status(receive(socket, flags)),
+        m_reader(m_status < 0 ? nullptr : zmq_msg_data(&m_msg),
+                 m_status < 0 ? 0 : zmq_msg_size(&m_msg))
+    {}
+    ~InMessage() {
+        zmq_msg_close(&m_msg);
+    }
+    InMessage(const InMessage&) = delete;
+    InMessage& operator=(const InMessage&) = delete;
+
+    int status() const {
+        return m_status;
+    }
+    Reader& reader() {
+        return m_reader;
+    }
+    const Header& header() const {
+        return m_reader.header();
+    }
+private:
+    int receive(void* socket, int flags) {
+        zmq_msg_init(&m_msg);
+        return zmq_msg_recv(&m_msg, socket, flags);
+    }
+};
+
+}
+
+#endif
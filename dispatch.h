@@ -0,0 +1,174 @@
+/**
+ * dispatch.h
+ *    Hands received messages to a handler chosen by the message's topic.
+ *
+ * A subscriber that receives a message into a std::string, splits it into
+ * words and compares the first against each topic it knows allocates and
+ * copies several times per message, and the comparisons grow with the
+ * number of topics.  TopicDispatcher works on the message bytes in place
+ * (e.g. straight out of zmq_msg_data) and allocates nothing:
+ *
+ * *  Messages are usually a topic word, a space and the body.  The first
+ *    word is looked up in a hash of the registered topics; that finds the
+ *    longest match as long as no registered topic contains a space.
+ * *  Otherwise (no space, the word isn't a topic, or topics with spaces are
+ *    registered) the topics' trie is walked over the message: one step per
+ *    topic byte.  Runs of bytes with no branch in them (e.g. the "prices."
+ *    every topic starts with) are kept in one node and compared with memcmp
+ *    (a radix tree).
+ *
+ * topics.cpp times both.  Each trie step costs a binary search and a
+ * pointer chase, so walking it is about 3 times slower than the hash
+ * lookup (165 against 55 nsec/msg with 1000 topics, 610 against 170 with
+ * 100000), which is why it's only the fallback for prefix subscriptions.
+ *
+ * Matching follows ZMQ subscriptions: a topic matches a message that
+ * starts with it.  When several registered topics match, the longest wins,
+ * so "" can serve as a default handler.
+ *
+ * Handlers get the topic that matched and the rest of the message, both as
+ * views into the message.
+ */
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+
+class TopicDispatcher {
+public:
+    using Handler = std::function<void(std::string_view topic, std::string_view body)>;
+private:
+    struct Edge {
+        uint8_t  byte;
+        uint32_t node;
+        bool operator<(uint8_t b) const { return byte < b; }
+    };
+    struct Node {
+        std::string       label;        // Bytes after the edge byte that lead here.
+        std::vector<Edge> edges;        // Sorted by byte.
+        int               handler;      // Index into m_handlers or -1.
+    };
+    struct ViewHash {                   // Lets the words be found by string_view.
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+    static const char DELIMITER = ' ';
+
+    std::vector<Node>    m_nodes;       // m_nodes[0] is the root ("").
+    std::vector<Handler> m_handlers;
+    std::unordered_map<std::string, Handler, ViewHash, std::equal_to<>> m_words;  // Word topics.
+    bool                 m_spaced;      // A topic has a DELIMITER: no hash lookups.
+public:
+    TopicDispatcher() : m_nodes(1, Node{"", {}, -1}), m_spaced(false) {}
+
+    /**
+     * add
+     *    Register (or replace) the handler for a topic.
+     * @param topic - topic prefix, "" matches everything.
+     * @param handler - called with the matched topic and the rest of the message.
+     */
+    void add(std::string_view topic, Handler handler) {
+        uint32_t node = 0;
+        size_t   i = 0;                   // Bytes of topic matched so far.
+        while (i < topic.size()) {
+            uint8_t c = topic[i];
+            auto& edges = m_nodes[node].edges;
+            auto  p = std::lower_bound(edges.begin(), edges.end(), c);
+            if (p == edges.end() || p->byte != c) {
+                // New branch holding the rest of the topic:
+
+                uint32_t child = m_nodes.size();
+                edges.insert(p, Edge{c, child});    // Before push_back: it may reallocate.
+                m_nodes.push_back(Node{std::string(topic.substr(i + 1)), {}, -1});
+                node = child;
+                break;
+            }
+            uint32_t    child = p->node;
+            std::string label = m_nodes[child].label;
+            std::string_view rest = topic.substr(i + 1);
+            size_t k = 0;
+            while (k < label.size() && k < rest.size() && label[k] == rest[k]) k++;
+            if (k < label.size()) {
+                // The topic leaves (or ends) inside the label; split it:
+
+                uint32_t mid = m_nodes.size();
+                p->node = mid;
+                m_nodes[child].label = label.substr(k + 1);
+                m_nodes.push_back(Node{label.substr(0, k), {Edge{(uint8_t)label[k], child}}, -1});
+                child = mid;
+            }
+            node = child;
+            i += 1 + k;
+        }
+        if (m_nodes[node].handler < 0) {
+            m_nodes[node].handler = m_handlers.size();
+            m_handlers.push_back(std::move(handler));
+        } else {
+            m_handlers[m_nodes[node].handler] = std::move(handler);
+        }
+        if (topic.find(DELIMITER) != std::string_view::npos) {
+            m_spaced = true;
+        } else if (!topic.empty()) {
+            m_words[std::string(topic)] = m_handlers[m_nodes[node].handler];
+        }
+    }
+    /**
+     * dispatch
+     *    Call the handler of the longest topic the message starts with.
+     * @param message - the message.
+     * @return bool - false if no topic matched.
+     */
+    bool dispatch(std::string_view message) const {
+        if (!m_spaced) {
+            size_t end = message.find(DELIMITER);
+            if (end != std::string_view::npos) {
+                auto p = m_words.find(message.substr(0, end));
+                if (p != m_words.end()) {
+                    p->second(message.substr(0, end), message.substr(end));
+                    return true;
+                }
+            }
+        }
+        // No whole word topic, try prefixes:
+
+        uint32_t node = 0;
+        int      handler = m_nodes[0].handler;
+        size_t   matched = 0;
+        size_t   i = 0;
+        while (i < message.size()) {
+            const auto& edges = m_nodes[node].edges;
+            uint8_t c = message[i];
+            auto p = std::lower_bound(edges.begin(), edges.end(), c);
+            if (p == edges.end() || p->byte != c) break;
+            const Node& child = m_nodes[p->node];
+            size_t len = child.label.size();
+            if (message.size() - (i + 1) < len ||
+                memcmp(message.data() + i + 1, child.label.data(), len) != 0) break;
+            node = p->node;
+            i += 1 + len;
+            if (child.handler >= 0) {
+                handler = child.handler;
+                matched = i;
+            }
+        }
+        if (handler < 0) return false;
+        m_handlers[handler](message.substr(0, matched), message.substr(matched));
+        return true;
+    }
+    /**
+     * topics
+     *   @return size_t - number of registered topics.
+     */
+    size_t topics() const {
+        return m_handlers.size();
+    }
+};
+
+#endif
@@ -0,0 +1,309 @@
+/**
+ * allocator.cpp
+ *    Replaces malloc, free and friends in the timing programs so we can
+ * (see the Makefile):
+ *
+ * *  Count allocations per thread (ALLOCSTATS, read via allocstats.h).
+ * *  Choose the allocator underneath:
+ *    -  system  (default)        - glibc's malloc via its __libc_ entries.
+ *    -  tcmalloc (ALLOCATOR_TCMALLOC) - gperftools' thread caching malloc.
+ *    -  pool    (ALLOCATOR_POOL) - the fixed size pool below.
+ *
+ * The programs are linked with this file; since the executable's malloc
+ * is found first, libzmq and libstdc++ allocate through it too.
+ *
+ * The pool allocator has a free list for each power of two block size
+ * from 16 bytes to 4MBytes, each protected by a spin lock, carved out
+ * of one big reserved mapping.  Blocks never go back to the system.  It's
+ * deliberately simple: no per-thread caches, so with many threads
+ * allocating the same size it shows what lock contention costs next to
+ * tcmalloc's thread caches.  Anything larger, and aligned allocations,
+ * go to glibc; free tells them apart by address.
+ *
+ * @note malloc_usable_size is not replaced and must not be used on pool
+ * blocks.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <sys/mman.h>
+#include "allocstats.h"
+
+extern "C" {
+    void* __libc_malloc(size_t);
+    void  __libc_free(void*);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+    void* __libc_memalign(size_t, size_t);
+}
+
+#if defined(ALLOCATOR_TCMALLOC)
+
+extern "C" {
+    void* tc_malloc(size_t);
+    void  tc_free(void*);
+    void* tc_calloc(size_t, size_t);
+    void* tc_realloc(void*, size_t);
+    void* tc_memalign(size_t, size_t);
+}
+[[maybe_unused]] static const char* ALLOCATOR = "tcmalloc";
+static void* realMalloc(size_t n)                 { return tc_malloc(n); }
+static void  realFree(void* p)                    { tc_free(p); }
+static void* realCalloc(size_t n, size_t s)       { return tc_calloc(n, s); }
+static void* realRealloc(void* p, size_t n)       { return tc_realloc(p, n); }
+static void* realMemalign(size_t a, size_t n)     { return tc_memalign(a, n); }
+
+#elif defined(ALLOCATOR_POOL)
+
+[[maybe_unused]] static const char* ALLOCATOR = "pool";
+
+static const int    MIN_SHIFT = 4;                   // 16 bytes.
+static const int    MAX_SHIFT = 22;                  // 4 MBytes.
+static const size_t HEADER = 16;                     // Keeps 16 byte alignment.
+static const size_t ARENA_SIZE = size_t(64) << 30;   // Reserved, not committed.
+static const size_t CARVE_SIZE = 256*1024;           // Small blocks made in bulk.
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+struct Pool {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    FreeBlock*       free = nullptr;
+    char             pad[64 - sizeof(std::atomic_flag) - sizeof(FreeBlock*)];
+};
+static Pool               pools[MAX_SHIFT + 1];
+static std::atomic<char*> arenaBase(nullptr);
+static std::atomic<size_t> arenaUsed(0);
+
+static char*
+arena() {
+    char* base = arenaBase.load(std::memory_order_acquire);
+    if (!base) {
+        void* p = mmap(
+            nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+        );
+        if (p == MAP_FAILED) return nullptr;
+        char* expected(nullptr);
+        if (!arenaBase.compare_exchange_strong(expected, static_cast<char*>(p))) {
+            munmap(p, ARENA_SIZE);          // Another thread won the race.
+        }
+        base = arenaBase.load(std::memory_order_acquire);
+    }
+    return base;
+}
+static bool
+inArena(void* p) {
+    char* base = arenaBase.load(std::memory_order_relaxed);
+    return base && p >= base && static_cast<char*>(p) < base + ARENA_SIZE;
+}
+static int
+poolIndex(size_t n) {
+    size_t total = n + HEADER;
+    int shift = MIN_SHIFT;
+    while ((size_t(1) << shift) < total) shift++;
+    return shift;
+}
+static void*
+poolMalloc(size_t n) {
+    int index = poolIndex(n);
+    char* base = arena();
+    if (index > MAX_SHIFT || !base) {
+        return __libc_malloc(n);
+    }
+    size_t blockSize = size_t(1) << index;
+    Pool&  pool = pools[index];
+
+    while (pool.lock.test_and_set(std::memory_order_acquire)) {
+    }
+    FreeBlock* block = pool.free;
+    if (!block) {
+        // Carve out a batch (or just one big block) from the arena:
+
+        size_t nblocks = blockSize >= CARVE_SIZE ? 1 : CARVE_SIZE/blockSize;
+        size_t offset = arenaUsed.fetch_add(nblocks*blockSize);
+        if (offset + nblocks*blockSize > ARENA_SIZE) {
+            pool.lock.clear(std::memory_order_release);
+            return __libc_malloc(n);
+        }
+        char* p = base + offset;
+        for (size_t i = 1; i < nblocks; i++) {
+            FreeBlock* extra = reinterpret_cast<FreeBlock*>(p + i*blockSize);
+            extra->next = pool.free;
+            pool.free = extra;
+        }
+        block = reinterpret_cast<FreeBlock*>(p);
+    } else {
+        pool.free = block->next;
+    }
+    pool.lock.clear(std::memory_order_release);
+
+    *reinterpret_cast<int*>(block) = index;
+    return reinterpret_cast<char*>(block) + HEADER;
+}
+static void
+poolFree(void* p) {
+    if (!inArena(p)) {
+        __libc_free(p);
+        return;
+    }
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(static_cast<char*>(p) - HEADER);
+    Pool& pool = pools[*reinterpret_cast<int*>(block)];
+    while (pool.lock.test_and_set(std::memory_order_acquire)) {
+    }
+    block->next = pool.free;
+    pool.free = block;
+    pool.lock.clear(std::memory_order_release);
+}
+static void* realMalloc(size_t n) { return poolMalloc(n); }
+static void  realFree(void* p)    { poolFree(p); }
+static void*
+realCalloc(size_t n, size_t s) {
+    if (s && n > SIZE_MAX/s) return nullptr;
+    void* p = poolMalloc(n*s);
+    if (p) memset(p, 0, n*s);
+    return p;
+}
+static void*
+realRealloc(void* p, size_t n) {
+    if (!inArena(p)) {
+        if (p) return __libc_realloc(p, n);
+        return poolMalloc(n);
+    }
+    int index = *reinterpret_cast<int*>(static_cast<char*>(p) - HEADER);
+    size_t room = (size_t(1) << index) - HEADER;
+    if (n <= room) return p;
+    void* result = poolMalloc(n);
+    if (result) {
+        memcpy(result, p, room);
+        poolFree(p);
+    }
+    return result;
+}
+static void* realMemalign(size_t a, size_t n) { return __libc_memalign(a, n); }
+
+#else
+
+[[maybe_unused]] static const char* ALLOCATOR = "system";
+static void* realMalloc(size_t n)                 { return __libc_malloc(n); }
+static void  realFree(void* p)                    { __libc_free(p); }
+static void* realCalloc(size_t n, size_t s)       { return __libc_calloc(n, s); }
+static void* realRealloc(void* p, size_t n)       { return __libc_realloc(p, n); }
+static void* realMemalign(size_t a, size_t n)     { return __libc_memalign(a, n); }
+
+#endif
+
+#ifdef ALLOCSTATS
+
+// Each thread gets its own set of counters so counting doesn't contend.
+// Slots are never reused so the process totals include threads that
+// have exited; threads past MAX_THREADS share the last slot.
+
+static const int MAX_THREADS = 1024;
+
+struct ThreadCounts {
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> bytes;
+    char                  pad[64 - 3*sizeof(std::atomic<uint64_t>)];
+};
+static ThreadCounts     threadCounts[MAX_THREADS];
+static std::atomic<int> threadsUsed(0);
+static __thread ThreadCounts* myCounts __attribute__((tls_model("initial-exec"))) = nullptr;
+
+static ThreadCounts&
+counts() {
+    if (!myCounts) {
+        int slot = threadsUsed.fetch_add(1);
+        myCounts = &threadCounts[slot < MAX_THREADS ? slot : MAX_THREADS - 1];
+    }
+    return *myCounts;
+}
+static void
+countAlloc(size_t n) {
+    ThreadCounts& c(counts());
+    c.allocs.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(n, std::memory_order_relaxed);
+}
+static void
+countFree(void* p) {
+    if (p) counts().frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void
+allocStatsThread(AllocCounts* result) {
+    ThreadCounts& c(counts());
+    result->allocs = c.allocs.load(std::memory_order_relaxed);
+    result->frees  = c.frees.load(std::memory_order_relaxed);
+    result->bytes  = c.bytes.load(std::memory_order_relaxed);
+}
+extern "C" void
+allocStatsProcess(AllocCounts* result) {
+    int n = threadsUsed.load();
+    if (n > MAX_THREADS) n = MAX_THREADS;
+    result->allocs = result->frees = result->bytes = 0;
+    for (int i = 0; i < n; i++) {
+        result->allocs += threadCounts[i].allocs.load(std::memory_order_relaxed);
+        result->frees  += threadCounts[i].frees.load(std::memory_order_relaxed);
+        result->bytes  += threadCounts[i].bytes.load(std::memory_order_relaxed);
+    }
+}
+extern "C" const char*
+allocatorName() {
+    return ALLOCATOR;
+}
+
+#else
+
+static void countAlloc(size_t) {}
+static void countFree(void*) {}
+
+#endif
+
+// The replacements:
+
+extern "C" {
+
+void*
+malloc(size_t n) {
+    countAlloc(n);
+    return realMalloc(n);
+}
+void
+free(void* p) {
+    countFree(p);
+    realFree(p);
+}
+void*
+calloc(size_t n, size_t size) {
+    countAlloc(n*size);
+    return realCalloc(n, size);
+}
+void*
+realloc(void* p, size_t n) {
+    if (p) countFree(p);
+    countAlloc(n);
+    return realRealloc(p, n);
+}
+void*
+memalign(size_t alignment, size_t n) {
+    countAlloc(n);
+    return realMemalign(alignment, n);
+}
+void*
+aligned_alloc(size_t alignment, size_t n) {
+    countAlloc(n);
+    return realMemalign(alignment, n);
+}
+int
+posix_memalign(void** result, size_t alignment, size_t n) {
+    countAlloc(n);
+    void* p = realMemalign(alignment, n);
+    if (!p) return ENOMEM;
+    *result = p;
+    return 0;
+}
+
+}
@@ -0,0 +1,153 @@
+/**
+ * allocstats.h
+ *    Optional allocation counts for the timing programs.
+ *
+ * When a program is built with ALLOCSTATS=1 (see the Makefile), allocator.cpp
+ * replaces malloc and friends with versions that count, per thread, the
+ * allocations, frees and bytes requested before passing the call on to the
+ * real allocator.  The counting functions below are weak so a program built
+ * without allocator.cpp still links; it then reports the counts as
+ * unavailable.
+ *
+ * As with PerfCounters, each thread that wants to be measured makes an
+ * AllocCounter and brackets the timed region with start() and stop().
+ * Threads playing the same role are summed with AllocTotals.  Since
+ * libzmq allocates received messages in its I/O threads and frees them in
+ * ours, the programs also count the whole process (AllocCounter(enable, true)).
+ */
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+
+#include <stdint.h>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+
+/**
+ * AllocCounts
+ *    Allocation activity.  Also the layout allocator.cpp fills in.
+ */
+struct AllocCounts {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;       // Requested, not what the allocator rounded up to.
+    int      threads;     // How many threads were summed.
+
+    AllocCounts() : allocs(0), frees(0), bytes(0), threads(0) {}
+    AllocCounts& operator+=(const AllocCounts& rhs) {
+        allocs  += rhs.allocs;
+        frees   += rhs.frees;
+        bytes   += rhs.bytes;
+        threads += rhs.threads;
+        return *this;
+    }
+    AllocCounts operator-(const AllocCounts& rhs) const {
+        AllocCounts result(*this);
+        result.allocs -= rhs.allocs;
+        result.frees  -= rhs.frees;
+        result.bytes  -= rhs.bytes;
+        return result;
+    }
+};
+
+// Provided by allocator.cpp when built with ALLOCSTATS:
+
+extern "C" void allocStatsThread(AllocCounts* counts) __attribute__((weak));
+extern "C" void allocStatsProcess(AllocCounts* counts) __attribute__((weak));
+extern "C" const char* allocatorName() __attribute__((weak));
+
+/**
+ * allocStatsAvailable
+ *   @return bool - true if the program was built with the counting allocator.
+ */
+inline bool
+allocStatsAvailable() {
+    return allocStatsThread != nullptr;
+}
+
+/**
+ * AllocCounter
+ *    Counts the allocations of the calling thread (or the whole process)
+ * between start and stop.  Constructed disabled, or without allocator.cpp,
+ * it does nothing.
+ */
+class AllocCounter {
+    bool        m_enabled;
+    bool        m_process;
+    AllocCounts m_start;
+    AllocCounts m_counts;
+public:
+    AllocCounter(bool enable, bool process = false) :
+        m_enabled(enable && allocStatsAvailable()), m_process(process) {}
+
+    void start() {
+        if (m_enabled) m_start = current();
+    }
+    void stop() {
+        if (m_enabled) m_counts = current() - m_start;
+    }
+    AllocCounts read() const {
+        AllocCounts result(m_counts);
+        result.threads = m_process ? 0 : 1;       // 0 means all of them.
+        return result;
+    }
+private:
+    AllocCounts current() const {
+        AllocCounts counts;
+        if (m_process) {
+            allocStatsProcess(&counts);
+        } else {
+            allocStatsThread(&counts);
+        }
+        return counts;
+    }
+};
+
+/**
+ * AllocTotals
+ *    Sums the counts from threads that play the same role.
+ */
+class AllocTotals {
+    std::mutex  m_lock;
+    AllocCounts m_counts;
+public:
+    void add(const AllocCounts& counts) {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_counts += counts;
+    }
+    AllocCounts get() {
+        std::lock_guard<std::mutex> guard(m_lock);
+        return m_counts;
+    }
+};
+
+/**
+ * reportAllocCounts
+ *    Write the counts in total and per message.
+ *
+ * @param who - Role of the thread(s) e.g. "Pusher".
+ * @param counts - The counts to report.
+ * @param msgs - Number of messages in the timed region.
+ */
+inline void
+reportAllocCounts(const char* who, const AllocCounts& counts, double msgs) {
+    std::cout << who << " allocations";
+    if (!allocStatsAvailable()) {
+        std::cout << " unavailable (build with make ALLOCSTATS=1)\n";
+        return;
+    }
+    std::cout << " (" << allocatorName() << ", ";
+    if (counts.threads) {
+        std::cout << counts.threads << " thread" << (counts.threads == 1 ? "" : "s") << ")\n";
+    } else {
+        std::cout << "all threads)\n";
+    }
+    std::cout << "  allocs  " << std::setw(14) << counts.allocs
+        << "  /msg: " << std::setw(12) << (double)counts.allocs/msgs << std::endl;
+    std::cout << "  frees   " << std::setw(14) << counts.frees
+        << "  /msg: " << std::setw(12) << (double)counts.frees/msgs << std::endl;
+    std::cout << "  bytes   " << std::setw(14) << counts.bytes
+        << "  /msg: " << std::setw(12) << (double)counts.bytes/msgs << std::endl;
+}
+
+#endif
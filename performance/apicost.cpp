@@ -0,0 +1,282 @@
+/**
+ * apicost.cpp
+ *    Microbenchmarks the libzmq calls on the timing programs' hot path, to
+ * choose the receive and send idioms they should standardize on.  ignore()
+ * does zmq_msg_init, zmq_recvmsg, zmq_msg_data, zmq_msg_close and a
+ * zmq_getsockopt(ZMQ_RCVMORE) for every message; send() is zmq_send, which
+ * copies.  This times those calls alone and the alternatives:
+ *
+ * *  Message calls: init/close, init_size/close, init_data (with and
+ *    without a free function)/close, zmq_msg_data, zmq_msg_more and
+ *    zmq_getsockopt(ZMQ_RCVMORE).
+ * *  Receive idioms, each receiving queued messages:
+ *      ignore        - as the timing programs do.
+ *      msg_more      - ignore with zmq_msg_more instead of getsockopt.
+ *      reuse         - one zmq_msg_t for every receive, zmq_msg_more.
+ *      recv buffer   - zmq_recv into a fixed buffer (copies).
+ * *  Send idioms, each queueing messages:
+ *      zmq_send      - copies, as send() does.
+ *      init_size     - zmq_msg_init_size, memcpy, zmq_msg_send.
+ *      init_data     - zmq_msg_init_data on a buffer we keep (no copy, no
+ *                      free function), zmq_msg_send.
+ *
+ * Sockets are an inproc PAIR with unlimited high water marks, both used
+ * from this thread, so what's timed is the API and the pipe, not I/O
+ * threads or the network.  Messages for the receive idioms are queued before
+ * the timing starts, and those the send idioms queue are drained after.
+ * Those two time fewer operations when ops messages of size would queue more
+ * than QUEUE_BYTES.
+ *
+ * Usage:
+ *    apicost [-r repetitions] [-n ops] [size]
+ * Where:
+ *    -r  - times each measurement is repeated (default 5).
+ *    -n  - operations per repetition (default 100000).
+ *    size - message size (default 64).  Up to 33 bytes messages are held
+ *           in the zmq_msg_t itself and never allocate.
+ *
+ * Reported: ns/op min, median and max over the repetitions.
+ *
+ * @note this is not production code.
+ */
+#include <zmq.h>
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static volatile uintptr_t sink;            // Keeps results "used".
+static const double QUEUE_BYTES = 256.0*1024*1024;  // Most we'll queue at once.
+
+static void
+freeNothing(void*, void*) {
+}
+/**
+ * measure
+ *    Time ops calls of body, reps times, and report ns/op.
+ *
+ * @param name - what's measured.
+ * @param reps - repetitions.
+ * @param ops - calls of body per repetition.
+ * @param setup - untimed, before each repetition.
+ * @param body - the operation.
+ * @param cleanup - untimed, after each repetition.
+ */
+template<typename Setup, typename Body, typename Cleanup>
+static void
+measure(const char* name, int reps, int ops, Setup setup, Body body, Cleanup cleanup) {
+    std::vector<double> ns;
+    for (int r = 0; r < reps; r++) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ops; i++) {
+            body();
+        }
+        auto end = std::chrono::steady_clock::now();
+        cleanup();
+        ns.push_back(std::chrono::duration<double, std::nano>(end - start).count()/ops);
+    }
+    std::sort(ns.begin(), ns.end());
+    std::cout << "  " << std::left << std::setw(32) << name << std::right
+        << std::setw(10) << ns.front() << std::setw(10) << ns[ns.size()/2]
+        << std::setw(10) << ns.back() << std::endl;
+}
+template<typename Body>
+static void
+measure(const char* name, int reps, int ops, Body body) {
+    measure(name, reps, ops, [](){}, body, [](){});
+}
+
+/**
+ * fill
+ *    Queue n messages of size on socket.
+ */
+static void
+fill(void* socket, const char* data, int size, int n) {
+    for (int i = 0; i < n; i++) {
+        checkError(zmq_send(socket, data, size, 0), "Queueing");
+    }
+}
+/**
+ * drain
+ *    Throw away n queued messages.
+ */
+static void
+drain(void* socket, int n) {
+    zmq_msg_t msg;
+    zmq_msg_init(&msg);
+    for (int i = 0; i < n; i++) {
+        checkError(zmq_msg_recv(&msg, socket, 0), "Draining");
+    }
+    zmq_msg_close(&msg);
+}
+
+int main(int argc, char** argv) {
+    int reps(5);
+    int ops(100000);
+    int opt;
+    while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+        switch (opt) {
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'n':
+            ops = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: apicost [-r repetitions] [-n ops] [size]\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    int size = optind < argc ? atoi(argv[optind]) : 64;
+    if (reps < 1) reps = 1;
+    if (ops < 1) ops = 1;
+    if (size < 1) size = 1;
+
+    auto ctx = checkError(zmq_ctx_new(), "Making context");
+    auto out = checkError(zmq_socket(ctx, ZMQ_PAIR), "Making sending PAIR");
+    auto in  = checkError(zmq_socket(ctx, ZMQ_PAIR), "Making receiving PAIR");
+    int hwm(0);
+    for (auto s : {out, in}) {
+        checkError(zmq_setsockopt(s, ZMQ_SNDHWM, &hwm, sizeof(hwm)), "Setting send hwm");
+        checkError(zmq_setsockopt(s, ZMQ_RCVHWM, &hwm, sizeof(hwm)), "Setting receive hwm");
+    }
+    checkError(zmq_bind(in, "inproc://apicost"), "Binding");
+    checkError(zmq_connect(out, "inproc://apicost"), "Connecting");
+
+    int queued = std::min(double(ops), std::max(1.0, QUEUE_BYTES/size));
+
+    char* data = new char[size];
+    memset(data, 0, size);
+    char* buffer = new char[size];
+
+    std::cout << "Size:      " << size << " ops: " << ops << " repetitions: " << reps
+        << " queued ops: " << queued << std::endl;
+    std::cout << "  " << std::left << std::setw(32) << "ns/op" << std::right
+        << std::setw(10) << "min" << std::setw(10) << "median" << std::setw(10) << "max"
+        << std::endl;
+
+    // Message calls:
+
+    measure("zmq_msg_init+close", reps, ops, [&]() {
+        zmq_msg_t msg;
+        zmq_msg_init(&msg);
+        zmq_msg_close(&msg);
+    });
+    measure("zmq_msg_init_size+close", reps, ops, [&]() {
+        zmq_msg_t msg;
+        zmq_msg_init_size(&msg, size);
+        zmq_msg_close(&msg);
+    });
+    measure("zmq_msg_init_data+close", reps, ops, [&]() {
+        zmq_msg_t msg;
+        zmq_msg_init_data(&msg, data, size, nullptr, nullptr);
+        zmq_msg_close(&msg);
+    });
+    measure("zmq_msg_init_data(ffn)+close", reps, ops, [&]() {
+        zmq_msg_t msg;
+        zmq_msg_init_data(&msg, data, size, freeNothing, nullptr);
+        zmq_msg_close(&msg);
+    });
+    zmq_msg_t held;
+    zmq_msg_init_size(&held, size);
+    measure("zmq_msg_data", reps, ops, [&]() {
+        sink = reinterpret_cast<uintptr_t>(zmq_msg_data(&held));
+    });
+    measure("zmq_msg_more", reps, ops, [&]() {
+        sink = zmq_msg_more(&held);
+    });
+    zmq_msg_close(&held);
+    measure("zmq_getsockopt(ZMQ_RCVMORE)", reps, ops, [&]() {
+        int more;
+        size_t len(sizeof(more));
+        zmq_getsockopt(in, ZMQ_RCVMORE, &more, &len);
+        sink = more;
+    });
+
+    // Receive idioms:
+
+    auto queue = [&]() { fill(out, data, size, queued); };
+    auto nothing = [](){};
+    measure("recv: ignore (getsockopt)", reps, queued, queue, [&]() {
+        zmq_msg_t msg;
+        zmq_msg_init(&msg);
+        checkError(zmq_recvmsg(in, &msg, 0), "Receiving");
+        sink = *static_cast<uint8_t*>(zmq_msg_data(&msg));
+        zmq_msg_close(&msg);
+        int more;
+        size_t len(sizeof(more));
+        zmq_getsockopt(in, ZMQ_RCVMORE, &more, &len);
+        sink = more;
+    }, nothing);
+    measure("recv: ignore (msg_more)", reps, queued, queue, [&]() {
+        zmq_msg_t msg;
+        zmq_msg_init(&msg);
+        checkError(zmq_msg_recv(&msg, in, 0), "Receiving");
+        sink = *static_cast<uint8_t*>(zmq_msg_data(&msg));
+        sink = zmq_msg_more(&msg);
+        zmq_msg_close(&msg);
+    }, nothing);
+    zmq_msg_t reused;
+    zmq_msg_init(&reused);
+    measure("recv: reuse one zmq_msg_t", reps, queued, queue, [&]() {
+        checkError(zmq_msg_recv(&reused, in, 0), "Receiving");   // Releases the last one.
+        sink = *static_cast<uint8_t*>(zmq_msg_data(&reused));
+        sink = zmq_msg_more(&reused);
+    }, nothing);
+    zmq_msg_close(&reused);
+    measure("recv: zmq_recv into buffer", reps, queued, queue, [&]() {
+        checkError(zmq_recv(in, buffer, size, 0), "Receiving");
+        sink = *buffer;
+    }, nothing);
+
+    // Send idioms:
+
+    auto empty = [&]() { drain(in, queued); };
+    measure("send: zmq_send (copy)", reps, queued, nothing, [&]() {
+        checkError(zmq_send(out, data, size, 0), "Sending");
+    }, empty);
+    measure("send: init_size+memcpy+send", reps, queued, nothing, [&]() {
+        zmq_msg_t msg;
+        zmq_msg_init_size(&msg, size);
+        memcpy(zmq_msg_data(&msg), data, size);
+        checkError(zmq_msg_send(&msg, out, 0), "Sending");
+    }, empty);
+    measure("send: init_data+send", reps, queued, nothing, [&]() {
+        zmq_msg_t msg;
+        zmq_msg_init_data(&msg, data, size, nullptr, nullptr);
+        checkError(zmq_msg_send(&msg, out, 0), "Sending");
+    }, empty);
+
+    zmq_close(out);
+    zmq_close(in);
+    checkError(zmq_ctx_term(ctx), "Terminating context");
+    delete []data;
+    delete []buffer;
+    return EXIT_SUCCESS;
+}
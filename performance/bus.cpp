@@ -0,0 +1,382 @@
+/**
+ * bus.cpp
+ *    Times the bus pattern (everyone sends, every other member receives)
+ * built from ZMQ PUB/SUB sockets.  See ../bus.cpp for the example.
+ * Two ways to build a bus are timed:
+ *
+ * *  hub (default) - every member's PUB connects to an XSUB and every SUB
+ *    to an XPUB, zmq_proxy moves messages between them.  Members get their
+ *    own messages back and drop them.
+ * *  mesh (-m) - every member binds a PUB and its SUB connects to every
+ *    other member's PUB.  No extra hop but n*(n-1) connections.
+ *
+ * Usage:
+ *    bus [-m] uri nmembers nmsgs size
+ * Where:
+ *    -m  - Use a full mesh rather than a hub.
+ *    uri - Base endpoint.  The hub binds its XSUB there and its XPUB at
+ *          the next endpoint; in a mesh member i binds the i'th endpoint
+ *          (see endpoints.h).
+ *    nmembers - Number of members (threads).
+ *    nmsgs - Number of messages each member sends.
+ *    size - Message size (at least 16 bytes, the header).
+ *
+ * Each message starts with the sender's id, a message kind and the
+ * steady_clock time it was sent, so receivers can compute the latency.
+ * Members interleave sending with draining what has arrived, then receive
+ * until they have everyone else's messages.
+ *
+ * Timing starts when every member has heard HELLOs from all the others
+ * (so no subscriptions are missing) and ends when all members have
+ * received everything.  High water marks are disabled so nothing is
+ * dropped and the counts are exact.
+ *
+ * Reported: aggregate delivered messages/sec and KB/sec (a delivery is
+ * one message to one member), and delivery latency percentiles.
+ *
+ * @note this is not production code; missing parameters will segfault.
+ */
+#include <thread>
+#include <latch>
+#include <mutex>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "endpoints.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// The header at the front of each message:
+
+struct BusHeader {
+    uint32_t member;
+    uint32_t kind;
+    int64_t  sent;                // steady_clock nanoseconds.
+};
+static const uint32_t HELLO = 1;
+static const uint32_t DATA  = 2;
+
+static int64_t
+now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+/**
+ *  setUnlimited
+ *    Set send/receive buffers to 2MBytes and turn off the high water
+ * marks so PUB never drops.
+ * @param socket
+ */
+static void
+setUnlimited(void* socket) {
+    int maxSize = 1024*1024*2;     // 2mbytes.
+    checkError(
+        zmq_setsockopt(socket, ZMQ_SNDBUF, &maxSize, sizeof(int)),
+        "Setting send buffer size"
+    );
+    checkError(
+        zmq_setsockopt(socket, ZMQ_RCVBUF, &maxSize, sizeof(int)),
+        "Setting receive buffer size"
+    );
+    int hwm(0);
+    checkError(
+        zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm)),
+        "Setting send high water mark"
+    );
+    checkError(
+        zmq_setsockopt(socket, ZMQ_RCVHWM, &hwm, sizeof(hwm)),
+        "Setting receive high water mark"
+    );
+}
+
+/**
+ * Results
+ *    Where the members put their latencies.
+ */
+struct Results {
+    std::mutex          lock;
+    std::vector<double> latencies;    // usec.
+    int64_t             deliveries = 0;
+};
+
+/**
+ * Member
+ *    Holds a member's state while it runs.
+ */
+class Member {
+    void*    m_pub;
+    void*    m_sub;
+    uint32_t m_id;
+    int      m_nmembers;
+    std::vector<bool>   m_heardFrom;
+    int      m_heard;
+    int64_t  m_got;
+    std::vector<double> m_latencies;
+public:
+    Member(void* pub, void* sub, int id, int nmembers) :
+        m_pub(pub), m_sub(sub), m_id(id), m_nmembers(nmembers),
+        m_heardFrom(nmembers, false), m_heard(0), m_got(0) {}
+
+    bool heardFromAll() const { return m_heard == m_nmembers - 1; }
+    int64_t got() const { return m_got; }
+    std::vector<double>& latencies() { return m_latencies; }
+
+    /**
+     * send
+     *   Send a message of our own.
+     * @param msg - buffer of the message size, we fill in the header.
+     * @param size - message size.
+     * @param kind - HELLO or DATA.
+     */
+    void send(char* msg, int size, uint32_t kind) {
+        BusHeader header = {m_id, kind, now()};
+        memcpy(msg, &header, sizeof(header));
+        checkError(zmq_send(m_pub, msg, size, 0), "Sending bus message");
+    }
+    /**
+     * receive
+     *    Receive and process a message.
+     * @param flags - ZMQ_DONTWAIT to poll.
+     * @return bool - false if nothing was available.
+     */
+    bool receive(int flags) {
+        zmq_msg_t msg;
+        checkError(zmq_msg_init(&msg), "Initializing message");
+        if (zmq_msg_recv(&msg, m_sub, flags) < 0) {
+            if (zmq_errno() == EAGAIN) {
+                zmq_msg_close(&msg);
+                return false;
+            }
+            checkError(-1, "Receiving bus message");
+        }
+        int64_t received = now();
+        BusHeader header;
+        memcpy(&header, zmq_msg_data(&msg), sizeof(header));
+        zmq_msg_close(&msg);
+
+        if (header.member == m_id) {
+            return true;                      // Hub echoes our own.
+        }
+        if (header.kind == HELLO) {
+            if (!m_heardFrom[header.member]) {
+                m_heardFrom[header.member] = true;
+                m_heard++;
+            }
+        } else {
+            m_latencies.push_back((double)(received - header.sent)/1000.0);
+            m_got++;
+        }
+        return true;
+    }
+};
+
+/**
+ * member
+ *    Thread for a bus member.
+ *
+ * @param pubUri - Endpoint our PUB binds (mesh) or connects to (hub).
+ * @param subUris - Endpoints our SUB connects to.
+ * @param mesh - True if we bind our PUB.
+ * @param ctx - Shared context.
+ * @param id - Member id.
+ * @param nmembers - Size of the bus.
+ * @param nmsgs - Number of messages we send.
+ * @param size - Message size.
+ * @param bound - Latch counted down once our PUB is bound.
+ * @param ready - Latch counted down once we've heard from everyone.
+ * @param done - Latch counted down when we've got everything; we wait
+ *               for everyone before closing.
+ * @param results - Where our latencies go.
+ */
+static void
+member(
+    std::string pubUri, std::vector<std::string> subUris, bool mesh,
+    void* ctx, int id, int nmembers, int nmsgs, int size,
+    std::latch& bound, std::latch& ready, std::latch& done, Results& results
+) {
+    auto pub = checkError(zmq_socket(ctx, ZMQ_PUB), "Creating member PUB");
+    setUnlimited(pub);
+    auto sub = checkError(zmq_socket(ctx, ZMQ_SUB), "Creating member SUB");
+    setUnlimited(sub);
+    checkError(zmq_setsockopt(sub, ZMQ_SUBSCRIBE, "", 0), "Subscribing");
+    if (mesh) {
+        checkError(zmq_bind(pub, pubUri.c_str()), "Binding member PUB");
+    } else {
+        checkError(zmq_connect(pub, pubUri.c_str()), "Connecting member PUB");
+    }
+    bound.arrive_and_wait();
+    for (auto& uri : subUris) {
+        checkError(zmq_connect(sub, uri.c_str()), "Connecting member SUB");
+    }
+
+    Member me(pub, sub, id, nmembers);
+    char* msg = new char[size];
+    memset(msg, 0, size);
+
+    // HELLO until everybody has heard everybody:
+
+    bool counted(false);
+    while (!ready.try_wait()) {
+        me.send(msg, size, HELLO);
+        usleep(1000);
+        while (me.receive(ZMQ_DONTWAIT))
+            ;
+        if (!counted && me.heardFromAll()) {
+            ready.count_down();
+            counted = true;
+        }
+    }
+    // Send our data, draining as we go, then get the rest:
+
+    int64_t expected = (int64_t)nmsgs*(nmembers - 1);
+    for (int i = 0; i < nmsgs; i++) {
+        me.send(msg, size, DATA);
+        while (me.receive(ZMQ_DONTWAIT))
+            ;
+    }
+    while (me.got() < expected) {
+        me.receive(0);
+    }
+    delete []msg;
+    {
+        std::lock_guard<std::mutex> guard(results.lock);
+        results.latencies.insert(
+            results.latencies.end(), me.latencies().begin(), me.latencies().end()
+        );
+        results.deliveries += me.got();
+    }
+    done.arrive_and_wait();        // Nobody needs our PUB anymore.
+
+    checkError(zmq_close(pub), "Closing member PUB");
+    checkError(zmq_close(sub), "Closing member SUB");
+}
+/**
+ * hub
+ *    Runs the proxy until the context is terminated.
+ */
+static void
+hub(void* xsub, void* xpub) {
+    zmq_proxy(xsub, xpub, nullptr);
+    zmq_close(xsub);
+    zmq_close(xpub);
+}
+
+int main(int argc, char** argv) {
+    bool mesh(false);
+    int opt;
+    while ((opt = getopt(argc, argv, "m")) != -1) {
+        switch (opt) {
+        case 'm':
+            mesh = true;
+            break;
+        default:
+            std::cerr << "Usage: bus [-m] uri nmembers nmsgs size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nmembers = atoi(argv[optind+1]);
+    int nmsgs = atoi(argv[optind+2]);
+    int size = atoi(argv[optind+3]);
+    if (size < (int)sizeof(BusHeader)) {
+        size = sizeof(BusHeader);
+    }
+
+    auto context = checkError(zmq_ctx_new(), "Creating context");
+
+    // Build the hub if there is one:
+
+    std::thread* hubThread(nullptr);
+    if (!mesh) {
+        auto xsub = checkError(zmq_socket(context, ZMQ_XSUB), "Creating hub XSUB");
+        setUnlimited(xsub);
+        checkError(zmq_bind(xsub, uri.c_str()), "Binding hub XSUB");
+        auto xpub = checkError(zmq_socket(context, ZMQ_XPUB), "Creating hub XPUB");
+        setUnlimited(xpub);
+        checkError(zmq_bind(xpub, nthEndpoint(uri, 1).c_str()), "Binding hub XPUB");
+        hubThread = new std::thread(hub, xsub, xpub);
+    }
+    // Start the members:
+
+    std::latch bound(nmembers);
+    std::latch ready(nmembers);
+    std::latch done(nmembers);
+    Results results;
+    std::vector<std::thread*> members;
+    for (int i = 0; i < nmembers; i++) {
+        std::string pubUri;
+        std::vector<std::string> subUris;
+        if (mesh) {
+            pubUri = nthEndpoint(uri, i);
+            for (int j = 0; j < nmembers; j++) {
+                if (j != i) subUris.push_back(nthEndpoint(uri, j));
+            }
+        } else {
+            pubUri = uri;
+            subUris.push_back(nthEndpoint(uri, 1));
+        }
+        members.push_back(new std::thread(
+            member, pubUri, subUris, mesh, context, i, nmembers, nmsgs, size,
+            std::ref(bound), std::ref(ready), std::ref(done), std::ref(results)
+        ));
+    }
+    ready.wait();
+    auto start = std::chrono::steady_clock::now();
+    done.wait();
+    auto end = std::chrono::steady_clock::now();
+
+    for (auto p : members) {
+        p->join();
+        delete p;
+    }
+    checkError(zmq_ctx_term(context), "Terminating context");   // Stops the hub.
+    if (hubThread) {
+        hubThread->join();
+        delete hubThread;
+    }
+
+    // Report:
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    double kb = (double)results.deliveries*(double)size/1024.0;
+    auto& lat = results.latencies;
+    std::sort(lat.begin(), lat.end());
+
+    std::cout << "Topology:        " << (mesh ? "mesh" : "hub") << std::endl;
+    std::cout << "Members:         " << nmembers << std::endl;
+    std::cout << "Seconds:         " << secs << std::endl;
+    std::cout << "Deliveries:      " << results.deliveries << std::endl;
+    std::cout << "Deliveries/sec:  " << (double)results.deliveries/secs << std::endl;
+    std::cout << "KB/sec:          " << kb/secs << std::endl;
+    std::cout << "Latency usec p50: " << lat[lat.size()/2]
+        << " p99: " << lat[(lat.size()*99)/100]
+        << " max: " << lat.back() << std::endl;
+
+    return EXIT_SUCCESS;
+}
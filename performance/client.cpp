@@ -0,0 +1,312 @@
+/**
+ * client.cpp
+ *    Times the draft, thread-safe CLIENT/SERVER sockets.  With the default
+ * options this is pair.cpp's exchange done with CLIENT/SERVER so the two
+ * can be compared directly.  The options add more client sockets and, more
+ * interesting, several threads sharing each client socket, which is
+ * something no other socket type allows.
+ *
+ * Usage:
+ *    client [-c nclients] [-t nthreads] uri nummsgs size
+ *
+ * Where:
+ *     -c  - Number of CLIENT sockets (default 1).
+ *     -t  - Number of threads sharing each CLIENT socket (default 1).
+ *     uri - is the communication end point URI, the SERVER binds.
+ *     nummsgs - is the number of request/reply pairs each thread does.
+ *     size - is the size of the 'large' message.
+ *
+ * As in pair, two sets of timings are done:
+ *
+ * *  the clients send messages of ```size``` and get back single byte
+ *    replies.
+ * *  the clients send 1 byte messages and get back ```size``` replies.
+ *
+ * The main thread is the SERVER.  It replies to each request using the
+ * request's routing id and knows how many requests are coming so
+ * termination is simple.
+ *
+ * Threads sharing a client socket each send a request and then receive a
+ * reply; the reply need not be the one to their own request, but each
+ * thread gets exactly as many replies as it sent requests.
+ *
+ * Reported per run, besides pair's numbers, is the per-thread round trip
+ * time: with contention it grows while Msgs/sec (all threads) may not.
+ *
+ * @note CLIENT/SERVER are draft sockets: libzmq must be built with draft APIs
+ * and the program compiled with -DZMQ_BUILD_DRAFT_API (make draft).
+ * @note this is not production quality code so a missing parameter will probably
+ * result in a segfault.
+ */
+#include <thread>
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <chrono>
+#include "monitor.h"
+#include "cputime.h"
+
+#ifndef ZMQ_CLIENT
+#error "CLIENT/SERVER need the libzmq draft API: compile with -DZMQ_BUILD_DRAFT_API"
+#endif
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/**
+ * send a message (not necessarily a string) to the
+ * server:
+ *
+ * @param socket - socket to carry the message.
+ * @param msg    - Pointer to the message.
+ * @param nBytes - size of the message
+ */
+static void
+send(void* socket, void* data, size_t len) {
+    checkError(
+        zmq_send(socket, data, len, 0),
+        "Sending data on socket."
+    );
+}
+/**
+ * ignore
+ *    Receive a message and ignore it.
+ *
+ * @param socket - socket that receives the message.
+ * @note CLIENT/SERVER messages are always single part.
+ */
+static void
+ignore(void* socket) {
+    zmq_msg_t msg;
+    checkError(zmq_msg_init(&msg), "Initializing message");
+    checkError(
+        zmq_msg_recv(&msg, socket, 0),
+        "Receiving message."
+    );
+    checkError(zmq_msg_close(&msg), "Freeing message");
+}
+/**
+ *  setBuffering
+ *    Set send/receive buffers to 2MBytes.
+ * @param socket
+ *
+ */
+static void
+setBuffering(void* socket) {
+    int maxSize = 1024*1024*2;     // 2mbytes.
+    checkError(
+        zmq_setsockopt(socket, ZMQ_SNDBUF, &maxSize, sizeof(int)),
+        "Setting send buffer size"
+    );
+    checkError(
+        zmq_setsockopt(socket, ZMQ_RCVBUF, &maxSize, sizeof(int)),
+        "Setting receive buffer size"
+    );
+    int64_t maxMsg = 1024*1024*2;
+    checkError(
+        zmq_setsockopt(socket, ZMQ_MAXMSGSIZE, &maxMsg, sizeof(maxMsg)),
+        "Setting max message size"
+    );
+}
+/**
+ * requestor
+ *    One of the threads sharing a client socket.
+ * @param socket - the shared CLIENT socket.
+ * @param nmsgs - Number of request/reply pairs.
+ * @param size - Size of our requests.
+ * @param start - Latch that starts all requestors at once.
+ */
+static void
+requestor(void* socket, int nmsgs, int size, std::latch& start) {
+    char* msg = new char[size];
+    start.wait();
+    for (int i = 0; i < nmsgs; i++) {
+        send(socket, msg, size);
+        ignore(socket);
+    }
+    delete []msg;
+}
+
+/**
+ *  run
+ *     Runs one of the timings.
+ * @param uri - communications endoint uri.
+ * @param context - ZMQ context on which communication is done.
+ * @param nclients - Number of CLIENT sockets.
+ * @param nthreads - Threads per CLIENT socket.
+ * @param nummsgs - Number request/reply pairs per thread.
+ * @param reqsize - Size of the requests.
+ * @param repsize - size of the replies.
+ * @param cpuSecs - CPU seconds the process (including ZMQ's I/O threads) used.
+ * @return double precision seconds the exchanges took.
+ */
+static double
+run(
+    std::string uri, void* context, int nclients, int nthreads, int nummsgs,
+    int reqsize, int repsize, double& cpuSecs
+) {
+    auto server = checkError(
+        zmq_socket(context, ZMQ_SERVER),
+        "Creating server socket"
+    );
+    setBuffering(server);
+    SocketMonitor monitor(
+        context, server, ZMQ_EVENT_HANDSHAKE_SUCCEEDED | ZMQ_EVENT_MONITOR_STOPPED
+    );
+    checkError(
+        zmq_bind(server, uri.c_str()),
+        "Binding server socket."
+    );
+    // Connect the client sockets and wait until the server has them all:
+
+    std::latch connected(nclients);
+    std::vector<void*> clients;
+    for (int i = 0; i < nclients; i++) {
+        auto client = checkError(
+            zmq_socket(context, ZMQ_CLIENT),
+            "Creating client socket"
+        );
+        setBuffering(client);
+        checkError(
+            zmq_connect(client, uri.c_str()),
+            "Connecting client to server."
+        );
+        clients.push_back(client);
+        connected.count_down();
+    }
+    waitForPeers(monitor, uri, nclients, connected);
+
+    std::latch start(1);
+    std::vector<std::thread*> requestors;
+    for (auto client : clients) {
+        for (int t = 0; t < nthreads; t++) {
+            requestors.push_back(new std::thread(
+                requestor, client, nummsgs, reqsize, std::ref(start)
+            ));
+        }
+    }
+    // Time serving all the requests -> join:
+
+    long total = (long)nclients*nthreads*nummsgs;
+    char* reply = new char[repsize];
+    double cpuStart = processCpuSeconds();
+    auto begin = std::chrono::high_resolution_clock::now();
+    start.count_down();
+    for (long i = 0; i < total; i++) {
+        zmq_msg_t msg;
+        checkError(zmq_msg_init(&msg), "Initializing message");
+        checkError(zmq_msg_recv(&msg, server, 0), "Receiving request");
+        uint32_t routingId = zmq_msg_routing_id(&msg);
+        checkError(zmq_msg_close(&msg), "Freeing message");
+
+        checkError(zmq_msg_init_size(&msg, repsize), "Allocating reply");
+        memcpy(zmq_msg_data(&msg), reply, repsize);
+        checkError(zmq_msg_set_routing_id(&msg, routingId), "Setting routing id");
+        checkError(zmq_msg_send(&msg, server, 0), "Sending reply");
+    }
+    for (auto p : requestors) {
+        p->join();
+        delete p;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    cpuSecs = processCpuSeconds() - cpuStart;
+    delete []reply;
+
+    for (auto client : clients) {
+        checkError(zmq_close(client), "Closing client socket");
+    }
+    checkError(
+        zmq_close(server),
+        "Closing server socket"
+    );
+    // Once the monitor stops, the endpoint is released and the next run can bind it.
+
+    monitor.waitFor(ZMQ_EVENT_MONITOR_STOPPED);
+
+    auto chronoDuration = end - begin;
+    double ms =
+        (double)std::chrono::duration_cast<std::chrono::milliseconds>(chronoDuration)
+        .count();
+    return ms/1000.0;
+}
+/**
+ * report
+ *    Print the results of a run.
+ */
+static void
+report(const char* title, double duration, double cpu, double nummsgs, int threads, int size) {
+    double total = nummsgs*threads;
+    std::cout << title << std::endl;
+    std::cout << "Time    :  " << duration << std::endl;
+    std::cout << "Msgs/sec:  " << total/duration << std::endl;
+    std::cout << "KB/sec  :  " << (double)size*total/(1024.0*duration) << std::endl;
+    std::cout << "RTT usec:  " << duration*1.0e6/nummsgs << " per thread" << std::endl;
+    std::cout << "CPU secs:  " << cpu << std::endl;
+    std::cout << "Cores/Gbps: " << cpu/((double)size*total*8.0/1.0e9) << std::endl;
+}
+/**
+ * main
+ *   We are the server and time the message exchanges.
+ */
+int main(int argc, char** argv) {
+    int nclients(1);
+    int nthreads(1);
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:")) != -1) {
+        switch (opt) {
+        case 'c':
+            nclients = atoi(optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: client [-c nclients] [-t nthreads] uri nummsgs size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nummsgs = atoi(argv[optind+1]);
+    int size  =  atoi(argv[optind+2]);
+
+    auto context = checkError(
+        zmq_ctx_new(),
+        "Making ZMQ context"
+    );
+    double cpu1, cpu2;
+    double duration1 = run(uri, context, nclients, nthreads, nummsgs, size, 1, cpu1);
+    double duration2 = run(uri, context, nclients, nthreads, nummsgs, 1, size, cpu2);
+
+    checkError(
+        zmq_ctx_term(context),
+        "Terminating ZMQ context"
+    );
+
+    std::cout << "Clients:   " << nclients << " threads each: " << nthreads << std::endl;
+    report("Big sends small replies", duration1, cpu1, nummsgs, nclients*nthreads, size);
+    report("Small sends, big replies", duration2, cpu2, nummsgs, nclients*nthreads, size);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,297 @@
+/**
+ * codec.cpp
+ *    Compares the string messages reqrep.cpp used to build (and our services
+ * copied) with the binary format in ../codec.h.
+ *
+ * Usage:
+ *    codec [-a] uri nummsgs
+ * Where:
+ *    -a  count allocations per message (see allocstats.h; needs
+ *        make ALLOCSTATS=1).
+ *    uri - REQ/REP endpoint for the round trip timings.
+ *    nummsgs - messages per timing.
+ *
+ * Each format is timed two ways:
+ *
+ * *  Codec only: build a request, put it in a zmq_msg_t, get the sender id,
+ *    sequence number and text back out, close the message.  No sockets,
+ *    so this is just the cost of the format.
+ * *  Round trip: a REQ (main) and a REP thread exchange nummsgs
+ *    request/replies in that format, as reqrep does.
+ *
+ * The string path is reqrep's: the request is formatted with a
+ * std::stringstream, sent with strlen/strcpy and received into a
+ * std::string; the replier then parses the id and sequence back out of it,
+ * which the binary format gets from its header for free.
+ */
+#include <thread>
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include "../codec.h"
+#include "monitor.h"
+#include "cputime.h"
+#include "allocstats.h"
+
+enum Format {STRINGS, BINARY};
+
+enum MessageType : uint16_t {
+    REQUEST = 1,
+    REPLY   = 2
+};
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/**
+ * rcvString
+ *    reqrep's original: receive a message into a std::string.
+ * @param sock - socket to receive on.
+ * @return std::string - message string received.
+ */
+static std::string
+rcvString(void* sock) {
+    zmq_msg_t msg;
+    checkError(zmq_msg_init(&msg), "Initializing message");
+    checkError(
+        zmq_recvmsg(sock, &msg, 0),
+        "Receiving message part."
+    );
+    std::string result(reinterpret_cast<char*>(zmq_msg_data(&msg)));
+    zmq_msg_close(&msg);
+    return result;
+}
+/**
+ * sendString
+ *    reqrep's original: copy a string into a message and send it.
+ * @param sock - socket on which to send it.
+ * @param mesg - c string to send.
+ */
+static void
+sendString(void* sock, const char* mesg) {
+    zmq_msg_t msg;
+    checkError(
+        zmq_msg_init_size(&msg, strlen(mesg) + 1),
+        "Failed to allocate message copy storage."
+    );
+    strcpy(reinterpret_cast<char*>(zmq_msg_data(&msg)), mesg);
+    checkError(
+        zmq_sendmsg(sock, &msg, 0),
+        "Sending string message"
+    );
+}
+/**
+ * formatRequest
+ *    The string request.
+ */
+static std::string
+formatRequest(int id, uint64_t sequence) {
+    std::stringstream strReq;
+    strReq << "Request from " << id << " #" << sequence;
+    return strReq.str();
+}
+/**
+ * parseRequest
+ *    Get the id and sequence back out of a string request.
+ */
+static void
+parseRequest(const std::string& request, int& id, uint64_t& sequence) {
+    std::istringstream in(request);
+    std::string word;
+    char hash;
+    in >> word >> word >> id >> hash >> sequence;
+}
+
+/**
+ * codecOnly
+ *    Time encoding and decoding without a transport.
+ * @param format - Which format.
+ * @param nummsgs - How many messages.
+ * @param allocs - True to count allocations.
+ * @param counts - The allocation counts.
+ * @return double - nanoseconds per message.
+ */
+static double
+codecOnly(Format format, int nummsgs, bool allocs, AllocCounts& counts) {
+    uint64_t check(0);           // So the work isn't optimized away.
+    AllocCounter allocCounter(allocs);
+    auto start = std::chrono::high_resolution_clock::now();
+    allocCounter.start();
+    for (int i = 0; i < nummsgs; i++) {
+        zmq_msg_t msg;
+        if (format == STRINGS) {
+            std::string request = formatRequest(1, i);
+            checkError(zmq_msg_init_size(&msg, request.size() + 1), "Allocating message");
+            strcpy(reinterpret_cast<char*>(zmq_msg_data(&msg)), request.c_str());
+
+            std::string received(reinterpret_cast<char*>(zmq_msg_data(&msg)));
+            int id;
+            uint64_t sequence;
+            parseRequest(received, id, sequence);
+            check += id + sequence + received.size();
+        } else {
+            checkError(codec::encode(&msg, REQUEST, 1, i, {"Request"}), "Encoding message");
+
+            codec::Reader reader(zmq_msg_data(&msg), zmq_msg_size(&msg));
+            std::string_view text;
+            reader.next(text);
+            check += reader.header().id + reader.header().sequence + text.size();
+        }
+        zmq_msg_close(&msg);
+    }
+    allocCounter.stop();
+    auto end = std::chrono::high_resolution_clock::now();
+    counts = allocCounter.read();
+    if (check == 0) std::cerr << "Unexpected checksum\n";
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()/nummsgs;
+}
+
+/**
+ * replier
+ *    The REP side of a round trip timing.
+ * @param uri - Endpoint to bind.
+ * @param ctx - ZMQ context.
+ * @param format - Which format.
+ * @param nummsgs - Requests to answer.
+ * @param listening - Latch we count down once we're bound.
+ */
+static void
+replier(std::string uri, void* ctx, Format format, int nummsgs, std::latch& listening) {
+    auto socket = checkError(zmq_socket(ctx, ZMQ_REP), "Making replier socket.");
+    checkError(zmq_bind(socket, uri.c_str()), "binding replier socket");
+    listening.count_down();
+
+    for (int i = 0; i < nummsgs; i++) {
+        if (format == STRINGS) {
+            std::string request = rcvString(socket);
+            int id;
+            uint64_t sequence;
+            parseRequest(request, id, sequence);
+            sendString(socket, "Keep going for now");
+        } else {
+            codec::InMessage request(socket);
+            checkError(request.status(), "Receiving request");
+            checkError(
+                codec::send(socket, REPLY, 0, request.header().sequence, {"Keep going for now"}),
+                "Sending reply"
+            );
+        }
+    }
+    checkError(zmq_close(socket), "Closing rep socket.");
+}
+/**
+ * roundTrip
+ *    Time nummsgs request/replies.
+ * @param uri - Endpoint.
+ * @param format - Which format.
+ * @param nummsgs - Number of requests.
+ * @param allocs - True to count allocations.
+ * @param counts - Allocations by the whole process.
+ * @param cpuSecs - CPU seconds the process used.
+ * @return double - seconds taken.
+ */
+static double
+roundTrip(
+    std::string uri, Format format, int nummsgs, bool allocs, AllocCounts& counts,
+    double& cpuSecs
+) {
+    auto context = checkError(zmq_ctx_new(), "Making ZMQ context");
+    std::latch listening(1);
+    std::thread replyThread(replier, uri, context, format, nummsgs, std::ref(listening));
+
+    auto socket = checkError(zmq_socket(context, ZMQ_REQ), "Making request socket");
+    auto monitor = new SocketMonitor(context, socket, ZMQ_EVENT_HANDSHAKE_SUCCEEDED);
+    listening.wait();
+    checkError(zmq_connect(socket, uri.c_str()), "Connecting to the replier");
+    std::latch connected(0);
+    waitForPeers(*monitor, uri, 1, connected);
+    delete monitor;
+
+    AllocCounter allocCounter(allocs, true);
+    double cpuStart = processCpuSeconds();
+    auto start = std::chrono::high_resolution_clock::now();
+    allocCounter.start();
+    for (int i = 0; i < nummsgs; i++) {
+        if (format == STRINGS) {
+            sendString(socket, formatRequest(1, i).c_str());
+            std::string reply = rcvString(socket);
+        } else {
+            checkError(codec::send(socket, REQUEST, 1, i, {"Request"}), "Sending request");
+            codec::InMessage reply(socket);
+            checkError(reply.status(), "Receiving reply");
+        }
+    }
+    allocCounter.stop();
+    replyThread.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    cpuSecs = processCpuSeconds() - cpuStart;
+    counts = allocCounter.read();
+
+    checkError(zmq_close(socket), "Closing request socket");
+    checkError(zmq_ctx_term(context), "Terminating ZMQ context");
+
+    double ms = (double)std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+        .count();
+    return ms/1000.0;
+}
+
+int main(int argc, char** argv) {
+    bool allocs(false);
+    int opt;
+    while ((opt = getopt(argc, argv, "a")) != -1) {
+        switch (opt) {
+        case 'a':
+            allocs = true;
+            break;
+        default:
+            std::cerr << "Usage: codec [-a] uri nummsgs\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nummsgs = atoi(argv[optind+1]);
+
+    const char* names[] = {"Strings", "Binary"};
+    for (Format format : {STRINGS, BINARY}) {
+        AllocCounts codecAllocs, tripAllocs;
+        double cpuSecs;
+        double nsecs = codecOnly(format, nummsgs, allocs, codecAllocs);
+        double secs  = roundTrip(uri, format, nummsgs, allocs, tripAllocs, cpuSecs);
+
+        std::cout << names[format] << std::endl;
+        std::cout << "Codec nsec/msg: " << nsecs << std::endl;
+        std::cout << "Time    :  " << secs << std::endl;
+        std::cout << "Msgs/sec:  " << (double)nummsgs/secs << std::endl;
+        std::cout << "RTT usec:  " << secs*1.0e6/nummsgs << std::endl;
+        std::cout << "CPU secs:  " << cpuSecs << std::endl;
+        if (allocs) {
+            reportAllocCounts("Codec only", codecAllocs, nummsgs);
+            reportAllocCounts("Round trip", tripAllocs, nummsgs);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/**
+ * compress.h
+ *    Optional compression of message payloads in the timing programs.
+ *
+ * Compressing trades CPU for bytes on the wire; whether that raises the
+ * useful throughput depends on the payload (see payload.h), the message
+ * size and how fast the link is.  A Compressor compresses each message
+ * before zmq_send and the receiver decompresses each one it gets, so both
+ * costs land in the timed region and in the CPU seconds reported.
+ *
+ * Algorithms are specified as name[:level]:
+ *
+ * *  lz4    - fast, modest ratio; level is LZ4's acceleration (default 1,
+ *             higher is faster and compresses less).  Needs make COMPRESS=lz4.
+ * *  zstd   - slower, better ratio; level 1-19 (default 1).
+ *             Needs make COMPRESS=zstd.
+ *
+ * The libraries are optional; asking for one the program wasn't built with
+ * is an error.  Compressor holds per-thread state (zstd contexts), so each
+ * thread makes its own from the same specification.
+ */
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <string>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+class Compressor {
+    enum Algorithm {NONE, LZ4, ZSTD};
+    Algorithm m_algorithm;
+    int       m_level;
+    void*     m_cctx;
+    void*     m_dctx;
+public:
+    /**
+     * constructor
+     * @param spec - name[:level], empty for no compression.
+     */
+    Compressor(const std::string& spec) :
+        m_algorithm(NONE), m_level(1), m_cctx(nullptr), m_dctx(nullptr)
+    {
+        if (spec.empty()) return;
+        std::string name(spec.substr(0, spec.find(':')));
+        if (spec.find(':') != std::string::npos) {
+            m_level = atoi(spec.substr(spec.find(':') + 1).c_str());
+        }
+        if (name == "lz4") {
+#ifdef HAVE_LZ4
+            m_algorithm = LZ4;
+#else
+            unavailable(name);
+#endif
+        } else if (name == "zstd") {
+#ifdef HAVE_ZSTD
+            m_algorithm = ZSTD;
+            m_cctx = ZSTD_createCCtx();
+            m_dctx = ZSTD_createDCtx();
+#else
+            unavailable(name);
+#endif
+        } else {
+            std::cerr << "Unknown compression " << name << " (lz4 or zstd)\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    ~Compressor() {
+#ifdef HAVE_ZSTD
+        ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(m_cctx));
+        ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(m_dctx));
+#endif
+    }
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    bool enabled() const {
+        return m_algorithm != NONE;
+    }
+    /**
+     * bound
+     *   @return size_t - the largest a message of n bytes can compress to.
+     */
+    size_t bound(size_t n) const {
+        switch (m_algorithm) {
+#ifdef HAVE_LZ4
+        case LZ4:
+            return LZ4_compressBound(n);
+#endif
+#ifdef HAVE_ZSTD
+        case ZSTD:
+            return ZSTD_compressBound(n);
+#endif
+        default:
+            return n;
+        }
+    }
+    /**
+     * compress
+     * @param in - the message.
+     * @param n - its size.
+     * @param out - where the compressed message goes; bound(n) bytes.
+     * @param capacity - size of out.
+     * @return size_t - the size of the compressed message.
+     */
+    size_t compress(const char* in, size_t n, char* out, size_t capacity) {
+        switch (m_algorithm) {
+#ifdef HAVE_LZ4
+        case LZ4:
+            return check(LZ4_compress_fast(in, out, n, capacity, m_level), "compressing");
+#endif
+#ifdef HAVE_ZSTD
+        case ZSTD:
+            return checkZstd(ZSTD_compressCCtx(
+                static_cast<ZSTD_CCtx*>(m_cctx), out, capacity, in, n, m_level
+            ), "compressing");
+#endif
+        default:
+            return copy(in, n, out, capacity);
+        }
+    }
+    /**
+     * decompress
+     * @param in - a compressed message.
+     * @param n - its size.
+     * @param out - where the original goes.
+     * @param capacity - size of out.
+     * @return size_t - the size of the original.
+     */
+    size_t decompress(const char* in, size_t n, char* out, size_t capacity) {
+        switch (m_algorithm) {
+#ifdef HAVE_LZ4
+        case LZ4:
+            return check(LZ4_decompress_safe(in, out, n, capacity), "decompressing");
+#endif
+#ifdef HAVE_ZSTD
+        case ZSTD:
+            return checkZstd(ZSTD_decompressDCtx(
+                static_cast<ZSTD_DCtx*>(m_dctx), out, capacity, in, n
+            ), "decompressing");
+#endif
+        default:
+            return copy(in, n, out, capacity);
+        }
+    }
+private:
+    static void unavailable(const std::string& name) {
+        std::cerr << name << " support was not built in (make COMPRESS=" << name << ")\n";
+        exit(EXIT_FAILURE);
+    }
+    static size_t copy(const char* in, size_t n, char* out, size_t capacity) {
+        if (n > capacity) {
+            std::cerr << "Failed copying message: " << n << " bytes into " << capacity << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        memcpy(out, in, n);
+        return n;
+    }
+    [[maybe_unused]] static size_t check(int status, const char* doing) {
+        if (status <= 0) {
+            std::cerr << "Failed " << doing << " message\n";
+            exit(EXIT_FAILURE);
+        }
+        return status;
+    }
+#ifdef HAVE_ZSTD
+    static size_t checkZstd(size_t status, const char* doing) {
+        if (ZSTD_isError(status)) {
+            std::cerr << "Failed " << doing << " message " << ZSTD_getErrorName(status) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return status;
+    }
+#endif
+};
+
+/**
+ * reportCompression
+ *    Write how much was saved and what the wire rate was.
+ *
+ * @param logical - Bytes of payload the program moved.
+ * @param wire - Bytes actually handed to ZMQ.
+ * @param secs - Time taken.
+ */
+inline void
+reportCompression(double logical, double wire, double secs) {
+    std::cout << "Logical KB: " << logical/1024.0 << std::endl;
+    std::cout << "Wire KB:    " << wire/1024.0 << std::endl;
+    std::cout << "Ratio:      " << (wire > 0 ? logical/wire : 0.0) << std::endl;
+    std::cout << "Wire kb/sec " << wire/(1024.0*secs) << std::endl;
+}
+
+#endif
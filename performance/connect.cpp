@@ -0,0 +1,285 @@
+/**
+ * connect.cpp
+ *    Times connection establishment.  After a failover every client
+ * reconnects at once, so we want to know how long a connection takes
+ * to become usable and how many connections/sec a server can establish.
+ *
+ * Usage:
+ *    connect uri nconnections
+ *
+ * Where:
+ *    uri - is the endpoint URI the server (a ROUTER) binds.
+ *    nconnections - number of client (DEALER) connections made.
+ *
+ * Two measurements are done:
+ *
+ * *  Serial - clients connect one at a time.  For each we time, from
+ * the call to zmq_connect, the CONNECTED and HANDSHAKE_SUCCEEDED monitor
+ * events and the first round trip to the server (which echoes).  The
+ * connections are left up so later connections see a busier server.
+ * *  Storm - all clients call zmq_connect back to back, as they would after
+ * a failover.  We time until the server's monitor has seen all handshakes
+ * and until every client got its first echo.
+ *
+ * inproc connections generate no monitor events so only zmq_connect
+ * and first round trip times are meaningful for them.
+ *
+ * @note Each tcp connection costs several file descriptors (the client and
+ * server sockets plus each ZMQ socket's mailbox).  We raise the open file
+ * limit to the hard limit, but a few hundred connections is the practical
+ * size for a default setup.
+ */
+#include <thread>
+#include <zmq.h>
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <sys/resource.h>
+#include "monitor.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// Microseconds between two time points:
+
+static double
+usec(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+/**
+ * server
+ *    Echo server.  Every message received on the ROUTER is sent back
+ * to the client that sent it.  A message whose first byte is nonzero
+ * makes us exit.
+ *
+ * @param socket - The bound ROUTER socket (made in main so the monitor
+ *                 could be attached before the bind).
+ */
+static void
+server(void* socket) {
+    while (true) {
+        zmq_msg_t id;
+        zmq_msg_t body;
+        checkError(zmq_msg_init(&id), "Initializing id message");
+        checkError(zmq_msg_init(&body), "Initializing body message");
+        checkError(zmq_msg_recv(&id, socket, 0), "Receiving client id");
+        checkError(zmq_msg_recv(&body, socket, 0), "Receiving client message");
+        bool exiting = *reinterpret_cast<uint8_t*>(zmq_msg_data(&body)) != 0;
+
+        checkError(zmq_msg_send(&id, socket, ZMQ_SNDMORE), "Echoing client id");
+        checkError(zmq_msg_send(&body, socket, 0), "Echoing client message");
+        if (exiting) break;
+    }
+}
+/**
+ * makeClient
+ *    Make a DEALER that won't block teardown.
+ * @param ctx - ZMQ context.
+ * @return void* - the socket.
+ */
+static void*
+makeClient(void* ctx) {
+    auto socket = checkError(
+        zmq_socket(ctx, ZMQ_DEALER),
+        "Creating client socket"
+    );
+    int linger(0);
+    checkError(
+        zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)),
+        "Setting client linger"
+    );
+    return socket;
+}
+/**
+ * ping
+ *    Send a zero byte to the server and wait for the echo.
+ * @param socket - the client socket.
+ */
+static void
+ping(void* socket) {
+    char msg = 0;
+    checkError(zmq_send(socket, &msg, 1, 0), "Sending ping");
+    checkError(zmq_recv(socket, &msg, 1, 0), "Receiving echo");
+}
+
+/**
+ * report
+ *    Print the statistics for a set of latencies.
+ * @param what - what was timed.
+ * @param times - latencies in microseconds (sorted by us).
+ */
+static void
+report(const char* what, std::vector<double>& times) {
+    std::sort(times.begin(), times.end());
+    double sum(0);
+    for (auto t : times) sum += t;
+    std::cout << std::left << std::setw(20) << what << std::right
+        << " mean: " << std::setw(10) << sum/times.size()
+        << " p50: "  << std::setw(10) << times[times.size()/2]
+        << " p99: "  << std::setw(10) << times[(times.size()*99)/100]
+        << " max: "  << std::setw(10) << times.back() << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string uri(argv[1]);
+    int nconnections = atoi(argv[2]);
+    bool inproc = isInproc(uri);
+
+    // Lots of connections need lots of files:
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    auto ctx = checkError(zmq_ctx_new(), "Creating context");
+    checkError(
+        zmq_ctx_set(ctx, ZMQ_MAX_SOCKETS, 2*nconnections + 16),
+        "Setting max sockets"
+    );
+    auto serverSocket = checkError(
+        zmq_socket(ctx, ZMQ_ROUTER),
+        "Creating server socket"
+    );
+    auto serverMonitor = new SocketMonitor(ctx, serverSocket, ZMQ_EVENT_HANDSHAKE_SUCCEEDED);
+    checkError(zmq_bind(serverSocket, uri.c_str()), "Binding server socket");
+    std::thread serverThread(server, serverSocket);
+
+    // Serial connections:
+
+    std::vector<double> connectTimes;
+    std::vector<double> connectedTimes;
+    std::vector<double> handshakeTimes;
+    std::vector<double> firstMsgTimes;
+    std::vector<void*>  clients;
+
+    auto serialStart = Clock::now();
+    for (int i = 0; i < nconnections; i++) {
+        auto client = makeClient(ctx);
+        auto monitor = new SocketMonitor(
+            ctx, client, ZMQ_EVENT_CONNECTED | ZMQ_EVENT_HANDSHAKE_SUCCEEDED
+        );
+        auto start = Clock::now();
+        checkError(zmq_connect(client, uri.c_str()), "Connecting client");
+        connectTimes.push_back(usec(start, Clock::now()));
+        if (!inproc) {
+            int event;
+            while ((event = monitor->next()) != ZMQ_EVENT_HANDSHAKE_SUCCEEDED) {
+                if (event == ZMQ_EVENT_CONNECTED) {
+                    connectedTimes.push_back(usec(start, Clock::now()));
+                }
+            }
+            handshakeTimes.push_back(usec(start, Clock::now()));
+        }
+        ping(client);
+        firstMsgTimes.push_back(usec(start, Clock::now()));
+
+        checkError(
+            zmq_socket_monitor(client, nullptr, 0),
+            "Stopping client monitor"
+        );
+        delete monitor;
+        clients.push_back(client);
+    }
+    double serialSecs = usec(serialStart, Clock::now())/1.0e6;
+
+    for (auto client : clients) {
+        checkError(zmq_close(client), "Closing client socket");
+    }
+    clients.clear();
+
+    // Forget the handshakes of the serial connections:
+
+    if (!inproc) {
+        serverMonitor->waitFor(ZMQ_EVENT_HANDSHAKE_SUCCEEDED, nconnections);
+    }
+
+    // The storm:
+
+    for (int i = 0; i < nconnections; i++) {
+        clients.push_back(makeClient(ctx));
+    }
+    auto stormStart = Clock::now();
+    for (auto client : clients) {
+        checkError(zmq_connect(client, uri.c_str()), "Connecting storm client");
+    }
+    double handshakeSecs(0);
+    if (!inproc) {
+        serverMonitor->waitFor(ZMQ_EVENT_HANDSHAKE_SUCCEEDED, nconnections);
+        handshakeSecs = usec(stormStart, Clock::now())/1.0e6;
+    }
+    // The pings queue until each connection is up:
+
+    char msg = 0;
+    for (auto client : clients) {
+        checkError(zmq_send(client, &msg, 1, 0), "Sending storm ping");
+    }
+    for (auto client : clients) {
+        checkError(zmq_recv(client, &msg, 1, 0), "Receiving storm echo");
+    }
+    double stormSecs = usec(stormStart, Clock::now())/1.0e6;
+
+    // Stop the server and tear down:
+
+    msg = 0xff;
+    checkError(zmq_send(clients[0], &msg, 1, 0), "Sending server exit");
+    checkError(zmq_recv(clients[0], &msg, 1, 0), "Receiving server exit echo");
+    serverThread.join();
+
+    for (auto client : clients) {
+        checkError(zmq_close(client), "Closing storm client");
+    }
+    delete serverMonitor;
+    checkError(zmq_close(serverSocket), "Closing server socket");
+    checkError(zmq_ctx_term(ctx), "Terminating context");
+
+    // Report (latencies in microseconds):
+
+    std::cout << "Serial connections: " << nconnections << " (usec)\n";
+    report("zmq_connect", connectTimes);
+    if (inproc) {
+        std::cout << "(inproc has no connected/handshake events)\n";
+    } else {
+        report("Connected", connectedTimes);
+        report("Handshake", handshakeTimes);
+    }
+    report("First round trip", firstMsgTimes);
+    std::cout << "Seconds:          " << serialSecs << std::endl;
+    std::cout << "Connections/sec:  " << nconnections/serialSecs << std::endl;
+
+    std::cout << "Connection storm: " << nconnections << std::endl;
+    if (!inproc) {
+        std::cout << "Handshakes secs:  " << handshakeSecs << std::endl;
+        std::cout << "Handshakes/sec:   " << nconnections/handshakeSecs << std::endl;
+    }
+    std::cout << "All echoed secs:  " << stormSecs << std::endl;
+    std::cout << "Connections/sec:  " << nconnections/stormSecs << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+/**
+ * cputime.h
+ *    CPU time consumed, for the timing programs that need to say what
+ * a transfer cost and not just how long it took.
+ *
+ * processCpuSeconds includes libzmq's I/O threads, which is where the
+ * engine (framing, encryption, socket syscalls) does its work.
+ */
+#ifndef CPUTIME_H
+#define CPUTIME_H
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// User + system seconds from a getrusage result:
+
+inline double
+rusageSeconds(const struct rusage& usage) {
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec/1.0e6 +
+        (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec/1.0e6;
+}
+
+// CPU seconds used by all threads in the process so far.
+
+inline double
+processCpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return rusageSeconds(usage);
+}
+
+// CPU seconds used by the calling thread so far.
+
+inline double
+threadCpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return rusageSeconds(usage);
+}
+
+#endif
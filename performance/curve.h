@@ -0,0 +1,67 @@
+/**
+ * curve.h
+ *    Optional CURVE security for the timing programs.
+ *
+ * A Curve object made enabled generates a server and a client keypair
+ * with zmq_curve_keypair.  server() makes a socket a CURVE server and
+ * client() makes it a client that knows the server's public key.  Both
+ * must be called before the socket binds/connects.  A disabled Curve does
+ * nothing so the plaintext and encrypted runs share the same code.
+ *
+ * @note CURVE only applies to transports that go through the ZMTP engine
+ * (tcp, ipc).  inproc ignores the mechanism entirely.
+ * @note libzmq must have been built with libsodium (or tweetnacl) or
+ * zmq_curve_keypair fails with ENOTSUP.
+ */
+#ifndef CURVE_H
+#define CURVE_H
+
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+
+class Curve {
+    bool m_enabled;
+    char m_serverPublic[41];          // Z85 keys are 40 chars + null.
+    char m_serverSecret[41];
+    char m_clientPublic[41];
+    char m_clientSecret[41];
+public:
+    Curve(bool enable) : m_enabled(enable) {
+        if (m_enabled) {
+            if (zmq_curve_keypair(m_serverPublic, m_serverSecret) < 0 ||
+                zmq_curve_keypair(m_clientPublic, m_clientSecret) < 0) {
+                fail("Generating CURVE keypairs");
+            }
+        }
+    }
+    bool enabled() const { return m_enabled; }
+
+    // Make socket a CURVE server.
+    void server(void* socket) const {
+        if (!m_enabled) return;
+        int isServer(1);
+        setOption(socket, ZMQ_CURVE_SERVER, &isServer, sizeof(isServer), "Setting CURVE server");
+        setOption(socket, ZMQ_CURVE_SECRETKEY, m_serverSecret, 41, "Setting CURVE server secret key");
+    }
+    // Make socket a CURVE client of our server.
+    void client(void* socket) const {
+        if (!m_enabled) return;
+        setOption(socket, ZMQ_CURVE_SERVERKEY, m_serverPublic, 41, "Setting CURVE server key");
+        setOption(socket, ZMQ_CURVE_PUBLICKEY, m_clientPublic, 41, "Setting CURVE public key");
+        setOption(socket, ZMQ_CURVE_SECRETKEY, m_clientSecret, 41, "Setting CURVE secret key");
+    }
+private:
+    static void setOption(void* socket, int option, const void* value, size_t len, const char* doing) {
+        if (zmq_setsockopt(socket, option, value, len) < 0) {
+            fail(doing);
+        }
+    }
+    static void fail(const char* doing) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+};
+
+#endif
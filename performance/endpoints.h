@@ -0,0 +1,32 @@
+/**
+ * endpoints.h
+ *    Programs that need several endpoints (one per bus member, proxy
+ * hop...) still take a single URI on the command line.  nthEndpoint derives
+ * the others from it so the timing scripts can keep looping over the usual
+ * three transports:
+ *
+ * *  tcp://host:port  - the nth endpoint is tcp://host:(port+n).
+ * *  anything else    - "-n" is appended e.g. ipc:///tmp/bus-3.
+ *
+ * The 0'th endpoint is the URI itself.
+ */
+#ifndef ENDPOINTS_H
+#define ENDPOINTS_H
+
+#include <string>
+#include <stdlib.h>
+
+inline std::string
+nthEndpoint(const std::string& uri, int n) {
+    if (n == 0) {
+        return uri;
+    }
+    if (uri.compare(0, 6, "tcp://") == 0) {
+        auto colon = uri.rfind(':');
+        int port = atoi(uri.substr(colon + 1).c_str());
+        return uri.substr(0, colon + 1) + std::to_string(port + n);
+    }
+    return uri + "-" + std::to_string(n);
+}
+
+#endif
@@ -0,0 +1,192 @@
+/**
+ * footprint.cpp
+ *    Measures what connections and queued messages cost in memory, so
+ * container limits can be worked out from the HWM, message size and fan out
+ * rather than guessed.
+ *
+ * The sender binds, npeers receivers connect and never read.  The sender
+ * then sends without waiting until nothing more will queue: every pipe is
+ * at its high water mark (and, for tcp and ipc, the kernel buffers are
+ * full; those don't show in RSS).  Memory is sampled (see memory.h):
+ *
+ * *  before connecting, to after every peer is connected: per connection.
+ * *  from connected to full: per queued message.
+ *
+ * Usage:
+ *    footprint [-h hwm] [-t pattern] uri npeers size
+ * Where:
+ *    -h  - send and receive high water marks (default 1000, ZMQ's default).
+ *    -t  - push (default): PUSH to PULLs; each message is queued for one
+ *          peer.  pub: XPUB with ZMQ_XPUB_NODROP to SUBs; each message is
+ *          queued for every peer, sharing the data (over 33 bytes), so the
+ *          report adds the cost per queued copy.
+ *    uri - the endpoint.
+ *    npeers - receivers.
+ *    size - message size.
+ *
+ * @note this is not production code; missing parameters will segfault.
+ */
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "monitor.h"
+#include "memory.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+// Rounds of 10ms with nothing queued before we call the queues full:
+
+static const int IDLE_ROUNDS = 10;
+
+/**
+ * setOption
+ *    Set an int socket option.
+ */
+static void
+setOption(void* socket, int option, int value, const char* doing) {
+    checkError(zmq_setsockopt(socket, option, &value, sizeof(value)), doing);
+}
+/**
+ * fill
+ *    Send until nothing more will queue.  On tcp and ipc the I/O thread keeps
+ * moving messages into the kernel and the receivers' pipes for a while
+ * after the first EAGAIN, so we keep trying until it's been quiet a bit.
+ * @return int - messages queued.
+ */
+static int
+fill(void* socket, const char* message, int size) {
+    int queued(0);
+    int idle(0);
+    while (idle < IDLE_ROUNDS) {
+        if (zmq_send(socket, message, size, ZMQ_DONTWAIT) >= 0) {
+            queued++;
+            idle = 0;
+        } else if (zmq_errno() == EAGAIN) {
+            idle++;
+            usleep(10000);
+        } else {
+            checkError(-1, "Queueing messages");
+        }
+    }
+    return queued;
+}
+
+int main(int argc, char** argv) {
+    int hwm(1000);
+    std::string pattern("push");
+    int opt;
+    while ((opt = getopt(argc, argv, "h:t:")) != -1) {
+        switch (opt) {
+        case 'h':
+            hwm = atoi(optarg);
+            break;
+        case 't':
+            pattern = optarg;
+            break;
+        default:
+            std::cerr << "Usage: footprint [-h hwm] [-t push|pub] uri npeers size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int npeers = atoi(argv[optind+1]);
+    int size   = atoi(argv[optind+2]);
+    bool pub = pattern == "pub";
+    if (!pub && pattern != "push") {
+        std::cerr << "Unknown pattern " << pattern << " (push or pub)\n";
+        exit(EXIT_FAILURE);
+    }
+
+    auto ctx = checkError(zmq_ctx_new(), "Making context");
+    auto sender = checkError(zmq_socket(ctx, pub ? ZMQ_XPUB : ZMQ_PUSH), "Making sender");
+    setOption(sender, ZMQ_SNDHWM, hwm, "Setting send hwm");
+    setOption(sender, ZMQ_LINGER, 0, "Setting linger");
+    if (pub) {
+        setOption(sender, ZMQ_XPUB_VERBOSE, 1, "Setting ZMQ_XPUB_VERBOSE");
+        setOption(sender, ZMQ_XPUB_NODROP, 1, "Setting ZMQ_XPUB_NODROP");
+    }
+    auto monitor = new SocketMonitor(ctx, sender, ZMQ_EVENT_HANDSHAKE_SUCCEEDED);
+    checkError(zmq_bind(sender, uri.c_str()), "Binding sender");
+
+    // Connect the peers:
+
+    MemorySampler sampler(true);
+    sampler.start();
+    MemorySample unconnected = memoryNow();
+    std::latch connected(npeers);
+    std::vector<void*> peers;
+    for (int i = 0; i < npeers; i++) {
+        auto peer = checkError(zmq_socket(ctx, pub ? ZMQ_SUB : ZMQ_PULL), "Making receiver");
+        setOption(peer, ZMQ_RCVHWM, hwm, "Setting receive hwm");
+        setOption(peer, ZMQ_LINGER, 0, "Setting linger");
+        if (pub) {
+            checkError(zmq_setsockopt(peer, ZMQ_SUBSCRIBE, "", 0), "Subscribing");
+        }
+        checkError(zmq_connect(peer, uri.c_str()), "Connecting receiver");
+        connected.count_down();
+        peers.push_back(peer);
+    }
+    if (pub) {
+        waitForSubscribers(sender, npeers);     // Else we'd queue for nobody.
+    } else {
+        waitForPeers(*monitor, uri, npeers, connected);
+    }
+    delete monitor;
+    MemorySample peered = memoryNow();
+
+    // Fill the queues:
+
+    char* message = new char[size];
+    memset(message, 0, size);
+    int queued = fill(sender, message, size);
+    MemorySample full = memoryNow();
+    sampler.stop();
+
+    for (auto peer : peers) {
+        zmq_close(peer);
+    }
+    zmq_close(sender);
+    checkError(zmq_ctx_term(ctx), "Terminating context");
+    delete []message;
+
+    // Report:
+
+    std::cout << "Pattern:   " << pattern << " hwm: " << hwm << " peers: " << npeers
+        << " size: " << size << std::endl;
+    std::cout << "Queued:    " << queued;
+    if (pub) {
+        std::cout << " copies: " << double(queued)*npeers;
+    }
+    std::cout << std::endl;
+    reportMemory(sampler.read());
+    reportMemoryPer("connection", peered - unconnected, npeers);
+    if (queued > 0) {
+        reportMemoryPer("queued message", full - peered, queued);
+        if (pub) {
+            reportMemoryPer("queued copy", full - peered, double(queued)*npeers);
+        }
+    }
+    return EXIT_SUCCESS;
+}
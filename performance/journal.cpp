@@ -0,0 +1,383 @@
+/**
+ * journal.cpp
+ *    Times reliable publish/subscribe: the publisher journals every
+ * publication (see journal.h) and subscribers that see a gap in the
+ * sequence numbers ask a replay service for what they missed.
+ *
+ *    publisher (XPUB) ---------------------> subscribers (SUB)
+ *        |  append                                |  gaps
+ *        v                                        v
+ *    journal (mmap) <- replay service (ROUTER) <-> DEALER
+ *
+ * Every message starts with its 8 byte sequence number.  A subscriber that
+ * receives n when it expected m < n asks for [m, n) and carries on with the
+ * live stream; the replay service sends each message straight out of the
+ * journal (zmq_msg_init_data, no copy), or just its sequence number if the
+ * journal no longer holds it.  When the publisher is done it repeatedly
+ * publishes a 0 sequence followed by the last sequence number, so a loss at
+ * the end is a gap too.
+ *
+ * The same publications are timed twice:
+ * *  Lossy - no journal and no replay, what pubsub does: lost is lost.
+ * *  Journaled - with the journal and gap fill.
+ *
+ * Usage:
+ *    journal [-f path] [-n slots] uri nummsgs nsubscribers size
+ * Where:
+ *    -f  - journal file (default /tmp/journal.dat).
+ *    -n  - publications the journal holds (default 65536, rounded up to
+ *          a power of two).
+ *    uri - the publisher binds it, the replay service the next endpoint
+ *          (see endpoints.h).
+ *    nummsgs - publications.
+ *    nsubscribers - subscriber threads.
+ *    size - message size including the sequence number (at least 8).
+ *
+ * The report gives, for each run, the publisher's rate (what journaling
+ * costs the publisher) and the delivered rate (messages each subscriber got
+ * live or replayed per second, to the last one finishing).  The journaled
+ * run adds gaps, messages recovered and not recoverable, and recovery
+ * latency percentiles: from seeing a gap to having all of it.
+ *
+ * @note this is not production code; missing parameters will segfault.
+ */
+#include <thread>
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include "journal.h"
+#include "monitor.h"
+#include "endpoints.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+static double
+usecsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * replay
+ *    The replay service.  Requests are [from][to] (sequence numbers, to
+ * exclusive); each sequence in the range is answered with the journaled
+ * message, or an empty frame if it's gone.  Runs until the context is shut
+ * down.
+ *
+ * @param ctx - shared context.
+ * @param uri - where to bind.
+ * @param journal - what to replay from.
+ * @param ready - latch we count down once bound.
+ */
+static void
+replay(void* ctx, std::string uri, const Journal& journal, std::latch& ready) {
+    auto socket = checkError(zmq_socket(ctx, ZMQ_ROUTER), "Making replay ROUTER");
+    int linger(0);                // Up front: setsockopt fails with ETERM after shutdown.
+    int hwm(0);                   // A replay can be a lot of messages.
+    checkError(zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    checkError(zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm)), "Setting send hwm");
+    checkError(zmq_bind(socket, uri.c_str()), "Binding replay ROUTER");
+    ready.count_down();
+
+    while (true) {
+        zmq_msg_t id;
+        zmq_msg_init(&id);
+        uint64_t range[2];
+        if (zmq_msg_recv(&id, socket, 0) < 0) break;
+        if (zmq_recv(socket, range, sizeof(range), 0) < 0) break;
+        for (uint64_t seq = range[0]; seq < range[1]; seq++) {
+            zmq_msg_t to, msg;
+            zmq_msg_init(&to);
+            zmq_msg_copy(&to, &id);
+            size_t len;
+            const char* journaled = journal.find(seq, len);
+            if (journaled) {
+                zmq_msg_init_data(&msg, const_cast<char*>(journaled), len, nullptr, nullptr);
+            } else {
+                zmq_msg_init(&msg);                     // Gone: journaled ones are never empty.
+            }
+            zmq_msg_send(&to, socket, ZMQ_SNDMORE);
+            zmq_msg_send(&msg, socket, 0);
+        }
+        zmq_msg_close(&id);
+    }
+    if (zmq_errno() != ETERM) {
+        checkError(-1, "Running the replay service");
+    }
+    zmq_close(socket);
+}
+
+// What a subscriber saw:
+
+struct SubscriberStats {
+    uint64_t live = 0;            // Received from the publisher.
+    uint64_t lost = 0;            // Missed (lossy) .
+    uint64_t gaps = 0;            // Ranges asked for (journaled).
+    uint64_t recovered = 0;       // Replayed.
+    uint64_t unrecoverable = 0;   // The journal no longer had them.
+    std::vector<double> recoveryUsec;
+};
+// A range we've asked for:
+
+struct Gap {
+    uint64_t next;                // Next sequence number we'll be sent.
+    uint64_t to;                  // Exclusive.
+    std::chrono::steady_clock::time_point seen;
+};
+
+/**
+ * subscriber
+ *    Receive until the publisher's done and, if we have a replay service,
+ * until every gap is filled.
+ * @param ctx - shared context.
+ * @param uri - publisher's endpoint.
+ * @param replayUri - replay service's endpoint, empty for lossy.
+ * @param stats - what we saw.
+ * @param done - latch we count down when finished.
+ */
+static void
+subscriber(
+    void* ctx, std::string uri, std::string replayUri, SubscriberStats& stats, std::latch& done
+) {
+    auto live = checkError(zmq_socket(ctx, ZMQ_SUB), "Making SUB");
+    checkError(zmq_setsockopt(live, ZMQ_SUBSCRIBE, "", 0), "Subscribing");
+    checkError(zmq_connect(live, uri.c_str()), "Connecting SUB");
+    void* gapFill(nullptr);
+    if (!replayUri.empty()) {
+        gapFill = checkError(zmq_socket(ctx, ZMQ_DEALER), "Making DEALER");
+        int hwm(0);
+        checkError(zmq_setsockopt(gapFill, ZMQ_RCVHWM, &hwm, sizeof(hwm)), "Setting receive hwm");
+        checkError(zmq_connect(gapFill, replayUri.c_str()), "Connecting DEALER");
+    }
+
+    std::deque<Gap> gaps;
+    uint64_t expected(1);
+    uint64_t last(0);
+    bool     finished(false);
+    auto missed = [&](uint64_t from, uint64_t to) {
+        if (gapFill) {
+            uint64_t range[2] = {from, to};
+            checkError(zmq_send(gapFill, range, sizeof(range), 0), "Requesting replay");
+            gaps.push_back(Gap{from, to, std::chrono::steady_clock::now()});
+            stats.gaps++;
+        } else {
+            stats.lost += to - from;
+        }
+    };
+    zmq_pollitem_t items[2] = {{live, 0, ZMQ_POLLIN, 0}, {gapFill, 0, ZMQ_POLLIN, 0}};
+    while (!finished || !gaps.empty()) {
+        checkError(zmq_poll(items, gapFill ? 2 : 1, -1), "Polling");
+        if (items[0].revents & ZMQ_POLLIN) {
+            zmq_msg_t msg;
+            zmq_msg_init(&msg);
+            checkError(zmq_msg_recv(&msg, live, 0), "Receiving publication");
+            uint64_t seq = Journal::sequenceOf(zmq_msg_data(&msg));
+            if (seq == 0) {                                  // Done: [0][last].
+                if (!finished) {
+                    finished = true;
+                    last = Journal::sequenceOf(static_cast<char*>(zmq_msg_data(&msg)) + Journal::SEQ_SIZE);
+                    if (expected <= last) missed(expected, last + 1);
+                    expected = last + 1;
+                }
+            } else if (!finished && seq >= expected) {
+                if (seq > expected) missed(expected, seq);
+                expected = seq + 1;
+                stats.live++;
+            }
+            zmq_msg_close(&msg);
+        }
+        if (gapFill && (items[1].revents & ZMQ_POLLIN)) {
+            zmq_msg_t msg;
+            zmq_msg_init(&msg);
+            checkError(zmq_msg_recv(&msg, gapFill, 0), "Receiving replay");
+            Gap& gap = gaps.front();
+            if (zmq_msg_size(&msg) > 0 &&
+                Journal::sequenceOf(zmq_msg_data(&msg)) == gap.next) {
+                stats.recovered++;
+            } else {
+                stats.unrecoverable++;                       // Gone, or overwritten in flight.
+            }
+            zmq_msg_close(&msg);
+            if (++gap.next == gap.to) {
+                stats.recoveryUsec.push_back(usecsSince(gap.seen));
+                gaps.pop_front();
+            }
+        }
+    }
+    done.count_down();
+
+    int linger(0);
+    zmq_setsockopt(live, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(live);
+    if (gapFill) {
+        zmq_setsockopt(gapFill, ZMQ_LINGER, &linger, sizeof(linger));
+        zmq_close(gapFill);
+    }
+}
+
+// One timed run:
+
+struct Run {
+    double publishSecs;           // Publishing nummsgs.
+    double secs;                  // Until every subscriber finished.
+    std::vector<SubscriberStats> subscribers;
+};
+/**
+ * timeRun
+ *    Publish nummsgs (journaling them if there's a journal) to nsubscribers,
+ * then publish done until they've all finished.
+ */
+static Run
+timeRun(
+    void* ctx, void* publisher, const std::string& uri, const std::string& replayUri,
+    Journal* journal, int nummsgs, int nsubscribers, int size
+) {
+    Run run;
+    run.subscribers.resize(nsubscribers);
+    std::latch done(nsubscribers);
+    std::vector<std::thread*> subscribers;
+    for (int i = 0; i < nsubscribers; i++) {
+        subscribers.push_back(new std::thread(
+            subscriber, ctx, uri, replayUri, std::ref(run.subscribers[i]), std::ref(done)
+        ));
+    }
+    waitForSubscribers(publisher, nsubscribers);
+
+    char* message = new char[size];
+    memset(message, 0, size);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t seq = 1; seq <= uint64_t(nummsgs); seq++) {
+        if (journal) {
+            const char* journaled = journal->append(message + Journal::SEQ_SIZE, size - Journal::SEQ_SIZE);
+            checkError(zmq_send(publisher, journaled, size, 0), "Publishing");
+        } else {
+            memcpy(message, &seq, Journal::SEQ_SIZE);
+            checkError(zmq_send(publisher, message, size, 0), "Publishing");
+        }
+    }
+    run.publishSecs = usecsSince(start)/1.0e6;
+    uint64_t finish[2] = {0, uint64_t(nummsgs)};
+    while (!done.try_wait()) {
+        checkError(zmq_send(publisher, finish, sizeof(finish), 0), "Publishing done");
+        usleep(1000);
+    }
+    run.secs = usecsSince(start)/1.0e6;
+
+    for (auto t : subscribers) {
+        t->join();
+        delete t;
+    }
+    delete []message;
+    return run;
+}
+
+int main(int argc, char** argv) {
+    std::string path("/tmp/journal.dat");
+    int slots(65536);
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+        switch (opt) {
+        case 'f':
+            path = optarg;
+            break;
+        case 'n':
+            slots = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: journal [-f path] [-n slots] uri nummsgs nsubscribers size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nummsgs      = atoi(argv[optind+1]);
+    int nsubscribers = atoi(argv[optind+2]);
+    int size         = atoi(argv[optind+3]);
+    if (size < int(Journal::SEQ_SIZE)) {
+        std::cerr << "size must be at least " << Journal::SEQ_SIZE << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    auto ctx = checkError(zmq_ctx_new(), "Making context");
+    auto publisher = checkError(zmq_socket(ctx, ZMQ_XPUB), "Making publisher");
+    int verbose(1);
+    checkError(
+        zmq_setsockopt(publisher, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose)),
+        "Setting ZMQ_XPUB_VERBOSE"
+    );
+    checkError(zmq_bind(publisher, uri.c_str()), "Binding publisher");
+
+    Run lossy = timeRun(ctx, publisher, uri, "", nullptr, nummsgs, nsubscribers, size);
+
+    Journal* journal = Journal::create(path, size, slots);
+    std::string replayUri = nthEndpoint(uri, 1);
+    std::latch ready(1);
+    std::thread replayer(replay, ctx, replayUri, std::cref(*journal), std::ref(ready));
+    ready.wait();
+    Run journaled = timeRun(ctx, publisher, uri, replayUri, journal, nummsgs, nsubscribers, size);
+
+    int linger(0);
+    zmq_setsockopt(publisher, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(publisher);
+    checkError(zmq_ctx_shutdown(ctx), "Shutting down context");
+    replayer.join();
+    checkError(zmq_ctx_term(ctx), "Terminating context");
+
+    // Report:
+
+    uint64_t lossyLive(0), lost(0);
+    for (auto& s : lossy.subscribers) {
+        lossyLive += s.live;
+        lost += s.lost;
+    }
+    uint64_t live(0), gaps(0), recovered(0), unrecoverable(0);
+    std::vector<double> recovery;
+    for (auto& s : journaled.subscribers) {
+        live += s.live;
+        gaps += s.gaps;
+        recovered += s.recovered;
+        unrecoverable += s.unrecoverable;
+        recovery.insert(recovery.end(), s.recoveryUsec.begin(), s.recoveryUsec.end());
+    }
+    std::cout << "Journal:         " << journal->slots() << " slots "
+        << journal->bytes()/(1024.0*1024.0) << " MBytes\n";
+    std::cout << "Lossy publish msgs/sec:       " << nummsgs/lossy.publishSecs << std::endl;
+    std::cout << "Lossy delivered msgs/sec:     "
+        << lossyLive/nsubscribers/lossy.secs << " lost: " << lost << std::endl;
+    std::cout << "Journaled publish msgs/sec:   " << nummsgs/journaled.publishSecs << std::endl;
+    std::cout << "Journaled delivered msgs/sec: "
+        << (live + recovered)/nsubscribers/journaled.secs << std::endl;
+    std::cout << "Gaps:            " << gaps << " recovered: " << recovered
+        << " unrecoverable: " << unrecoverable << std::endl;
+    if (!recovery.empty()) {
+        std::sort(recovery.begin(), recovery.end());
+        std::cout << "Recovery usec p50: " << recovery[recovery.size()/2]
+            << " p99: " << recovery[recovery.size()*99/100]
+            << " max: " << recovery.back() << std::endl;
+    }
+    delete journal;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+/**
+ * journal.h
+ *    A memory mapped ring journal of publications, indexed by sequence
+ * number, so a replay service can retransmit what subscribers missed.
+ *
+ * *  The journal is a file (open + mmap MAP_SHARED) so a replay service in
+ *    another process could map it too; here it's shared between threads.
+ * *  Publication n lives in slot n % nslots until nslots more publications
+ *    overwrite it.  Each slot holds the message length then the message,
+ *    and every message starts with its own 8 byte sequence number, so what
+ *    the publisher sends, what the journal holds and what a replay sends
+ *    are the same bytes.
+ * *  There's a single appender.  It fills a slot and then publishes the new
+ *    last sequence number (release); readers check a sequence number is
+ *    still held against it (acquire).
+ *
+ * find returns a pointer into the mapping so a replay can be sent with
+ * zmq_msg_init_data and no copy.  Nothing stops the appender overwriting a
+ * slot while such a message is still queued: size the journal so replays
+ * finish well inside nslots publications.  Receivers should check the
+ * sequence number in the message, which is how an overwrite shows up.
+ *
+ * Journal::create makes (replacing) the file; Journal::open maps an existing
+ * one.  The creator unlinks it on destruction.
+ */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <iostream>
+
+class Journal {
+    struct Header {
+        uint64_t                  msgSize;   // Largest message (including its sequence).
+        uint64_t                  nslots;    // Power of two.
+        uint64_t                  stride;    // Bytes between slots.
+        alignas(64) std::atomic<uint64_t> last;  // Last sequence appended, 0 for none.
+    };
+    // Each slot is the message length then the message:
+
+    static const size_t LEN_OFFSET  = 0;
+    static const size_t DATA_OFFSET = 8;
+
+    std::string m_path;
+    bool        m_owner;
+    size_t      m_size;
+    Header*     m_header;
+    char*       m_slots;
+public:
+    static const size_t SEQ_SIZE = sizeof(uint64_t);   // Sequence at the front of each message.
+
+    /**
+     * create
+     *    Make a new journal.
+     * @param path - file to map.
+     * @param msgSize - Largest message, including the sequence number.
+     * @param nslots - Publications held; rounded up to a power of two.
+     * @return Journal* - the journal, delete it when done.
+     */
+    static Journal* create(const std::string& path, size_t msgSize, size_t nslots) {
+        size_t n(1);
+        while (n < nslots) n *= 2;
+        size_t stride = (DATA_OFFSET + msgSize + 63) & ~size_t(63);
+        size_t size = sizeof(Header) + n*stride;
+
+        unlink(path.c_str());
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) fail("Creating journal");
+        if (ftruncate(fd, size) < 0) fail("Sizing journal");
+        Journal* journal = new Journal(path, true, fd, size);
+
+        Header* h = journal->m_header;
+        h->msgSize = msgSize;
+        h->nslots  = n;
+        h->stride  = stride;
+        new (&h->last) std::atomic<uint64_t>(0);
+        return journal;
+    }
+    /**
+     * open
+     *    Map a journal someone else created.
+     * @param path - its file.
+     * @return Journal* - the journal, delete it when done.
+     */
+    static Journal* open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDWR);
+        if (fd < 0) fail("Opening journal");
+        struct stat info;
+        if (fstat(fd, &info) < 0) fail("Getting journal size");
+        return new Journal(path, false, fd, info.st_size);
+    }
+    ~Journal() {
+        munmap(m_header, m_size);
+        if (m_owner) {
+            unlink(m_path.c_str());
+        }
+    }
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /**
+     * append
+     *    Journal the next publication.
+     * @param body - what follows the sequence number.
+     * @param len  - its size; len + SEQ_SIZE at most the message size.
+     * @return char* - the message (sequence then body) in the journal, ready
+     *                 to publish; it's len + SEQ_SIZE bytes.
+     * @note there's only one appender per journal.
+     */
+    char* append(const void* body, size_t len) {
+        if (len + SEQ_SIZE > m_header->msgSize) {
+            std::cerr << "Message of " << len + SEQ_SIZE << " bytes won't fit a "
+                << m_header->msgSize << " byte journal slot\n";
+            exit(EXIT_FAILURE);
+        }
+        uint64_t seq = m_header->last.load(std::memory_order_relaxed) + 1;
+        char* slot = slotOf(seq);
+        *reinterpret_cast<uint64_t*>(slot + LEN_OFFSET) = len + SEQ_SIZE;
+        memcpy(slot + DATA_OFFSET, &seq, SEQ_SIZE);
+        memcpy(slot + DATA_OFFSET + SEQ_SIZE, body, len);
+        m_header->last.store(seq, std::memory_order_release);
+        return slot + DATA_OFFSET;
+    }
+    /**
+     * find
+     *    Locate a journaled message.
+     * @param seq - its sequence number.
+     * @param[out] len - its size.
+     * @return const char* - the message in the journal, nullptr if seq hasn't
+     *                       been appended or has been overwritten.
+     */
+    const char* find(uint64_t seq, size_t& len) const {
+        uint64_t last = m_header->last.load(std::memory_order_acquire);
+        if (seq == 0 || seq > last || last - seq >= m_header->nslots) {
+            return nullptr;
+        }
+        const char* slot = slotOf(seq);
+        len = *reinterpret_cast<const uint64_t*>(slot + LEN_OFFSET);
+        return slot + DATA_OFFSET;
+    }
+    /**
+     * last
+     *   @return uint64_t - the last sequence number appended, 0 if none.
+     */
+    uint64_t last() const {
+        return m_header->last.load(std::memory_order_acquire);
+    }
+    /**
+     * slots
+     *   @return size_t - publications the journal holds.
+     */
+    size_t slots() const {
+        return m_header->nslots;
+    }
+    /**
+     * bytes
+     *   @return size_t - size of the mapping.
+     */
+    size_t bytes() const {
+        return m_size;
+    }
+    /**
+     * sequenceOf
+     *   @return uint64_t - the sequence number at the front of a message.
+     */
+    static uint64_t sequenceOf(const void* message) {
+        uint64_t seq;
+        memcpy(&seq, message, SEQ_SIZE);
+        return seq;
+    }
+private:
+    Journal(const std::string& path, bool owner, int fd, size_t size) :
+        m_path(path), m_owner(owner), m_size(size)
+    {
+        void* p = mmap(                         // Populate: no page faults while timing.
+            nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0
+        );
+        if (p == MAP_FAILED) fail("Mapping journal");
+        close(fd);
+        m_header = reinterpret_cast<Header*>(p);
+        m_slots  = reinterpret_cast<char*>(p) + sizeof(Header);
+    }
+    char* slotOf(uint64_t seq) const {
+        return m_slots + (seq & (m_header->nslots - 1))*m_header->stride;
+    }
+    static void fail(const char* doing) {
+        std::cerr << "Failed " << doing << " " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+};
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ * lanes.cpp
+ *    Times small control messages sent while bulk data saturates the
+ * connection, with the control messages:
+ *
+ * *  Shared - on the same socket as the bulk data, as pair and push do:
+ *    each one waits behind whatever bulk is already queued (head of line
+ *    blocking).
+ * *  Lanes - on a second, high priority socket.  The receiver polls both and
+ *    always drains the control socket before taking the next bulk message.
+ *
+ * The sender sends bulk messages whenever the bulk socket will take one and
+ * a control message every 1/rate seconds.  Control messages carry the time
+ * they were due, so a sender stuck behind a full bulk queue is counted in
+ * their latency too (see the open loop mode of req).
+ *
+ * Usage:
+ *    lanes [-t pattern] [-r rate] [-n ncontrol] [-h hwm] uri bulksize
+ * Where:
+ *    -t  - pair (default) or push: the socket types of both lanes.
+ *    -r  - control messages/sec (default 1000).
+ *    -n  - control messages timed in each mode (default 2000).
+ *    -h  - bulk lane send and receive high water marks (default 100).
+ *    uri - the bulk lane (and the shared socket); the control lane is the
+ *          next endpoint (see endpoints.h).
+ *    bulksize - bulk message size.  Control messages are 64 bytes.
+ *
+ * The report gives, for each mode, control latency percentiles in usec and
+ * the bulk throughput achieved meanwhile.
+ *
+ * @note this is not production code; missing parameters will segfault.
+ */
+#include <thread>
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "endpoints.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Message types (first byte); control messages then carry their due time:
+
+static const char BULK    = 0;
+static const char CONTROL = 1;
+static const char END     = 2;
+static const size_t STAMP_OFFSET = 1;
+static const int CONTROL_SIZE = 64;
+static const int WARMUP = 10;           // Control messages not counted.
+
+// steady_clock nanoseconds:
+
+static int64_t
+now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+/**
+ * makeSocket
+ *    Make a socket with linger 0 and, if hwm > 0, those high water marks.
+ */
+static void*
+makeSocket(void* ctx, int type, int hwm) {
+    auto socket = checkError(zmq_socket(ctx, type), "Making socket");
+    int linger(0);
+    checkError(zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    if (hwm > 0) {
+        checkError(zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm)), "Setting send hwm");
+        checkError(zmq_setsockopt(socket, ZMQ_RCVHWM, &hwm, sizeof(hwm)), "Setting receive hwm");
+    }
+    return socket;
+}
+
+// What the receiver saw:
+
+struct Received {
+    std::vector<double> latencies;       // Control, usec.
+    int bulk = 0;
+};
+/**
+ * handle
+ *    Account for a message.
+ * @return bool - false if it was the END.
+ */
+static bool
+handle(zmq_msg_t& msg, Received& got) {
+    const char* data = static_cast<const char*>(zmq_msg_data(&msg));
+    if (*data == CONTROL) {
+        int64_t due;
+        memcpy(&due, data + STAMP_OFFSET, sizeof(due));
+        got.latencies.push_back((now() - due)/1000.0);
+    } else if (*data == BULK) {
+        got.bulk++;
+    }
+    return *data != END;
+}
+/**
+ * receiver
+ *    Receive until END.  With a control socket, poll both and drain control
+ * before each bulk message.
+ *
+ * @param bulk - the bulk (or shared) socket, bound.
+ * @param control - the control socket, bound, or nullptr (shared).
+ * @param got - what we saw.
+ */
+static void
+receiver(void* bulk, void* control, Received& got) {
+    bool running(true);
+    zmq_pollitem_t items[2] = {{control, 0, ZMQ_POLLIN, 0}, {bulk, 0, ZMQ_POLLIN, 0}};
+    while (running) {
+        zmq_msg_t msg;
+        zmq_msg_init(&msg);
+        if (!control) {
+            checkError(zmq_msg_recv(&msg, bulk, 0), "Receiving");
+            running = handle(msg, got);
+            zmq_msg_close(&msg);
+            continue;
+        }
+        checkError(zmq_poll(items, 2, -1), "Polling");
+        while (running && zmq_msg_recv(&msg, control, ZMQ_DONTWAIT) >= 0) {   // Control first.
+            running = handle(msg, got);
+        }
+        if (running && zmq_errno() != EAGAIN) {
+            checkError(-1, "Receiving control");
+        }
+        if (running && (items[1].revents & ZMQ_POLLIN) &&
+            zmq_msg_recv(&msg, bulk, ZMQ_DONTWAIT) >= 0) {
+            running = handle(msg, got);
+        }
+        zmq_msg_close(&msg);
+    }
+}
+
+// A mode's timings:
+
+struct LaneTimes {
+    std::vector<double> latencies;
+    double bulkPerSec;
+};
+/**
+ * timeMode
+ *    Set up the lanes (one shared socket or two), run the sender in this
+ * thread and the receiver in another and tear down.
+ */
+static LaneTimes
+timeMode(
+    bool lanes, int type, const std::string& uri, int rate, int ncontrol, int hwm, int bulksize
+) {
+    auto ctx = checkError(zmq_ctx_new(), "Making context");
+    int receiveType = (type == ZMQ_PUSH) ? ZMQ_PULL : ZMQ_PAIR;
+    auto bulkIn = makeSocket(ctx, receiveType, hwm);
+    void* controlIn(nullptr);
+    checkError(zmq_bind(bulkIn, uri.c_str()), "Binding bulk lane");
+    if (lanes) {
+        controlIn = makeSocket(ctx, receiveType, 0);
+        checkError(zmq_bind(controlIn, nthEndpoint(uri, 1).c_str()), "Binding control lane");
+    }
+    auto bulkOut = makeSocket(ctx, type, hwm);
+    void* controlOut = bulkOut;
+    checkError(zmq_connect(bulkOut, uri.c_str()), "Connecting bulk lane");
+    if (lanes) {
+        controlOut = makeSocket(ctx, type, 0);
+        checkError(zmq_connect(controlOut, nthEndpoint(uri, 1).c_str()), "Connecting control lane");
+    }
+    Received got;
+    std::thread* reader = new std::thread(receiver, bulkIn, controlIn, std::ref(got));
+
+    char* bulk = new char[bulksize];
+    memset(bulk, 0, bulksize);
+    *bulk = BULK;
+    char control[CONTROL_SIZE];
+    memset(control, 0, sizeof(control));
+    *control = CONTROL;
+
+    // Bulk whenever there's room, control when due:
+
+    int64_t interval = 1000000000LL/(rate > 0 ? rate : 1);
+    int64_t due = now() + interval;
+    auto start = std::chrono::steady_clock::now();
+    zmq_pollitem_t item = {bulkOut, 0, ZMQ_POLLOUT, 0};
+    for (int sent = 0; sent < WARMUP + ncontrol; ) {
+        int64_t wait = due - now();
+        if (wait <= 0) {
+            memcpy(control + STAMP_OFFSET, &due, sizeof(due));
+            checkError(zmq_send(controlOut, control, sizeof(control), 0), "Sending control");
+            due += interval;
+            sent++;
+            continue;
+        }
+        checkError(zmq_poll(&item, 1, wait/1000000), "Polling bulk lane");
+        if (item.revents & ZMQ_POLLOUT) {
+            if (zmq_send(bulkOut, bulk, bulksize, ZMQ_DONTWAIT) < 0 && zmq_errno() != EAGAIN) {
+                checkError(-1, "Sending bulk");
+            }
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    *control = END;
+    checkError(zmq_send(controlOut, control, sizeof(control), 0), "Sending end");
+    reader->join();
+    delete reader;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    zmq_close(bulkOut);
+    zmq_close(bulkIn);
+    if (lanes) {
+        zmq_close(controlOut);
+        zmq_close(controlIn);
+    }
+    checkError(zmq_ctx_term(ctx), "Terminating context");
+    delete []bulk;
+
+    LaneTimes times;
+    times.latencies.assign(got.latencies.begin() + WARMUP, got.latencies.end());
+    times.bulkPerSec = got.bulk/secs;
+    return times;
+}
+/**
+ * report
+ *    One mode's line.
+ */
+static void
+report(const char* mode, LaneTimes& times, int bulksize) {
+    auto& l = times.latencies;
+    std::sort(l.begin(), l.end());
+    size_t n = l.size();
+    std::cout << mode << " control latency usec p50: " << l[n/2] << " p99: " << l[(n*99)/100]
+        << " p99.9: " << l[(n*999)/1000] << " max: " << l.back() << std::endl;
+    std::cout << mode << " bulk msgs/sec: " << times.bulkPerSec
+        << " MB/sec: " << times.bulkPerSec*bulksize/(1024.0*1024.0) << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string pattern("pair");
+    int rate(1000);
+    int ncontrol(2000);
+    int hwm(100);
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:n:h:")) != -1) {
+        switch (opt) {
+        case 't':
+            pattern = optarg;
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'n':
+            ncontrol = atoi(optarg);
+            break;
+        case 'h':
+            hwm = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: lanes [-t pair|push] [-r rate] [-n ncontrol] [-h hwm] uri bulksize\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int bulksize = atoi(argv[optind+1]);
+    int type(ZMQ_PAIR);
+    if (pattern == "push") {
+        type = ZMQ_PUSH;
+    } else if (pattern != "pair") {
+        std::cerr << "Unknown pattern " << pattern << " (pair or push)\n";
+        exit(EXIT_FAILURE);
+    }
+    if (bulksize < 1) bulksize = 1;
+    if (ncontrol < 1) ncontrol = 1;
+
+    LaneTimes shared = timeMode(false, type, uri, rate, ncontrol, hwm, bulksize);
+    LaneTimes lanes  = timeMode(true, type, uri, rate, ncontrol, hwm, bulksize);
+
+    std::cout << "Pattern:   " << pattern << " bulk size: " << bulksize << " hwm: " << hwm
+        << " control/sec: " << rate << std::endl;
+    report("Shared", shared, bulksize);
+    report("Lanes ", lanes, bulksize);
+    return EXIT_SUCCESS;
+}
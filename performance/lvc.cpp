@@ -0,0 +1,480 @@
+/**
+ * lvc.cpp
+ *    Times a last value cache (see lvc.h) and the snapshots it serves to
+ * late joining subscribers.
+ *
+ *    publisher (XPUB) -> [SUB  cache  XPUB] -> subscribers
+ *                              ROUTER      <-> joiners' DEALERs (snapshots)
+ *
+ * The cache passes the stream on, numbering each message, and keeps the
+ * newest message on each topic.  A joiner subscribes to the live stream
+ * then asks the ROUTER for a snapshot: every cached topic and value,
+ * followed by the number of the last message the snapshot includes.  Live
+ * messages up to that number are discarded; the next must follow it
+ * exactly or the joiner missed something between its subscription landing
+ * and the snapshot, and asks again.  Topics starting with $ are control
+ * messages and aren't cached.
+ *
+ * Usage:
+ *    lvc [-s size] [-r rate] uri ntopics nummsgs njoiners
+ * Where:
+ *    -s  - value size (default 64).
+ *    -r  - publications/sec while joiners take snapshots (default 10000).
+ *    uri - the publisher binds it, the cache's XPUB binds the next endpoint
+ *          and its ROUTER the one after (see endpoints.h).
+ *    ntopics - topics published round robin.
+ *    nummsgs - messages published for the throughput timings.
+ *    njoiners - subscribers that join at once for the snapshot timing.
+ *
+ * Three timings are reported:
+ * *  Direct - nummsgs from the publisher straight to a subscriber.
+ * *  Cached - the same through the cache.
+ * *  Snapshots - njoiners join while the publisher publishes at rate:
+ *    how long snapshots take and how long until each joiner is in
+ *    sequence on the live stream.
+ *
+ * Publishers and the cache wait for subscriptions rather than sleeping (see
+ * waitForSubscribers in monitor.h).
+ *
+ * @note this is not production code; missing parameters will segfault.
+ */
+#include <thread>
+#include <latch>
+#include <atomic>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "lvc.h"
+#include "monitor.h"
+#include "endpoints.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+/**
+ * setUnlimited
+ *    No high water marks; snapshots are one message per topic and a joiner
+ * must not lose live messages while it reads one.  The publisher, the
+ * cache's SUB and the counters have none either, so the cache sees every
+ * topic and the throughput timings count every message.
+ */
+static void
+setUnlimited(void* socket) {
+    int hwm(0);
+    checkError(zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm)), "Setting send hwm");
+    checkError(zmq_setsockopt(socket, ZMQ_RCVHWM, &hwm, sizeof(hwm)), "Setting receive hwm");
+}
+/**
+ * setVerbose
+ *    Have an XPUB pass up every subscription.
+ */
+static void
+setVerbose(void* xpub) {
+    int verbose(1);
+    checkError(
+        zmq_setsockopt(xpub, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose)),
+        "Setting ZMQ_XPUB_VERBOSE"
+    );
+}
+static std::string
+topicName(int n) {
+    return "prices." + std::to_string(n);
+}
+static bool
+isControl(zmq_msg_t* topic) {
+    return zmq_msg_size(topic) > 0 && *static_cast<char*>(zmq_msg_data(topic)) == '$';
+}
+static double
+msecsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * cache
+ *    The last value cache.  Runs until the context is shut down.
+ *
+ * @param ctx - shared context.
+ * @param uri - base uri: the publisher's endpoint.
+ * @param subscribers - count of subscriptions on our live XPUB.
+ * @param ready - latch we count down once bound.
+ */
+static void
+cache(void* ctx, std::string uri, std::atomic<int>& subscribers, std::latch& ready) {
+    auto upstream = checkError(zmq_socket(ctx, ZMQ_SUB), "Making cache SUB");
+    auto live     = checkError(zmq_socket(ctx, ZMQ_XPUB), "Making cache XPUB");
+    auto snapshot = checkError(zmq_socket(ctx, ZMQ_ROUTER), "Making cache ROUTER");
+    int linger(0);                // Up front: setsockopt fails with ETERM after shutdown.
+    for (auto s : {upstream, live, snapshot}) {
+        checkError(zmq_setsockopt(s, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    }
+    setUnlimited(upstream);
+    setUnlimited(live);
+    setUnlimited(snapshot);
+    setVerbose(live);
+    checkError(zmq_setsockopt(upstream, ZMQ_SUBSCRIBE, "", 0), "Subscribing cache");
+    checkError(zmq_bind(live, nthEndpoint(uri, 1).c_str()), "Binding cache XPUB");
+    checkError(zmq_bind(snapshot, nthEndpoint(uri, 2).c_str()), "Binding cache ROUTER");
+    checkError(zmq_connect(upstream, uri.c_str()), "Connecting cache SUB");
+    ready.count_down();
+
+    LastValueCache values;
+    uint64_t sequence(0);
+    zmq_pollitem_t items[3] = {
+        {upstream, 0, ZMQ_POLLIN, 0}, {snapshot, 0, ZMQ_POLLIN, 0}, {live, 0, ZMQ_POLLIN, 0}
+    };
+    while (zmq_poll(items, 3, -1) >= 0) {
+        if (items[0].revents & ZMQ_POLLIN) {
+            // [topic][value] -> cache, then on as [topic][sequence][value]:
+
+            zmq_msg_t topic, value;
+            zmq_msg_init(&topic);
+            zmq_msg_init(&value);
+            if (zmq_msg_recv(&topic, upstream, 0) < 0) break;
+            if (zmq_msg_recv(&value, upstream, 0) < 0) break;
+            sequence++;
+            if (!isControl(&topic)) {
+                values.update(&topic, &value);
+            }
+            zmq_msg_send(&topic, live, ZMQ_SNDMORE);
+            zmq_send(live, &sequence, sizeof(sequence), ZMQ_SNDMORE);
+            zmq_msg_send(&value, live, 0);
+        }
+        if (items[1].revents & ZMQ_POLLIN) {
+            // [id][request] -> [id][topic][value]... [id][$END][sequence]:
+
+            zmq_msg_t id, request;
+            zmq_msg_init(&id);
+            zmq_msg_init(&request);
+            if (zmq_msg_recv(&id, snapshot, 0) < 0) break;
+            if (zmq_msg_recv(&request, snapshot, 0) < 0) break;
+            zmq_msg_close(&request);
+            values.forEach([&](zmq_msg_t* topic, zmq_msg_t* value) {
+                zmq_msg_t i, t, v;
+                zmq_msg_init(&i);
+                zmq_msg_init(&t);
+                zmq_msg_init(&v);
+                zmq_msg_copy(&i, &id);
+                zmq_msg_copy(&t, topic);
+                zmq_msg_copy(&v, value);
+                zmq_msg_send(&i, snapshot, ZMQ_SNDMORE);
+                zmq_msg_send(&t, snapshot, ZMQ_SNDMORE);
+                zmq_msg_send(&v, snapshot, 0);
+            });
+            zmq_msg_send(&id, snapshot, ZMQ_SNDMORE);
+            zmq_send(snapshot, "$END", 4, ZMQ_SNDMORE);
+            zmq_send(snapshot, &sequence, sizeof(sequence), 0);
+        }
+        if (items[2].revents & ZMQ_POLLIN) {
+            zmq_msg_t sub;
+            zmq_msg_init(&sub);
+            if (zmq_msg_recv(&sub, live, 0) < 0) break;
+            if (zmq_msg_size(&sub) > 0 && *static_cast<uint8_t*>(zmq_msg_data(&sub)) == 1) {
+                subscribers++;
+            }
+            zmq_msg_close(&sub);
+        }
+    }
+    if (zmq_errno() != ETERM) {
+        checkError(-1, "Running the cache");
+    }
+    for (auto s : {upstream, live, snapshot}) {
+        zmq_close(s);
+    }
+}
+
+/**
+ * counter
+ *    Counts publications until a $DONE.
+ * @param ctx - shared context.
+ * @param uri - where to subscribe.
+ * @param cached - True if the messages come through the cache (sequenced).
+ * @param done - latch we count down on $DONE.
+ * @param received - messages received.
+ * @param lost - sequence numbers we didn't see (cached only).
+ */
+static void
+counter(
+    void* ctx, std::string uri, bool cached, std::latch& done, int& received, int& lost
+) {
+    auto socket = checkError(zmq_socket(ctx, ZMQ_SUB), "Making counter SUB");
+    setUnlimited(socket);
+    checkError(zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "", 0), "Subscribing counter");
+    checkError(zmq_connect(socket, uri.c_str()), "Connecting counter");
+    received = 0;
+    lost = 0;
+    uint64_t last(0);
+    bool finished(false);
+    while (!finished) {
+        zmq_msg_t part;
+        zmq_msg_init(&part);
+        checkError(zmq_msg_recv(&part, socket, 0), "Receiving topic");
+        finished = isControl(&part);
+        zmq_msg_close(&part);
+        if (cached) {
+            uint64_t sequence;
+            checkError(zmq_recv(socket, &sequence, sizeof(sequence), 0), "Receiving sequence");
+            if (last && sequence != last + 1) lost += sequence - last - 1;
+            last = sequence;
+        }
+        zmq_msg_init(&part);
+        checkError(zmq_msg_recv(&part, socket, 0), "Receiving value");
+        zmq_msg_close(&part);
+        if (!finished) received++;
+    }
+    done.count_down();
+    int linger(0);
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(socket);
+}
+
+// What a joiner saw:
+
+struct JoinStats {
+    double snapshotMs = 0;    // First request to the last snapshot's $END.
+    double syncMs = 0;        // First request to the first in sequence live message.
+    int    topics = 0;        // In the last snapshot.
+    int    resyncs = 0;       // Snapshots after the first.
+};
+/**
+ * joiner
+ *    Join late: subscribe, take a snapshot, then follow the live stream.
+ * @param ctx - shared context.
+ * @param uri - base uri.
+ * @param stats - what we saw.
+ * @param joined - latch we count down when in sequence.
+ */
+static void
+joiner(void* ctx, std::string uri, JoinStats& stats, std::latch& joined) {
+    auto live = checkError(zmq_socket(ctx, ZMQ_SUB), "Making joiner SUB");
+    auto snapshot = checkError(zmq_socket(ctx, ZMQ_DEALER), "Making joiner DEALER");
+    setUnlimited(live);
+    setUnlimited(snapshot);
+    checkError(zmq_setsockopt(live, ZMQ_SUBSCRIBE, "", 0), "Subscribing joiner");
+    checkError(zmq_connect(live, nthEndpoint(uri, 1).c_str()), "Connecting joiner SUB");
+    checkError(zmq_connect(snapshot, nthEndpoint(uri, 2).c_str()), "Connecting joiner DEALER");
+
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        // Snapshot:
+
+        checkError(zmq_send(snapshot, "SNAPSHOT", 8, 0), "Requesting snapshot");
+        int topics(0);
+        uint64_t through(0);
+        while (true) {
+            zmq_msg_t topic, value;
+            zmq_msg_init(&topic);
+            zmq_msg_init(&value);
+            checkError(zmq_msg_recv(&topic, snapshot, 0), "Receiving snapshot topic");
+            checkError(zmq_msg_recv(&value, snapshot, 0), "Receiving snapshot value");
+            bool end = isControl(&topic);
+            if (end) memcpy(&through, zmq_msg_data(&value), sizeof(through));
+            zmq_msg_close(&topic);
+            zmq_msg_close(&value);
+            if (end) break;
+            topics++;                              // A real subscriber would keep it.
+        }
+        stats.snapshotMs = msecsSince(start);
+        stats.topics = topics;
+
+        // Skip live messages the snapshot covered; the next one must follow it:
+
+        uint64_t sequence(0);
+        do {
+            zmq_msg_t part;
+            zmq_msg_init(&part);
+            checkError(zmq_msg_recv(&part, live, 0), "Receiving live topic");
+            zmq_msg_close(&part);
+            checkError(zmq_recv(live, &sequence, sizeof(sequence), 0), "Receiving live sequence");
+            zmq_msg_init(&part);
+            checkError(zmq_msg_recv(&part, live, 0), "Receiving live value");
+            zmq_msg_close(&part);
+        } while (sequence <= through);
+        if (sequence == through + 1) break;
+        stats.resyncs++;                           // Missed some; start again.
+    }
+    stats.syncMs = msecsSince(start);
+    joined.count_down();
+
+    int linger(0);
+    zmq_setsockopt(live, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(snapshot, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(live);
+    zmq_close(snapshot);
+}
+
+/**
+ * publish
+ *    Publish [topic][value].
+ */
+static void
+publish(void* socket, const std::string& topic, const char* value, int size) {
+    checkError(zmq_send(socket, topic.data(), topic.size(), ZMQ_SNDMORE), "Publishing topic");
+    checkError(zmq_send(socket, value, size, 0), "Publishing value");
+}
+/**
+ * timeStream
+ *    Publish nummsgs round robin over the topics, then $DONE until the
+ * subscriber has it.
+ * @return double - seconds.
+ */
+static double
+timeStream(
+    void* publisher, const std::vector<std::string>& topics, const char* value, int size,
+    int nummsgs, std::latch& done
+) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nummsgs; i++) {
+        publish(publisher, topics[i % topics.size()], value, size);
+    }
+    while (!done.try_wait()) {
+        publish(publisher, "$DONE", value, size);
+        usleep(100);
+    }
+    return msecsSince(start)/1000.0;
+}
+
+int main(int argc, char** argv) {
+    int size(64);
+    int rate(10000);
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+        switch (opt) {
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: lvc [-s size] [-r rate] uri ntopics nummsgs njoiners\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int ntopics  = atoi(argv[optind+1]);
+    int nummsgs  = atoi(argv[optind+2]);
+    int njoiners = atoi(argv[optind+3]);
+
+    std::vector<std::string> topics;
+    for (int i = 0; i < ntopics; i++) topics.push_back(topicName(i));
+    char* value = new char[size];
+    memset(value, 0, size);
+
+    auto ctx = checkError(zmq_ctx_new(), "Making context");
+    auto publisher = checkError(zmq_socket(ctx, ZMQ_XPUB), "Making publisher");
+    setUnlimited(publisher);
+    setVerbose(publisher);
+    checkError(zmq_bind(publisher, uri.c_str()), "Binding publisher");
+
+    // Direct:
+
+    int directReceived, directLost;
+    std::latch directDone(1);
+    std::thread direct(
+        counter, ctx, uri, false, std::ref(directDone), std::ref(directReceived),
+        std::ref(directLost)
+    );
+    waitForSubscribers(publisher, 1);
+    double directSecs = timeStream(publisher, topics, value, size, nummsgs, directDone);
+    direct.join();
+
+    // Through the cache; wait for its subscription to us and the counter's to it:
+
+    std::atomic<int> cacheSubscribers(0);
+    std::latch ready(1);
+    std::thread cacheThread(cache, ctx, uri, std::ref(cacheSubscribers), std::ref(ready));
+    ready.wait();
+    waitForSubscribers(publisher, 1);
+    int cachedReceived, cachedLost;
+    std::latch cachedDone(1);
+    std::thread cached(
+        counter, ctx, nthEndpoint(uri, 1), true, std::ref(cachedDone), std::ref(cachedReceived),
+        std::ref(cachedLost)
+    );
+    while (cacheSubscribers.load() < 1) usleep(100);
+    double cachedSecs = timeStream(publisher, topics, value, size, nummsgs, cachedDone);
+    cached.join();
+
+    // Joiners take snapshots while we publish at rate:
+
+    std::vector<JoinStats> joins(njoiners);
+    std::latch joined(njoiners);
+    std::vector<std::thread*> joiners;
+    for (int i = 0; i < njoiners; i++) {
+        joiners.push_back(new std::thread(joiner, ctx, uri, std::ref(joins[i]), std::ref(joined)));
+    }
+    auto interval = std::chrono::nanoseconds(1000000000/(rate > 0 ? rate : 1));
+    auto next = std::chrono::steady_clock::now();
+    for (int i = 0; !joined.try_wait(); i++) {
+        publish(publisher, topics[i % ntopics], value, size);
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    for (auto t : joiners) {
+        t->join();
+        delete t;
+    }
+    int linger(0);
+    zmq_setsockopt(publisher, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(publisher);
+    checkError(zmq_ctx_shutdown(ctx), "Shutting down context");
+    cacheThread.join();
+    checkError(zmq_ctx_term(ctx), "Terminating context");
+    delete []value;
+
+    // Report:
+
+    std::cout << "Topics:          " << ntopics << std::endl;
+    std::cout << "Direct msgs/sec: " << directReceived/directSecs
+        << " received: " << directReceived << std::endl;
+    std::cout << "Cached msgs/sec: " << cachedReceived/cachedSecs
+        << " received: " << cachedReceived << " lost: " << cachedLost << std::endl;
+    if (njoiners > 0) {
+        std::vector<double> snapshots, syncs, rates;
+        int resyncs(0), fewest(ntopics);
+        for (auto& j : joins) {
+            snapshots.push_back(j.snapshotMs);
+            syncs.push_back(j.syncMs);
+            rates.push_back(j.topics/(j.snapshotMs/1000.0));
+            resyncs += j.resyncs;
+            fewest = std::min(fewest, j.topics);
+        }
+        std::sort(snapshots.begin(), snapshots.end());
+        std::sort(syncs.begin(), syncs.end());
+        std::sort(rates.begin(), rates.end());
+        std::cout << "Joiners:         " << njoiners << " resyncs: " << resyncs
+            << " fewest topics: " << fewest << std::endl;
+        std::cout << "Snapshot msec p50: " << snapshots[snapshots.size()/2]
+            << " max: " << snapshots.back() << std::endl;
+        std::cout << "Sync msec p50: " << syncs[syncs.size()/2]
+            << " max: " << syncs.back() << std::endl;
+        std::cout << "Topics/sec:      " << rates[rates.size()/2] << std::endl;
+        if (fewest < ntopics) {
+            std::cerr << "Warning: a snapshot held only " << fewest << " of " << ntopics
+                << " topics\n";
+        }
+    }
+    return EXIT_SUCCESS;
+}
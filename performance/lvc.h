@@ -0,0 +1,117 @@
+/**
+ * lvc.h
+ *    The table behind a last value cache: the newest message for each topic.
+ *
+ * A last value cache sits between a publisher and its subscribers, passes
+ * the stream through and remembers the latest message on each topic so a
+ * subscriber that joins late can be sent the current state (a snapshot)
+ * instead of waiting for every topic to be published again.
+ *
+ * The table is open addressed (linear probing, power of two capacity) over
+ * a dense deque of entries, so an update is a hash, usually one probe and
+ * a memcmp, and a snapshot walks the entries in order.  Topics and values
+ * are kept as zmq_msg_t's: storing one and sending it again are
+ * zmq_msg_copy's, which share the message data rather than copying it.
+ */
+#ifndef LVC_H
+#define LVC_H
+
+#include <zmq.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+
+class LastValueCache {
+    struct Entry {
+        zmq_msg_t topic;
+        zmq_msg_t value;
+    };
+    struct Slot {
+        uint32_t hash;
+        uint32_t entry;          // Index into m_entries + 1, 0 if empty.
+    };
+    std::vector<Slot>  m_slots;
+    std::deque<Entry>  m_entries;      // Never moves a zmq_msg_t once made.
+
+    static uint32_t hash(const void* data, size_t size) {      // FNV-1a.
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < size; i++) {
+            h = (h ^ p[i])*16777619u;
+        }
+        return h;
+    }
+    void grow() {
+        std::vector<Slot> slots(m_slots.size()*2, Slot{0, 0});
+        size_t mask = slots.size() - 1;
+        for (auto& slot : m_slots) {
+            if (!slot.entry) continue;
+            size_t i = slot.hash & mask;
+            while (slots[i].entry) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+        m_slots.swap(slots);
+    }
+public:
+    LastValueCache() : m_slots(1024, Slot{0, 0}) {}
+    ~LastValueCache() {
+        for (auto& e : m_entries) {
+            zmq_msg_close(&e.topic);
+            zmq_msg_close(&e.value);
+        }
+    }
+    LastValueCache(const LastValueCache&) = delete;
+    LastValueCache& operator=(const LastValueCache&) = delete;
+
+    /**
+     * update
+     *    Make value the latest for topic.  Both are copied (shared) so the
+     * caller can still send them on.
+     */
+    void update(zmq_msg_t* topic, zmq_msg_t* value) {
+        const void* key = zmq_msg_data(topic);
+        size_t      size = zmq_msg_size(topic);
+        uint32_t    h = hash(key, size);
+        size_t      mask = m_slots.size() - 1;
+        size_t      i = h & mask;
+        while (m_slots[i].entry) {
+            if (m_slots[i].hash == h) {
+                Entry& e = m_entries[m_slots[i].entry - 1];
+                if (zmq_msg_size(&e.topic) == size && memcmp(zmq_msg_data(&e.topic), key, size) == 0) {
+                    zmq_msg_copy(&e.value, value);        // Releases the old value.
+                    return;
+                }
+            }
+            i = (i + 1) & mask;
+        }
+        m_entries.emplace_back();
+        Entry& e = m_entries.back();
+        zmq_msg_init(&e.topic);
+        zmq_msg_init(&e.value);
+        zmq_msg_copy(&e.topic, topic);
+        zmq_msg_copy(&e.value, value);
+        m_slots[i] = Slot{h, (uint32_t)m_entries.size()};
+        if (m_entries.size()*2 > m_slots.size()) grow();  // Keep probes short.
+    }
+    /**
+     * forEach
+     *    Call f(topic, value) for every cached topic, in the order they
+     * first appeared.
+     */
+    template<typename F>
+    void forEach(F f) {
+        for (auto& e : m_entries) {
+            f(&e.topic, &e.value);
+        }
+    }
+    /**
+     * size
+     *   @return size_t - number of topics cached.
+     */
+    size_t size() const {
+        return m_entries.size();
+    }
+};
+
+#endif
@@ -0,0 +1,181 @@
+/**
+ * memory.h
+ *    Memory footprint for the timing programs: how much a run made the
+ * process grow, so container limits needn't be guesswork.
+ *
+ * memoryNow reads the resident set size from /proc/self/statm and the heap
+ * in use from glibc's mallinfo2 (arena plus mmapped chunks).  With
+ * ALLOCATOR=tcmalloc or pool (see allocator.cpp) most messages don't come
+ * from glibc and only the RSS figure means much.  Neither counts kernel
+ * socket buffers, which for tcp and ipc hold messages too.
+ *
+ * A MemorySampler samples in its own thread between start() and stop().  It
+ * reports the baseline (at start), the peak and the steady state: the median
+ * of the samples in the second half of the run, by when queues have filled.
+ * Constructed disabled it does nothing.
+ */
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <malloc.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+/**
+ * MemorySample
+ *    Bytes resident and bytes of heap in use.
+ */
+struct MemorySample {
+    double rss;
+    double heap;
+
+    MemorySample() : rss(0), heap(0) {}
+    MemorySample operator-(const MemorySample& rhs) const {
+        MemorySample result(*this);
+        result.rss  -= rhs.rss;
+        result.heap -= rhs.heap;
+        return result;
+    }
+    MemorySample operator/(double n) const {
+        MemorySample result(*this);
+        result.rss  /= n;
+        result.heap /= n;
+        return result;
+    }
+};
+
+/**
+ * memoryNow
+ *   @return MemorySample - the process's footprint right now.
+ */
+inline MemorySample
+memoryNow() {
+    MemorySample sample;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        unsigned long size, resident;
+        if (fscanf(statm, "%lu %lu", &size, &resident) == 2) {
+            sample.rss = double(resident)*double(sysconf(_SC_PAGESIZE));
+        }
+        fclose(statm);
+    }
+    struct mallinfo2 info = mallinfo2();
+    sample.heap = double(info.uordblks) + double(info.hblkhd);
+    return sample;
+}
+
+/**
+ * MemoryStats
+ *    What a MemorySampler saw.
+ */
+struct MemoryStats {
+    MemorySample baseline;
+    MemorySample peak;
+    MemorySample steady;
+    int          samples = 0;
+};
+
+/**
+ * MemorySampler
+ *    Samples memoryNow every interval milliseconds between start and stop.
+ */
+class MemorySampler {
+    bool                      m_enabled;
+    int                       m_intervalMs;
+    std::atomic<bool>         m_stop;
+    std::thread*              m_thread;
+    std::vector<MemorySample> m_samples;
+    MemorySample              m_baseline;
+public:
+    MemorySampler(bool enable, int intervalMs = 10) :
+        m_enabled(enable), m_intervalMs(intervalMs), m_stop(false), m_thread(nullptr) {}
+    ~MemorySampler() {
+        stop();
+    }
+    MemorySampler(const MemorySampler&) = delete;
+    MemorySampler& operator=(const MemorySampler&) = delete;
+
+    bool enabled() const {
+        return m_enabled;
+    }
+    void start() {
+        if (!m_enabled) return;
+        m_baseline = memoryNow();
+        m_samples.clear();
+        m_stop = false;
+        m_thread = new std::thread([this]() {
+            while (!m_stop) {
+                m_samples.push_back(memoryNow());
+                std::this_thread::sleep_for(std::chrono::milliseconds(m_intervalMs));
+            }
+        });
+    }
+    void stop() {
+        if (!m_thread) return;
+        m_stop = true;
+        m_thread->join();
+        delete m_thread;
+        m_thread = nullptr;
+        m_samples.push_back(memoryNow());      // At least one sample, however short the run.
+    }
+    MemoryStats read() const {
+        MemoryStats stats;
+        stats.baseline = m_baseline;
+        stats.samples  = m_samples.size();
+        if (m_samples.empty()) return stats;
+
+        std::vector<double> rss, heap;
+        for (size_t i = m_samples.size()/2; i < m_samples.size(); i++) {
+            rss.push_back(m_samples[i].rss);
+            heap.push_back(m_samples[i].heap);
+        }
+        std::sort(rss.begin(), rss.end());
+        std::sort(heap.begin(), heap.end());
+        stats.steady.rss  = rss[rss.size()/2];
+        stats.steady.heap = heap[heap.size()/2];
+        for (auto& s : m_samples) {
+            stats.peak.rss  = std::max(stats.peak.rss, s.rss);
+            stats.peak.heap = std::max(stats.peak.heap, s.heap);
+        }
+        return stats;
+    }
+};
+
+/**
+ * reportMemory
+ *    Write baseline, peak and steady state RSS and heap in MBytes.
+ *
+ * @param stats - from MemorySampler::read.
+ */
+inline void
+reportMemory(const MemoryStats& stats) {
+    const double MB = 1024.0*1024.0;
+    std::cout << "Memory MBytes " << std::setw(12) << "baseline" << std::setw(12) << "peak"
+        << std::setw(12) << "steady" << "  (" << stats.samples << " samples)\n";
+    std::cout << "  RSS         " << std::setw(12) << stats.baseline.rss/MB
+        << std::setw(12) << stats.peak.rss/MB << std::setw(12) << stats.steady.rss/MB << std::endl;
+    std::cout << "  heap        " << std::setw(12) << stats.baseline.heap/MB
+        << std::setw(12) << stats.peak.heap/MB << std::setw(12) << stats.steady.heap/MB << std::endl;
+}
+/**
+ * reportMemoryPer
+ *    Write a difference in footprint divided among some things.
+ *
+ * @param what - e.g. "connection".
+ * @param delta - the difference.
+ * @param n - how many things it's due to.
+ */
+inline void
+reportMemoryPer(const char* what, const MemorySample& delta, double n) {
+    MemorySample per = delta/n;
+    std::cout << "Per " << what << " bytes RSS: " << per.rss << " heap: " << per.heap << std::endl;
+}
+
+#endif
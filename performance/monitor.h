@@ -0,0 +1,184 @@
+/**
+ * monitor.h
+ *    Socket monitor helpers for the timing programs.
+ *
+ * The timing programs used to sleep to give peers time to connect.  That's
+ * both slow (a second per run adds up over a sweep) and racy.  Instead we
+ * use zmq_socket_monitor to learn when connections are really usable:
+ *
+ * *  SocketMonitor - attaches a monitor to a socket and reads the events.
+ * *  waitForPeers  - blocks until a number of peers have finished their
+ *                    handshake with a socket.
+ * *  waitForSubscribers - blocks until an XPUB has got a number of
+ *                    subscriptions.
+ *
+ * inproc connections don't go through the engine and therefore don't
+ * generate CONNECTED/HANDSHAKE_SUCCEEDED events.  They are, however,
+ * usable as soon as zmq_connect returns; so callers also pass a latch
+ * the connecting threads count down after zmq_connect.
+ *
+ * The monitor must be created before the socket binds/connects or the
+ * events are lost.  Its PAIR socket belongs to the context, so the monitor
+ * has to be destroyed before zmq_ctx_term or that will hang.
+ */
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <zmq.h>
+#include <latch>
+#include <atomic>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * isInproc
+ *   @param uri - an endpoint URI.
+ *   @return bool - true if the endpoint is inproc (no monitor connection events).
+ */
+inline bool
+isInproc(const std::string& uri) {
+    return uri.compare(0, 9, "inproc://") == 0;
+}
+
+/**
+ * SocketMonitor
+ *    Owns the PAIR socket that zmq_socket_monitor publishes events to.
+ * Each monitor gets a unique inproc endpoint so any number can coexist in
+ * a context.
+ */
+class SocketMonitor {
+    void*       m_socket;
+    std::string m_endpoint;
+public:
+    /**
+     * constructor
+     * @param ctx - context of the monitored socket (the monitor is inproc).
+     * @param socket - Socket to monitor.
+     * @param events - Mask of the ZMQ_EVENT_* bits we want.
+     */
+    SocketMonitor(void* ctx, void* socket, int events) {
+        static std::atomic<int> serial(0);
+        std::stringstream endpoint;
+        endpoint << "inproc://monitor-" << serial++;
+        m_endpoint = endpoint.str();
+
+        if (zmq_socket_monitor(socket, m_endpoint.c_str(), events) < 0) {
+            fail("Starting socket monitor");
+        }
+        m_socket = zmq_socket(ctx, ZMQ_PAIR);
+        if (!m_socket) {
+            fail("Creating monitor socket");
+        }
+        if (zmq_connect(m_socket, m_endpoint.c_str()) < 0) {
+            fail("Connecting to socket monitor");
+        }
+    }
+    ~SocketMonitor() {
+        int linger(0);
+        zmq_setsockopt(m_socket, ZMQ_LINGER, &linger, sizeof(linger));
+        zmq_close(m_socket);
+    }
+    SocketMonitor(const SocketMonitor&) = delete;
+    SocketMonitor& operator=(const SocketMonitor&) = delete;
+
+    /**
+     * next
+     *    Get the next event.
+     * @param timeout - milliseconds to wait; -1 waits forever.
+     * @return int - the ZMQ_EVENT_* value or 0 on timeout.
+     * @note the event message is two parts: 6 bytes with the event number
+     * and value, then the affected endpoint.  We only want the number.
+     */
+    int next(long timeout = -1) {
+        zmq_pollitem_t item = {m_socket, 0, ZMQ_POLLIN, 0};
+        if (zmq_poll(&item, 1, timeout) < 0) {
+            fail("Polling socket monitor");
+        }
+        if (!(item.revents & ZMQ_POLLIN)) {
+            return 0;
+        }
+        zmq_msg_t msg;
+        zmq_msg_init(&msg);
+        if (zmq_msg_recv(&msg, m_socket, 0) < 0) {
+            fail("Receiving monitor event");
+        }
+        uint16_t event;
+        memcpy(&event, zmq_msg_data(&msg), sizeof(event));
+        while (zmq_msg_more(&msg)) {              // Discard the address part.
+            zmq_msg_recv(&msg, m_socket, 0);
+        }
+        zmq_msg_close(&msg);
+        return event;
+    }
+    /**
+     * waitFor
+     *    Wait until an event has happened a number of times.  Other
+     * events are ignored.
+     * @param event - The ZMQ_EVENT_* we want.
+     * @param count - How many of them.
+     */
+    void waitFor(int event, int count = 1) {
+        while (count > 0) {
+            if (next() == event) count--;
+        }
+    }
+private:
+    static void fail(const char* doing) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+};
+
+/**
+ * waitForPeers
+ *    Wait until all peers have connected to a socket and can exchange data.
+ *
+ * @param monitor - Monitor on the socket, created with at least
+ *                  ZMQ_EVENT_HANDSHAKE_SUCCEEDED.
+ * @param uri - The socket's endpoint.
+ * @param npeers - Number of peers to wait for.
+ * @param connected - Latch the peers count down once their zmq_connect returned.
+ */
+inline void
+waitForPeers(SocketMonitor& monitor, const std::string& uri, int npeers, std::latch& connected) {
+    connected.wait();
+    if (!isInproc(uri)) {
+        monitor.waitFor(ZMQ_EVENT_HANDSHAKE_SUCCEEDED, npeers);
+    }
+}
+/**
+ * waitForSubscribers
+ *    A connected subscriber still misses what's published before its
+ * subscription reaches the publisher (the slow joiner).  A publisher that
+ * uses an XPUB with ZMQ_XPUB_VERBOSE set (so every subscription is passed
+ * up, not just the first for each topic) can wait for them instead.  Once
+ * the XPUB has handed us a subscription, what we publish reaches that
+ * subscriber.
+ *
+ * @param xpub - The publisher's XPUB socket (ZMQ_XPUB_VERBOSE set).
+ * @param nsubscribers - Number of subscriptions to wait for.
+ */
+inline void
+waitForSubscribers(void* xpub, int nsubscribers) {
+    int subscribed(0);
+    while (subscribed < nsubscribers) {
+        zmq_msg_t msg;
+        zmq_msg_init(&msg);
+        if (zmq_msg_recv(&msg, xpub, 0) < 0) {
+            std::cerr << "Failed waiting for subscriptions "
+                << zmq_strerror(zmq_errno()) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (zmq_msg_size(&msg) > 0 && *static_cast<uint8_t*>(zmq_msg_data(&msg)) == 1) {
+            subscribed++;                      // 0 would be an unsubscribe.
+        }
+        zmq_msg_close(&msg);
+    }
+}
+
+#endif
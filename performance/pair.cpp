@@ -6,10 +6,26 @@
  * receiver thread which then replies  back:alignas
  *
  * Usage:
- *    pair uri  nummsgs  size
+ *    pair [-p] [-s] [-d payload] [-z algorithm] [-w window [-k ackevery]] [-r strategy] uri  nummsgs  size
  * 
  * Where:
- *     uri - is the communication end point URI, the main binds.
+ *     -p  - count cycles, instructions, LLC misses, context switches and
+ *           page faults for both threads in the timed part (see perfcounters.h).
+ *     -s  - secure the connection with CURVE (see curve.h).  Compare with
+ *           a run without -s to get the cost of the encryption.
+ *     -d  - what the messages contain: uninit (default), zeros, random, log
+ *           or file:path (see payload.h).
+ *     -z  - compress each message with lz4 or zstd[:level] before sending
+ *           and decompress it on receipt, in both directions (see compress.h).
+ *     -w  - stream instead of ping-pong: keep up to window messages of size
+ *           unacknowledged (see below).
+ *     -k  - with -w, the peer acknowledges every ackevery messages
+ *           (default window/2, at most window).
+ *     -r  - how both threads wait for messages: block (default), spin,
+ *           hybrid[:usec], poll or poller (see receive.h).  Adds round trip
+ *           percentiles and the peer thread's CPU to the report.
+ *     uri - is the communication end point URI, the main binds.  shm://name
+ *           uses a pair of shared memory rings instead of ZMQ (see shmring.h).
  *     nummsgs - is the number of send/receive pairs done.
  *     size - is the size of the 'large' message.
  * 
@@ -26,6 +42,14 @@
  * Termination is simple as both peers know the number of messages
  * that will be exchanged and communication is assumed reliable.
  *
+ * Ping-pong has one message in flight so it measures round trip time, not
+ * bandwidth.  With -w main instead streams messages of size to the peer,
+ * which replies with a cumulative acknowledgement (the number of messages
+ * it has received) every ackevery messages.  Main stops sending when window
+ * messages are unacknowledged and waits for credit: flow control over PAIR
+ * like a bulk replication channel would do.  Running with growing windows
+ * shows how much of the transport's bandwidth a window buys.
+ *
  */
 #include <thread>
 #include <latch>
@@ -39,6 +63,15 @@
 #include <vector>
 #include <sstream>
 #include <chrono>
+#include <algorithm>
+#include "perfcounters.h"
+#include "monitor.h"
+#include "curve.h"
+#include "cputime.h"
+#include "shmring.h"
+#include "payload.h"
+#include "compress.h"
+#include "receive.h"
 
 // check error for int returns.
 static int checkError(int status, const char* doing) {
@@ -80,15 +113,16 @@ send(void* socket, void* data, size_t len) {
  *    Receive a message and ignore it.
  * 
  * @param socket - socket that receives the message.
+ * @param receiver - how we wait for it (see receive.h).
  * @note - we ensure the message is a single part message.
  */
 static void
-ignore(void* socket) {
+ignore(void* socket, ReceiveStrategy& receiver) {
     zmq_msg_t msg;
     checkError(zmq_msg_init(&msg), "Initializing message");
 
     checkError(
-        zmq_recvmsg(socket, &msg, 0),
+        receiver.receive(&msg),
         "Receiving message part."
     );
     checkError(zmq_msg_close(&msg), "Freeing message");
@@ -103,6 +137,48 @@ ignore(void* socket) {
         exit(EXIT_FAILURE);
     }
 }
+/**
+ * sendCompressed
+ *    Compress a message and send it.
+ *
+ * @param socket - socket to carry the message.
+ * @param compressor - compresses it.
+ * @param data - the message.
+ * @param len - its size.
+ * @param wire - buffer for the compressed message.
+ * @param wireSize - size of wire (compressor.bound(len)).
+ * @return size_t - bytes actually sent.
+ */
+static size_t
+sendCompressed(
+    void* socket, Compressor& compressor, char* data, size_t len, char* wire, size_t wireSize
+) {
+    size_t n = compressor.compress(data, len, wire, wireSize);
+    send(socket, wire, n);
+    return n;
+}
+/**
+ * expand
+ *    Receive a compressed message and decompress it.
+ *
+ * @param socket - socket that receives the message.
+ * @param compressor - decompresses it.
+ * @param buffer - where it's decompressed to.
+ * @param size - size of buffer.
+ * @param receiver - how we wait for it (see receive.h).
+ */
+static void
+expand(
+    void* socket, Compressor& compressor, char* buffer, size_t size, ReceiveStrategy& receiver
+) {
+    zmq_msg_t msg;
+    checkError(zmq_msg_init(&msg), "Initializing message");
+    checkError(receiver.receive(&msg), "Receiving message part.");
+    compressor.decompress(
+        static_cast<const char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg), buffer, size
+    );
+    checkError(zmq_msg_close(&msg), "Freeing message");
+}
 /**
  *  setBuffering
  *    Set send/receive buffers to 2MBytes.
@@ -136,11 +212,25 @@ setBuffering(void* socket) {
  * @param ctx - shared ZMQ context.
  * @param nmsgs - Number of messages to exchange.
  * @param size - Size of the messages we will return.
+ * @param perf - True to count performance events.
+ * @param counts - Where the performance counts end up.
+ * @param connected - Latch we count down once we've connected.
+ * @param curve - CURVE keys, if enabled we're the client.
+ * @param recvsize - Size of the messages we get (decompressed).
+ * @param payload - What our messages contain (see payload.h).
+ * @param compression - Compression specification, empty for none.
+ * @param wireBytes - Bytes we sent after compression.
+ * @param strategy - How we wait for messages (see receive.h).
+ * @param cpuSecs - CPU seconds this thread used exchanging messages.
  * @note see the comments in the top of the file for more
  * information about how this works.
  */
 static void 
-peer(std::string uri, void* ctx, int nmsgs, int size) {
+peer(
+    std::string uri, void* ctx, int nmsgs, int size, bool perf, PerfCounts& counts,
+    std::latch& connected, const Curve& curve, int recvsize, std::string payload,
+    std::string compression, double& wireBytes, std::string strategy, double& cpuSecs
+) {
     // Set up my  communications path;
 
     auto socket = checkError(
@@ -148,19 +238,42 @@ peer(std::string uri, void* ctx, int nmsgs, int size) {
         "Creating thread's pair socket."
     );
     setBuffering(socket);
+    curve.client(socket);
     checkError(
         zmq_connect(socket, uri.c_str()),
         "Connecting to peer."
     );
+    connected.count_down();
     setBuffering(socket);
     char* msg = new char[size];
+    fillPayload(msg, size, payload, 2);
+    Compressor compressor(compression);
+    size_t wireSize = compressor.bound(size);
+    char* wire = new char[wireSize];
+    char* in = new char[recvsize];
+    ReceiveStrategy receiver(strategy);
+    receiver.attach(socket);
+    PerfCounters counters(perf);
+    wireBytes = 0;
     // exchange messages:
 
+    double cpuStart = threadCpuSeconds();
+    counters.start();
     for (int i = 0; i < nmsgs; i++) {
-        ignore(socket);
-        send(socket, msg, size);
+        if (compressor.enabled()) {
+            expand(socket, compressor, in, recvsize, receiver);
+            wireBytes += sendCompressed(socket, compressor, msg, size, wire, wireSize);
+        } else {
+            ignore(socket, receiver);
+            send(socket, msg, size);
+        }
     }
+    counters.stop();
+    cpuSecs = threadCpuSeconds() - cpuStart;
+    counts = counters.read();
     delete []msg;
+    delete []wire;
+    delete []in;
     checkError(
         zmq_close(socket),
         "Closing thread's socket."
@@ -175,10 +288,27 @@ peer(std::string uri, void* ctx, int nmsgs, int size) {
  * @param nummsgs - Number send/receive pairs.
  * @param mainsize - Size of the messages we will send.
  * @param thrsize - size of the messags the thread will send us.
+ * @param perf - True to count performance events.
+ * @param mainCounts - Performance counts for the main thread.
+ * @param peerCounts - Performance counts for the peer thread.
+ * @param curve - CURVE keys, if enabled we're the server.
+ * @param cpuSecs - CPU seconds the process (including ZMQ's I/O threads) used.
+ * @param payload - What the messages contain (see payload.h).
+ * @param compression - Compression specification, empty for none.
+ * @param wireBytes - Bytes sent in both directions after compression.
+ * @param strategy - How both threads wait for messages (see receive.h).
+ * @param rtts - Each round trip's time in usec, only timed with a strategy.
+ * @param peerCpu - CPU seconds the peer thread used.
  * @return double precision seconds the send/recieves took.
  */
 static double
-run(std::string uri, void* context, int nummsgs, int mainsize, int thrsize) {
+run(
+    std::string uri, void* context, int nummsgs, int mainsize, int thrsize,
+    bool perf, PerfCounts& mainCounts, PerfCounts& peerCounts,
+    const Curve& curve, double& cpuSecs, const std::string& payload,
+    const std::string& compression, double& wireBytes,
+    const std::string& strategy, std::vector<double>& rtts, double& peerCpu
+) {
     // Setup our side of the pair and bind
 
     auto socket = checkError(
@@ -186,24 +316,68 @@ run(std::string uri, void* context, int nummsgs, int mainsize, int thrsize) {
         "Creating main thread socket"
     );
     setBuffering(socket);
+    SocketMonitor monitor(
+        context, socket, ZMQ_EVENT_HANDSHAKE_SUCCEEDED | ZMQ_EVENT_MONITOR_STOPPED
+    );
+    curve.server(socket);
     checkError(
         zmq_bind(socket, uri.c_str()),
         "Binding socket in main thread."
     );
     setBuffering(socket);
-    // Start the peer thread:
+    // Start the peer thread and don't start timing until it's connected:
 
-    std::thread peerThread(peer, uri, context, nummsgs, thrsize);
+    std::latch connected(1);
+    double peerWireBytes(0);
+    std::thread peerThread(
+        peer, uri, context, nummsgs, thrsize, perf, std::ref(peerCounts),
+        std::ref(connected), std::cref(curve), mainsize, payload, compression,
+        std::ref(peerWireBytes), strategy, std::ref(peerCpu)
+    );
+    waitForPeers(monitor, uri, 1, connected);
 
     // Time the message exchange -> join:
     char* sendmsg = new char[mainsize];    // Allocate only once.
+    fillPayload(sendmsg, mainsize, payload);
+    Compressor compressor(compression);
+    size_t wireSize = compressor.bound(mainsize);
+    char* wire = new char[wireSize];
+    char* in = new char[thrsize];
+    ReceiveStrategy receiver(strategy);
+    receiver.attach(socket);
+    bool stamped = !strategy.empty();          // Else time the loop as it always was.
+    rtts.clear();
+    if (stamped) rtts.reserve(nummsgs);
+    wireBytes = 0;
+    PerfCounters counters(perf);
+    double cpuStart = processCpuSeconds();
     auto start = std::chrono::high_resolution_clock::now();
+    counters.start();
     for (int i =0; i < nummsgs; i++) {
-        send(socket, sendmsg, mainsize);         // send
-        ignore(socket);                          // reply.
+        std::chrono::steady_clock::time_point sent;
+        if (stamped) sent = std::chrono::steady_clock::now();
+        if (compressor.enabled()) {
+            wireBytes += sendCompressed(socket, compressor, sendmsg, mainsize, wire, wireSize);
+            expand(socket, compressor, in, thrsize, receiver);
+        } else {
+            send(socket, sendmsg, mainsize);         // send
+            ignore(socket, receiver);                // reply.
+        }
+        if (stamped) {
+            rtts.push_back(
+                std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count()
+            );
+        }
     }
+    counters.stop();
     peerThread.join();                           // so all is done.
     auto end = std::chrono::high_resolution_clock::now();
+    cpuSecs = processCpuSeconds() - cpuStart;
+    mainCounts = counters.read();
+    wireBytes += peerWireBytes;
+    delete []sendmsg;
+    delete []wire;
+    delete []in;
 
     // Shutdown the communication from our side:
 
@@ -211,6 +385,9 @@ run(std::string uri, void* context, int nummsgs, int mainsize, int thrsize) {
         zmq_close(socket),
         "Closing socket in main thread"
     );
+    // Once the monitor stops, the endpoint is released and the next run can bind it.
+
+    monitor.waitFor(ZMQ_EVENT_MONITOR_STOPPED);
 
     // Compute the duration:
 
@@ -220,23 +397,408 @@ run(std::string uri, void* context, int nummsgs, int mainsize, int thrsize) {
         .count();                       // Milliseconds.
     return ms/1000.0;            // seconds.
 }
+/**
+ * setWindowHwm
+ *    Make the ZMQ high water marks at least the window so the window,
+ * not ZMQ, is what limits the messages in flight.
+ * @param socket
+ * @param window - messages the sender may have outstanding.
+ */
+static void
+setWindowHwm(void* socket, int window) {
+    int hwm = window > 1000 ? window : 1000;    // 1000 is ZMQ's default.
+    checkError(
+        zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm)),
+        "Setting send high water mark"
+    );
+    checkError(
+        zmq_setsockopt(socket, ZMQ_RCVHWM, &hwm, sizeof(hwm)),
+        "Setting receive high water mark"
+    );
+}
+/**
+ * receiveAck
+ *    Receive a cumulative acknowledgement.
+ * @param socket - socket it comes in on.
+ * @return int64_t - number of messages the peer has received.
+ */
+static int64_t
+receiveAck(void* socket) {
+    int64_t received;
+    checkError(
+        zmq_recv(socket, &received, sizeof(received), 0),
+        "Receiving acknowledgement"
+    );
+    return received;
+}
+/**
+ * streamPeer
+ *    The peer thread in streaming mode: receive nmsgs messages and
+ * acknowledge every ackEvery'th one (and the last) with the number
+ * received so far.
+ * @param uri - uri to zmq_connect to.
+ * @param ctx - shared ZMQ context.
+ * @param nmsgs - Number of messages we'll get.
+ * @param size - Their size (decompressed).
+ * @param window - The sender's window (sets our high water mark).
+ * @param ackEvery - Messages per acknowledgement.
+ * @param perf - True to count performance events.
+ * @param counts - Where the performance counts end up.
+ * @param connected - Latch we count down once we've connected.
+ * @param curve - CURVE keys, if enabled we're the client.
+ * @param compression - Compression specification, empty for none.
+ * @param strategy - How we wait for messages (see receive.h).
+ */
+static void
+streamPeer(
+    std::string uri, void* ctx, int nmsgs, int size, int window, int ackEvery,
+    bool perf, PerfCounts& counts, std::latch& connected, const Curve& curve,
+    std::string compression, std::string strategy
+) {
+    auto socket = checkError(
+        zmq_socket(ctx, ZMQ_PAIR),
+        "Creating thread's pair socket."
+    );
+    setBuffering(socket);
+    setWindowHwm(socket, window);
+    curve.client(socket);
+    checkError(
+        zmq_connect(socket, uri.c_str()),
+        "Connecting to peer."
+    );
+    connected.count_down();
+    Compressor compressor(compression);
+    char* in = new char[size];
+    ReceiveStrategy receiver(strategy);
+    receiver.attach(socket);
+    PerfCounters counters(perf);
+
+    counters.start();
+    for (int64_t i = 1; i <= nmsgs; i++) {
+        if (compressor.enabled()) {
+            expand(socket, compressor, in, size, receiver);
+        } else {
+            ignore(socket, receiver);
+        }
+        if (i % ackEvery == 0 || i == nmsgs) {
+            send(socket, &i, sizeof(i));
+        }
+    }
+    counters.stop();
+    counts = counters.read();
+    delete []in;
+    checkError(
+        zmq_close(socket),
+        "Closing thread's socket."
+    );
+}
+/**
+ * runStream
+ *    Streaming timing: main sends nummsgs messages keeping at most window
+ * of them unacknowledged (credit based flow control), the peer returns
+ * cumulative acknowledgements.  Timing ends when the last is acknowledged.
+ *
+ * @param window - Most messages outstanding.
+ * @param ackEvery - Messages per acknowledgement (at most window).
+ * @param stalls - Times the window was full and we waited for an ack.
+ * @param acks - Acknowledgements received.
+ * @param strategy - How the peer waits for messages (see receive.h).
+ *
+ * The other parameters are as for run, less thrsize (acks are 8 bytes).
+ * @return double - seconds taken.
+ */
+static double
+runStream(
+    std::string uri, void* context, int nummsgs, int size, int window, int ackEvery,
+    bool perf, PerfCounts& mainCounts, PerfCounts& peerCounts,
+    const Curve& curve, double& cpuSecs, const std::string& payload,
+    const std::string& compression, double& wireBytes, int& stalls, int& acks,
+    const std::string& strategy
+) {
+    auto socket = checkError(
+        zmq_socket(context, ZMQ_PAIR),
+        "Creating main thread socket"
+    );
+    setBuffering(socket);
+    setWindowHwm(socket, window);
+    SocketMonitor monitor(
+        context, socket, ZMQ_EVENT_HANDSHAKE_SUCCEEDED | ZMQ_EVENT_MONITOR_STOPPED
+    );
+    curve.server(socket);
+    checkError(
+        zmq_bind(socket, uri.c_str()),
+        "Binding socket in main thread."
+    );
+    std::latch connected(1);
+    std::thread peerThread(
+        streamPeer, uri, context, nummsgs, size, window, ackEvery, perf,
+        std::ref(peerCounts), std::ref(connected), std::cref(curve), compression, strategy
+    );
+    waitForPeers(monitor, uri, 1, connected);
+
+    char* sendmsg = new char[size];
+    fillPayload(sendmsg, size, payload);
+    Compressor compressor(compression);
+    size_t wireSize = compressor.bound(size);
+    char* wire = new char[wireSize];
+    wireBytes = 0;
+    stalls = 0;
+    acks = 0;
+    PerfCounters counters(perf);
+    double cpuStart = processCpuSeconds();
+    auto start = std::chrono::high_resolution_clock::now();
+    counters.start();
+    int64_t sent(0), acked(0);
+    while (sent < nummsgs) {
+        if (sent - acked >= window) {
+            stalls++;                         // Out of credit.
+            acked = receiveAck(socket);
+            acks++;
+            continue;
+        }
+        if (compressor.enabled()) {
+            wireBytes += sendCompressed(socket, compressor, sendmsg, size, wire, wireSize);
+        } else {
+            send(socket, sendmsg, size);
+        }
+        sent++;
+    }
+    while (acked < nummsgs) {                 // Drain to the final ack.
+        acked = receiveAck(socket);
+        acks++;
+    }
+    counters.stop();
+    peerThread.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    cpuSecs = processCpuSeconds() - cpuStart;
+    mainCounts = counters.read();
+    delete []sendmsg;
+    delete []wire;
+
+    checkError(
+        zmq_close(socket),
+        "Closing socket in main thread"
+    );
+    monitor.waitFor(ZMQ_EVENT_MONITOR_STOPPED);
+
+    auto chronoDuration = end - start;
+    double ms =
+        (double)std::chrono::duration_cast<std::chrono::milliseconds>(chronoDuration)
+        .count();
+    return ms/1000.0;
+}
+/**
+ * shmPeer
+ *    The peer thread when the "transport" is shared memory rings.
+ * @param in - Ring we receive on.
+ * @param out - Ring we reply on.
+ * @param nmsgs - Number of messages to exchange.
+ * @param size - Size of the messages we will return.
+ * @param perf - True to count performance events.
+ * @param counts - Where the performance counts end up.
+ */
+static void
+shmPeer(
+    ShmRing* in, ShmRing* out, int nmsgs, int size, bool perf, PerfCounts& counts,
+    std::string payload
+) {
+    char* msg = new char[size];
+    fillPayload(msg, size, payload, 2);
+    PerfCounters counters(perf);
+
+    counters.start();
+    for (int i = 0; i < nmsgs; i++) {
+        in->ignore();
+        out->send(msg, size);
+    }
+    counters.stop();
+    counts = counters.read();
+    delete []msg;
+}
+/**
+ * runShm
+ *    run for shm:// endpoints.  The main thread's messages go through
+ * the ring uri-out and the peer's come back through uri-back.  Each peer
+ * opens the rings the other created as it would across processes.
+ *
+ * Parameters are as for run, less the ZMQ and compression ones.
+ */
+static double
+runShm(
+    std::string uri, int nummsgs, int mainsize, int thrsize,
+    bool perf, PerfCounts& mainCounts, PerfCounts& peerCounts, double& cpuSecs,
+    const std::string& payload
+) {
+    ShmRing* outRing  = ShmRing::create(uri + "-out", mainsize, ShmRing::defaultSlots(mainsize));
+    ShmRing* backRing = ShmRing::create(uri + "-back", thrsize, ShmRing::defaultSlots(thrsize));
+    ShmRing* peerIn   = ShmRing::open(uri + "-out");
+    ShmRing* peerOut  = ShmRing::open(uri + "-back");
+    std::thread peerThread(
+        shmPeer, peerIn, peerOut, nummsgs, thrsize, perf, std::ref(peerCounts), payload
+    );
+
+    char* sendmsg = new char[mainsize];
+    fillPayload(sendmsg, mainsize, payload);
+    PerfCounters counters(perf);
+    double cpuStart = processCpuSeconds();
+    auto start = std::chrono::high_resolution_clock::now();
+    counters.start();
+    for (int i =0; i < nummsgs; i++) {
+        outRing->send(sendmsg, mainsize);
+        backRing->ignore();
+    }
+    counters.stop();
+    peerThread.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    cpuSecs = processCpuSeconds() - cpuStart;
+    mainCounts = counters.read();
+    delete []sendmsg;
+    delete peerIn;
+    delete peerOut;
+    delete outRing;
+    delete backRing;
+
+    auto chronoDuration = end - start;
+    double ms =
+        (double)std::chrono::duration_cast<std::chrono::milliseconds>(chronoDuration)
+        .count();
+    return ms/1000.0;
+}
+/**
+ * reportRtts
+ *    Print round trip percentiles and what waiting for them cost.
+ * @param strategy - how messages were waited for.
+ * @param rtts - round trip times (usec), sorted here.
+ * @param peerCpu - CPU seconds the peer thread used.
+ */
+static void
+reportRtts(const std::string& strategy, std::vector<double>& rtts, double peerCpu) {
+    std::sort(rtts.begin(), rtts.end());
+    size_t n = rtts.size();
+    std::cout << "Receive :  " << strategy << std::endl;
+    std::cout << "RTT usec p50: " << rtts[n/2] << " p99: " << rtts[(n*99)/100]
+        << " max: " << rtts.back() << std::endl;
+    std::cout << "Peer CPU secs: " << peerCpu
+        << " usec/msg: " << peerCpu*1.0e6/n << std::endl;
+}
 /**
  * main
  *   We are a peer and time the message exchanges.
  */
 int main(int argc, char** argv) {
-    std::string uri(argv[1]);
-    int nummsgs = atoi(argv[2]);
-    int size  =  atoi(argv[3]);
+    bool perf(false);
+    bool secure(false);
+    std::string payload("uninit");
+    std::string compression;
+    int window(0);
+    int ackEvery(0);
+    std::string strategy;
+    int opt;
+    while ((opt = getopt(argc, argv, "psd:z:w:k:r:")) != -1) {
+        switch (opt) {
+        case 'p':
+            perf = true;
+            break;
+        case 's':
+            secure = true;
+            break;
+        case 'd':
+            payload = optarg;
+            break;
+        case 'z':
+            compression = optarg;
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'k':
+            ackEvery = atoi(optarg);
+            break;
+        case 'r':
+            strategy = optarg;
+            break;
+        default:
+            std::cerr << "Usage: pair [-p] [-s] [-d payload] [-z algorithm] "
+                << "[-w window [-k ackevery]] [-r strategy] uri nummsgs size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nummsgs = atoi(argv[optind+1]);
+    int size  =  atoi(argv[optind+2]);
+    if (secure && (isInproc(uri) || isShm(uri))) {
+        std::cerr << "Warning: CURVE has no effect on inproc and shm transports\n";
+    }
+    if (!compression.empty() && isShm(uri)) {
+        std::cerr << "Warning: compression is not done on shm transports\n";
+    }
+    if (!strategy.empty() && isShm(uri)) {
+        std::cerr << "Warning: receive strategies don't apply to shm transports\n";
+    }
+    if (window > 0 && isShm(uri)) {
+        std::cerr << "Streaming (-w) is not supported on shm transports\n";
+        exit(EXIT_FAILURE);
+    }
+    if (ackEvery <= 0) ackEvery = window > 1 ? window/2 : 1;
+    if (ackEvery > window) ackEvery = window;      // Else we'd wait forever for credit.
+    Curve curve(secure);
+    Compressor compressor(compression);      // Validates the spec.
+    ReceiveStrategy receiver(strategy);      // Ditto.
 
     auto context = checkError(
         zmq_ctx_new(),
         "Making ZMQ context"
     );
+    if (window > 0) {
+        PerfCounts mainCounts, peerCounts;
+        double cpuSecs, wireBytes;
+        int stalls, acks;
+        double duration = runStream(
+            uri, context, nummsgs, size, window, ackEvery, perf, mainCounts, peerCounts,
+            curve, cpuSecs, payload, compression, wireBytes, stalls, acks, strategy
+        );
+        checkError(
+            zmq_ctx_term(context),
+            "Terminating ZMQ context"
+        );
+        std::cout << "Streaming window " << window << " ack every " << ackEvery << std::endl;
+        std::cout << "Time    :  " << duration << std::endl;
+        std::cout << "Msgs/sec:  " << (double)nummsgs/duration << std::endl;
+        std::cout << "KB/sec  :  " << (double)size*(double)nummsgs/(1024.0*duration) << std::endl;
+        std::cout << "Acks    :  " << acks << std::endl;
+        std::cout << "Stalls  :  " << stalls << std::endl;
+        std::cout << "CPU secs:  " << cpuSecs << std::endl;
+        std::cout << "Cores/Gbps: " << cpuSecs/((double)size*(double)nummsgs*8.0/1.0e9) << std::endl;
+        if (wireBytes > 0) {
+            reportCompression((double)size*(double)nummsgs, wireBytes, duration);
+        }
+        if (perf) {
+            double kb = (double)size*(double)nummsgs/1024.0;
+            reportPerfCounts("Main (streamer)", mainCounts, nummsgs, kb);
+            reportPerfCounts("Peer (acknowledger)", peerCounts, nummsgs, kb);
+        }
+        return EXIT_SUCCESS;
+    }
 
-    double duration1 = run(uri, context, nummsgs, size, 1); // 'big' send, small return.
-    sleep(1);                          // Let the socket die?
-    double duration2 = run(uri, context, nummsgs, 1, size); // small send, 'big' return.
+    PerfCounts main1, peer1, main2, peer2;
+    double cpu1, cpu2;
+    double duration1, duration2;
+    double wire1(0), wire2(0);
+    std::vector<double> rtts1, rtts2;
+    double peerCpu1(0), peerCpu2(0);
+    if (isShm(uri)) {
+        duration1 = runShm(uri, nummsgs, size, 1, perf, main1, peer1, cpu1, payload);
+        duration2 = runShm(uri, nummsgs, 1, size, perf, main2, peer2, cpu2, payload);
+    } else {
+        duration1 = run(
+            uri, context, nummsgs, size, 1, perf, main1, peer1, curve, cpu1,
+            payload, compression, wire1, strategy, rtts1, peerCpu1
+        ); // 'big' send, small return.
+        duration2 = run(
+            uri, context, nummsgs, 1, size, perf, main2, peer2, curve, cpu2,
+            payload, compression, wire2, strategy, rtts2, peerCpu2
+        ); // small send, 'big' return.
+    }
 
 
     checkError(
@@ -250,6 +812,20 @@ int main(int argc, char** argv) {
     std::cout << "Time    :  " << duration1 << std::endl;
     std::cout << "Msgs/sec:  " << (double)nummsgs/duration1 << std::endl;
     std::cout << "KB/sec  :  " << (double)size*(double)nummsgs/(1024.0*duration1) << std::endl;
+    std::cout << "RTT usec:  " << duration1*1.0e6/nummsgs << std::endl;
+    std::cout << "CPU secs:  " << cpu1 << std::endl;
+    std::cout << "Cores/Gbps: " << cpu1/((double)size*(double)nummsgs*8.0/1.0e9) << std::endl;
+    if (wire1 > 0) {
+        reportCompression((double)(size + 1)*(double)nummsgs, wire1, duration1);
+    }
+    if (!strategy.empty() && !rtts1.empty()) {
+        reportRtts(strategy, rtts1, peerCpu1);
+    }
+    if (perf) {
+        double kb = (double)size*(double)nummsgs/1024.0;
+        reportPerfCounts("Main (big sender)", main1, nummsgs, kb);
+        reportPerfCounts("Peer (small replier)", peer1, nummsgs, kb);
+    }
 
     // ditto for small sends:
 
@@ -257,5 +833,19 @@ int main(int argc, char** argv) {
     std::cout << "Time    :  " << duration2 << std::endl;
     std::cout << "Msgs/sec:  " << (double)nummsgs/duration2 << std::endl;
     std::cout << "KB/sec  :  " << (double)size*(double)nummsgs/(1024.0*duration2) << std::endl;
+    std::cout << "RTT usec:  " << duration2*1.0e6/nummsgs << std::endl;
+    std::cout << "CPU secs:  " << cpu2 << std::endl;
+    std::cout << "Cores/Gbps: " << cpu2/((double)size*(double)nummsgs*8.0/1.0e9) << std::endl;
+    if (wire2 > 0) {
+        reportCompression((double)(size + 1)*(double)nummsgs, wire2, duration2);
+    }
+    if (!strategy.empty() && !rtts2.empty()) {
+        reportRtts(strategy, rtts2, peerCpu2);
+    }
+    if (perf) {
+        double kb = (double)size*(double)nummsgs/1024.0;
+        reportPerfCounts("Main (small sender)", main2, nummsgs, kb);
+        reportPerfCounts("Peer (big replier)", peer2, nummsgs, kb);
+    }
 
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+/**
+ * payload.h
+ *    What goes in the messages the timing programs send.
+ *
+ * Historically the programs sent whatever was in a fresh new char[size].
+ * That's fine for raw transport timing but says nothing about how well
+ * the data compresses, and since those pages may never have been touched
+ * page fault costs can move into the timed region.  fillPayload writes
+ * one of:
+ *
+ * *  uninit     - leave the buffer alone (the old behaviour, the default).
+ * *  zeros      - all zero; compresses to almost nothing.
+ * *  random     - pseudo random bytes; doesn't compress at all.
+ * *  log        - text lines that look like service logs; typical of what
+ *                 we actually ship, compresses well but not absurdly.
+ * *  file:path  - the start of a file, repeated to fill the buffer; to try
+ *                 a sample of real traffic.
+ */
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * fillPayload
+ *    Fill a message buffer.
+ * @param buffer - the buffer.
+ * @param size - its size.
+ * @param kind - one of the kinds above.
+ * @param seed - varies the random and log data between threads.
+ */
+inline void
+fillPayload(char* buffer, size_t size, const std::string& kind, uint32_t seed = 1) {
+    if (kind == "uninit") {
+        return;
+    }
+    if (kind == "zeros") {
+        memset(buffer, 0, size);
+        return;
+    }
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ seed;    // xorshift64.
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    if (kind == "random") {
+        for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+            uint64_t r = next();
+            memcpy(buffer + i, &r, size - i < sizeof(r) ? size - i : sizeof(r));
+        }
+        return;
+    }
+    if (kind == "log") {
+        static const char* levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+        static const char* paths[] = {
+            "/api/v1/items", "/api/v1/orders", "/api/v1/users", "/healthz", "/api/v2/search"
+        };
+        static const int statuses[] = {200, 200, 200, 201, 204, 404, 500};
+        size_t used(0);
+        long   usec(0);
+        while (used < size) {
+            char line[256];
+            usec += next() % 5000;
+            int n = snprintf(
+                line, sizeof(line),
+                "2024-05-01T12:%02ld:%02ld.%06ld %-5s [worker-%02d] req=%016llx %s/%llu "
+                "status=%d latency_us=%llu bytes=%llu\n",
+                (usec/60000000) % 60, (usec/1000000) % 60, usec % 1000000,
+                levels[next() % 6], (int)(next() % 32), (unsigned long long)next(),
+                paths[next() % 5], (unsigned long long)(next() % 100000),
+                statuses[next() % 7], (unsigned long long)(next() % 250000),
+                (unsigned long long)(next() % 65536)
+            );
+            size_t chunk = (size_t)n < size - used ? (size_t)n : size - used;
+            memcpy(buffer + used, line, chunk);
+            used += chunk;
+        }
+        return;
+    }
+    if (kind.compare(0, 5, "file:") == 0) {
+        std::ifstream file(kind.substr(5), std::ios::binary);
+        std::vector<char> sample(size);
+        file.read(sample.data(), size);
+        size_t got = file.gcount();
+        if (got == 0) {
+            std::cerr << "Can't read a payload sample from " << kind.substr(5) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < size; i += got) {
+            memcpy(buffer + i, sample.data(), size - i < got ? size - i : got);
+        }
+        return;
+    }
+    std::cerr << "Unknown payload " << kind
+        << " (uninit, zeros, random, log or file:path)\n";
+    exit(EXIT_FAILURE);
+}
+
+#endif
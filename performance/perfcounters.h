@@ -0,0 +1,214 @@
+/**
+ * perfcounters.h
+ *    Optional Linux performance counters for the timing programs.
+ *
+ * Each thread that wants to be measured makes a PerfCounters object.
+ * That opens (via perf_event_open) a set of counters that count only
+ * the calling thread:
+ *
+ * *  cycles, instructions, last level cache misses (hardware counters).
+ * *  context switches and page faults (software counters).
+ *
+ * start() and stop() bracket the timed region and read() gets the
+ * values.  Since several threads can play the same role (e.g. the pullers
+ * in push), PerfCounts can be summed (under a lock, see PerfTotals).
+ *
+ * Counters the kernel won't give us (no PMU in a VM, perf_event_paranoid
+ * too high...) are just marked invalid and reported as such; that's
+ * not a reason to fail the timing run.
+ *
+ * @note If perf_event_paranoid forbids kernel counting we fall back to
+ * counting user mode only, counter by counter; the report marks those.
+ * Context switches only happen in the kernel, so that one has no fallback
+ * and is unavailable instead.
+ */
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+
+static const int NUM_PERF_COUNTERS = 5;
+
+static const char* perfCounterNames[NUM_PERF_COUNTERS] = {
+    "cycles", "instructions", "LLC-misses", "ctx-switches", "page-faults"
+};
+static const uint32_t perfCounterTypes[NUM_PERF_COUNTERS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+    PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE
+};
+static const uint64_t perfCounterConfigs[NUM_PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_PAGE_FAULTS
+};
+// Whether counting only user mode still means anything:
+static const bool perfCounterUserFallback[NUM_PERF_COUNTERS] = {
+    true, true, true, false, true
+};
+
+/**
+ * PerfCounts
+ *    The values of one set of counters.  A counter is valid if it
+ * could be opened in every thread that contributed to the sum.
+ */
+struct PerfCounts {
+    bool     valid[NUM_PERF_COUNTERS];
+    uint64_t counts[NUM_PERF_COUNTERS];
+    bool     userOnly[NUM_PERF_COUNTERS]; // Kernel was excluded.
+    int      threads;                     // How many threads were summed.
+
+    PerfCounts() : threads(0) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            valid[i] = true;
+            counts[i] = 0;
+            userOnly[i] = false;
+        }
+    }
+    PerfCounts& operator+=(const PerfCounts& rhs) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            valid[i] = valid[i] && rhs.valid[i];
+            counts[i] += rhs.counts[i];
+            userOnly[i] = userOnly[i] || rhs.userOnly[i];
+        }
+        threads += rhs.threads;
+        return *this;
+    }
+};
+
+/**
+ * PerfCounters
+ *    Counters for the calling thread.  If constructed disabled, all of the
+ * methods are no-ops so the timing code does not need to be littered with ifs.
+ */
+class PerfCounters {
+    int  m_fds[NUM_PERF_COUNTERS];
+    bool m_userOnly[NUM_PERF_COUNTERS];
+public:
+    PerfCounters(bool enable) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            m_fds[i] = -1;
+            m_userOnly[i] = false;
+            if (enable) {
+                m_fds[i] = openCounter(perfCounterTypes[i], perfCounterConfigs[i], false);
+                if (m_fds[i] < 0 && perfCounterUserFallback[i]) {
+                    m_fds[i] = openCounter(perfCounterTypes[i], perfCounterConfigs[i], true);
+                    m_userOnly[i] = m_fds[i] >= 0;
+                }
+            }
+        }
+    }
+    ~PerfCounters() {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            if (m_fds[i] >= 0) close(m_fds[i]);
+        }
+    }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Zero and start counting.
+    void start() {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            if (m_fds[i] >= 0) {
+                ioctl(m_fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(m_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+    // Stop counting - the values are frozen until the next start.
+    void stop() {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            if (m_fds[i] >= 0) {
+                ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+    }
+    /**
+     * read
+     *    Get the counter values.  If the kernel had to multiplex the
+     * hardware counters, the values are scaled by enabled/running time.
+     * @return PerfCounts - invalid for counters we could not open.
+     */
+    PerfCounts read() const {
+        PerfCounts result;
+        result.threads = 1;
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            result.userOnly[i] = m_userOnly[i];
+            uint64_t values[3];     // value, time enabled, time running.
+            if (m_fds[i] < 0 || ::read(m_fds[i], values, sizeof(values)) != sizeof(values)) {
+                result.valid[i] = false;
+                continue;
+            }
+            double scale = values[2] ? (double)values[1]/(double)values[2] : 1.0;
+            result.counts[i] = (uint64_t)((double)values[0]*scale);
+        }
+        return result;
+    }
+private:
+    static int openCounter(uint32_t type, uint64_t config, bool userOnly) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        attr.exclude_kernel = userOnly ? 1 : 0;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // pid 0, cpu -1 means this thread on any cpu.
+        return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+};
+
+/**
+ * PerfTotals
+ *    Sums the counts from threads that play the same role.
+ */
+class PerfTotals {
+    std::mutex m_lock;
+    PerfCounts m_counts;
+public:
+    void add(const PerfCounts& counts) {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_counts += counts;
+    }
+    PerfCounts get() {
+        std::lock_guard<std::mutex> guard(m_lock);
+        return m_counts;
+    }
+};
+
+/**
+ * reportPerfCounts
+ *    Write the counts per message and per KB.  Counters that only counted
+ * user mode are marked (user).
+ *
+ * @param who - Role of the thread(s) e.g. "Sender".
+ * @param counts - The counts to report.
+ * @param msgs - Number of messages in the timed region.
+ * @param kb   - KBytes transferred in the timed region.
+ */
+inline void
+reportPerfCounts(const char* who, const PerfCounts& counts, double msgs, double kb) {
+    std::cout << who << " counters (" << counts.threads << " thread"
+        << (counts.threads == 1 ? "" : "s") << ")\n";
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+        std::cout << "  " << std::left << std::setw(14) << perfCounterNames[i] << std::right;
+        if (!counts.valid[i]) {
+            std::cout << "unavailable\n";
+            continue;
+        }
+        std::cout << std::setw(14) << counts.counts[i]
+            << "  /msg: " << std::setw(12) << (double)counts.counts[i]/msgs
+            << "  /KB: "  << std::setw(12) << (double)counts.counts[i]/kb
+            << (counts.userOnly[i] ? "  (user)" : "") << std::endl;
+    }
+}
+
+#endif
@@ -0,0 +1,330 @@
+/**
+ * pipeline.cpp
+ *    Times a parallel task pipeline (see ../pipeline.cpp for the example):
+ *
+ *    ventilator (PUSH) -> stage 0 workers (PULL/PUSH) -> ... -> sink (PULL)
+ *
+ * Each stage has the same number of workers.  Between stages a streamer
+ * (zmq_proxy from a bound PULL to a bound PUSH) joins the workers of one
+ * stage to those of the next, so every worker has exactly one connection
+ * each way and the PUSH sockets load balance over the next stage.
+ *
+ * Usage:
+ *    pipeline [-u usec] [-n stages] uri ntasks workers size
+ * Where:
+ *    -u  - microseconds of CPU each worker spends on a task (default 0).
+ *    -n  - number of worker stages (default 1).
+ *    uri - the ventilator binds it; the streamers and the sink bind the
+ *          following endpoints (see endpoints.h).
+ *    ntasks - tasks the ventilator sends.
+ *    workers - workers per stage.
+ *    size - task size (at least 16 bytes, the header).
+ *
+ * Timing starts once every worker is connected at both ends and stops when
+ * the sink has every result.  Each task carries the steady_clock time it
+ * was ventilated so the sink gets the completion latency.  The ventilator
+ * sends as fast as the pipeline takes tasks, so with enough tasks the
+ * latency includes queueing in front of the slowest stage.
+ *
+ * Reported: tasks/sec, KB/sec, completion latency percentiles, CPU seconds
+ * and the fewest/most tasks any worker did.
+ *
+ * @note this is not production code; missing parameters will segfault.
+ */
+#include <thread>
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "monitor.h"
+#include "endpoints.h"
+#include "cputime.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+/**
+ *  setBuffering
+ *    Set send/receive buffers to 2MBytes.
+ * @param socket
+ */
+static void
+setBuffering(void* socket) {
+    int maxSize = 1024*1024*2;     // 2mbytes.
+    checkError(
+        zmq_setsockopt(socket, ZMQ_SNDBUF, &maxSize, sizeof(int)),
+        "Setting send buffer size"
+    );
+    checkError(
+        zmq_setsockopt(socket, ZMQ_RCVBUF, &maxSize, sizeof(int)),
+        "Setting receive buffer size"
+    );
+}
+
+// The front of every task:
+
+struct TaskHeader {
+    uint64_t id;
+    int64_t  sent;        // steady_clock nanoseconds at ventilation.
+};
+
+static int64_t
+now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+/**
+ * spin
+ *    Use CPU for some microseconds (the worker's "work").
+ */
+static void
+spin(int usec) {
+    if (usec <= 0) return;
+    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(usec);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+/**
+ * Endpoints: the ventilator is 0; between stage s-1 and s the streamer's
+ * PULL is 2s-1 and its PUSH is 2s; the sink is 2*stages-1.
+ */
+static std::string
+inputOf(const std::string& uri, int stage) {
+    return nthEndpoint(uri, 2*stage);
+}
+static std::string
+outputOf(const std::string& uri, int stage) {
+    return nthEndpoint(uri, 2*stage + 1);
+}
+/**
+ * makeSocket
+ *    A buffered socket with linger 0, set while setsockopt still works
+ * (it fails with ETERM once the context is shut down).
+ */
+static void*
+makeSocket(void* ctx, int type, const char* doing) {
+    auto socket = checkError(zmq_socket(ctx, type), doing);
+    setBuffering(socket);
+    int linger(0);
+    checkError(zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    return socket;
+}
+/**
+ * worker
+ *    Pull a task, work on it, push it on.  Runs until the context is shut
+ * down.
+ * @param uri - base endpoint.
+ * @param ctx - shared context.
+ * @param stage - our stage.
+ * @param usec - work per task.
+ * @param connected - Latch we count down once connected at both ends.
+ * @param done - where we put the number of tasks we did.
+ */
+static void
+worker(std::string uri, void* ctx, int stage, int usec, std::latch& connected, int& done) {
+    auto in  = makeSocket(ctx, ZMQ_PULL, "Making worker pull socket");
+    auto out = makeSocket(ctx, ZMQ_PUSH, "Making worker push socket");
+    checkError(zmq_connect(in, inputOf(uri, stage).c_str()), "Connecting worker input");
+    checkError(zmq_connect(out, outputOf(uri, stage).c_str()), "Connecting worker output");
+    connected.count_down();
+
+    done = 0;
+    while (true) {
+        zmq_msg_t msg;
+        checkError(zmq_msg_init(&msg), "Initializing message");
+        if (zmq_msg_recv(&msg, in, 0) < 0) {
+            zmq_msg_close(&msg);
+            if (zmq_errno() == ETERM) break;
+            checkError(-1, "Receiving task");
+        }
+        spin(usec);
+        if (zmq_msg_send(&msg, out, 0) < 0) {      // Passes the task on without a copy.
+            zmq_msg_close(&msg);
+            if (zmq_errno() == ETERM) break;
+            checkError(-1, "Sending result");
+        }
+        done++;
+    }
+    zmq_close(in);
+    zmq_close(out);
+}
+/**
+ * streamer
+ *    Moves tasks from one stage to the next until the context is shut down.
+ * The sockets were made and bound by main.
+ */
+static void
+streamer(void* pull, void* push) {
+    zmq_proxy(pull, push, nullptr);
+    zmq_close(pull);
+    zmq_close(push);
+}
+/**
+ * bindMonitored
+ *    Make and bind a socket whose connections we'll wait for.
+ */
+static void*
+bindMonitored(void* ctx, int type, const std::string& uri, SocketMonitor*& monitor) {
+    auto socket = makeSocket(ctx, type, "Making socket");
+    monitor = new SocketMonitor(ctx, socket, ZMQ_EVENT_HANDSHAKE_SUCCEEDED);
+    checkError(zmq_bind(socket, uri.c_str()), "Binding socket");
+    return socket;
+}
+
+int main(int argc, char** argv) {
+    int usec(0);
+    int nstages(1);
+    int opt;
+    while ((opt = getopt(argc, argv, "u:n:")) != -1) {
+        switch (opt) {
+        case 'u':
+            usec = atoi(optarg);
+            break;
+        case 'n':
+            nstages = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: pipeline [-u usec] [-n stages] uri ntasks workers size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int ntasks   = atoi(argv[optind+1]);
+    int nworkers = atoi(argv[optind+2]);
+    int size     = atoi(argv[optind+3]);
+    if (size < (int)sizeof(TaskHeader)) size = sizeof(TaskHeader);
+
+    auto context = checkError(zmq_ctx_new(), "Making ZMQ context");
+
+    // Everything that binds.  Each stage's input is a PUSH we wait on all
+    // the stage's workers connecting to; the PULLs only fair queue so
+    // their connections don't matter to the timing:
+
+    std::vector<void*> inputs;
+    std::vector<SocketMonitor*> monitors(nstages);
+    std::vector<void*> streamerPulls;
+    inputs.push_back(bindMonitored(context, ZMQ_PUSH, inputOf(uri, 0), monitors[0]));
+    for (int s = 1; s < nstages; s++) {
+        auto pull = makeSocket(context, ZMQ_PULL, "Making streamer pull");
+        checkError(zmq_bind(pull, outputOf(uri, s - 1).c_str()), "Binding streamer pull");
+        streamerPulls.push_back(pull);
+        inputs.push_back(bindMonitored(context, ZMQ_PUSH, inputOf(uri, s), monitors[s]));
+    }
+    auto sink = makeSocket(context, ZMQ_PULL, "Making sink socket");
+    checkError(zmq_bind(sink, outputOf(uri, nstages - 1).c_str()), "Binding sink");
+
+    // Workers, then wait for them all to be connected:
+
+    std::vector<std::latch*> connected;
+    std::vector<int> done(nstages*nworkers);
+    std::vector<std::thread*> workers;
+    for (int s = 0; s < nstages; s++) {
+        connected.push_back(new std::latch(nworkers));
+        for (int w = 0; w < nworkers; w++) {
+            workers.push_back(new std::thread(
+                worker, uri, context, s, usec, std::ref(*connected[s]),
+                std::ref(done[s*nworkers + w])
+            ));
+        }
+    }
+    for (int s = 0; s < nstages; s++) {
+        waitForPeers(*monitors[s], inputOf(uri, s), nworkers, *connected[s]);
+        delete monitors[s];
+        delete connected[s];
+    }
+    // Sockets may move between threads (thread creation is a barrier):
+
+    std::vector<std::thread*> streamers;
+    for (int s = 1; s < nstages; s++) {
+        streamers.push_back(new std::thread(streamer, streamerPulls[s - 1], inputs[s]));
+    }
+
+    // Ventilate from a thread; the sink is main:
+
+    void* ventilator = inputs[0];
+    double cpuStart = processCpuSeconds();
+    auto start = std::chrono::steady_clock::now();
+    std::thread ventilatorThread([ventilator, ntasks, size]() {
+        char* task = new char[size];
+        memset(task, 0, size);
+        for (int i = 0; i < ntasks; i++) {
+            TaskHeader header = {(uint64_t)i, now()};
+            memcpy(task, &header, sizeof(header));
+            checkError(zmq_send(ventilator, task, size, 0), "Ventilating task");
+        }
+        delete []task;
+    });
+    std::vector<double> latencies;      // usec.
+    latencies.reserve(ntasks);
+    for (int i = 0; i < ntasks; i++) {
+        zmq_msg_t msg;
+        checkError(zmq_msg_init(&msg), "Initializing message");
+        checkError(zmq_msg_recv(&msg, sink, 0), "Receiving result");
+        int64_t received = now();
+        TaskHeader header;
+        memcpy(&header, zmq_msg_data(&msg), sizeof(header));
+        zmq_msg_close(&msg);
+        latencies.push_back((double)(received - header.sent)/1000.0);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double cpuSecs = processCpuSeconds() - cpuStart;
+    ventilatorThread.join();
+
+    // Shut down: blocked workers and streamers get ETERM.
+
+    zmq_close(ventilator);
+    zmq_close(sink);
+    checkError(zmq_ctx_shutdown(context), "Shutting down context");
+    for (auto p : workers) {
+        p->join();
+        delete p;
+    }
+    for (auto p : streamers) {
+        p->join();
+        delete p;
+    }
+    checkError(zmq_ctx_term(context), "Terminating context");
+
+    // Report:
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    std::sort(latencies.begin(), latencies.end());
+    auto minmax = std::minmax_element(done.begin(), done.end());
+
+    std::cout << "Stages:          " << nstages << std::endl;
+    std::cout << "Workers/stage:   " << nworkers << std::endl;
+    std::cout << "Seconds:         " << secs << std::endl;
+    std::cout << "Tasks:           " << ntasks << std::endl;
+    std::cout << "Tasks/sec:       " << (double)ntasks/secs << std::endl;
+    std::cout << "KB/sec:          " << (double)ntasks*size/(1024.0*secs) << std::endl;
+    std::cout << "CPU secs:        " << cpuSecs << std::endl;
+    std::cout << "Latency usec p50: " << latencies[latencies.size()/2]
+        << " p99: " << latencies[(latencies.size()*99)/100]
+        << " max: " << latencies.back() << std::endl;
+    std::cout << "Tasks/worker:    " << *minmax.first << " - " << *minmax.second << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+/**
+ * pool.cpp
+ *    Times the worker pool service in ../reqrep.cpp: REQ clients talk to a
+ * ROUTER, a zmq_proxy passes requests to an inproc DEALER and W REP worker
+ * threads answer them.  Run it with 1 worker and then more to see how far
+ * the service scales past one core.
+ *
+ * Usage:
+ *    pool [-u usec] [-s size] uri nclients nworkers nummsgs
+ * Where:
+ *    -u  - microseconds of CPU each worker spends on a request (default 0).
+ *          With 0 the proxy and sockets are all there is to time; real
+ *          services do work and that's what more workers spread.
+ *    -s  - size of requests and replies (default 64).
+ *    uri - endpoint the ROUTER binds.
+ *    nclients - requester threads, each with its own REQ socket.
+ *    nworkers - REP worker threads.
+ *    nummsgs - requests in total, split evenly over the clients.
+ *
+ * Each client does one untimed request first so every connection is up
+ * before timing starts.  Reported are requests/sec, the mean round trip
+ * seen by a client, CPU seconds and how evenly the workers were used.
+ */
+#include <thread>
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "cputime.h"
+
+static const char* WORKERS_URI = "inproc://pool-workers";
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+/**
+ * send a message (not necessarily a string) to the
+ * peer:
+ *
+ * @param socket - socket to carry the message.
+ * @param msg    - Pointer to the message.
+ * @param nBytes - size of the message
+ */
+static void
+send(void* socket, void* data, size_t len) {
+    checkError(
+        zmq_send(socket, data, len, 0),
+        "Sending data on socket."
+    );
+}
+/**
+ * ignore
+ *    Receive a message and ignore it.
+ * @param socket - socket that receives the message.
+ * @return int - negative if the receive failed (zmq_errno says why).
+ */
+static int
+ignore(void* socket) {
+    zmq_msg_t msg;
+    checkError(zmq_msg_init(&msg), "Initializing message");
+    int status = zmq_recvmsg(socket, &msg, 0);
+    zmq_msg_close(&msg);
+    return status;
+}
+/**
+ * spin
+ *    Use CPU for some microseconds (the worker's "work").
+ */
+static void
+spin(int usec) {
+    if (usec <= 0) return;
+    auto until = std::chrono::high_resolution_clock::now() + std::chrono::microseconds(usec);
+    while (std::chrono::high_resolution_clock::now() < until) {
+    }
+}
+/**
+ * broker
+ *    ROUTER on uri proxied to the workers' DEALER until the context is
+ * shut down.
+ * @param uri - endpoint for the clients.
+ * @param ctx - shared context.
+ * @param bound - Latch we count down once both sockets are bound.
+ */
+static void
+broker(std::string uri, void* ctx, std::latch& bound) {
+    auto frontend = checkError(zmq_socket(ctx, ZMQ_ROUTER), "Making router socket");
+    auto backend  = checkError(zmq_socket(ctx, ZMQ_DEALER), "Making dealer socket");
+    int linger(0);                // Before zmq_ctx_shutdown makes setsockopt fail.
+    checkError(zmq_setsockopt(frontend, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    checkError(zmq_setsockopt(backend, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    checkError(zmq_bind(frontend, uri.c_str()), "Binding ROUTER socket");
+    checkError(zmq_bind(backend, WORKERS_URI), "Binding DEALER socket");
+    bound.count_down();
+
+    zmq_proxy(frontend, backend, nullptr);      // Returns on zmq_ctx_shutdown.
+
+    checkError(zmq_close(frontend), "Closing router socket");
+    checkError(zmq_close(backend), "Closing dealer socket");
+}
+/**
+ * worker
+ *    A REP worker.
+ * @param ctx - shared context.
+ * @param size - reply size.
+ * @param usec - work per request.
+ * @param handled - requests we answered.
+ */
+static void
+worker(void* ctx, int size, int usec, int& handled) {
+    auto socket = checkError(zmq_socket(ctx, ZMQ_REP), "Making worker socket");
+    int linger(0);
+    checkError(zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    checkError(zmq_connect(socket, WORKERS_URI), "Connecting worker");
+    char* reply = new char[size];
+    memset(reply, 0, size);
+    handled = 0;
+    while (ignore(socket) >= 0) {
+        spin(usec);
+        send(socket, reply, size);
+        handled++;
+    }
+    if (zmq_errno() != ETERM) {
+        checkError(-1, "Receiving request");
+    }
+    delete []reply;
+    checkError(zmq_close(socket), "Closing worker socket");
+}
+/**
+ * client
+ *    A requester.
+ * @param uri - where to connect.
+ * @param ctx - shared context.
+ * @param nreq - timed requests to make.
+ * @param size - request size.
+ * @param start - Latch everyone arrives at to start timing.
+ */
+static void
+client(std::string uri, void* ctx, int nreq, int size, std::latch& start) {
+    auto socket = checkError(zmq_socket(ctx, ZMQ_REQ), "Making request socket");
+    checkError(zmq_connect(socket, uri.c_str()), "Connecting to service");
+    char* request = new char[size];
+    memset(request, 0, size);
+
+    send(socket, request, size);                 // Connection is up after this.
+    checkError(ignore(socket), "Receiving reply");
+    start.arrive_and_wait();
+
+    for (int i = 0; i < nreq; i++) {
+        send(socket, request, size);
+        checkError(ignore(socket), "Receiving reply");
+    }
+    delete []request;
+    checkError(zmq_close(socket), "Closing request socket");
+}
+
+int main(int argc, char** argv) {
+    int usec(0);
+    int size(64);
+    int opt;
+    while ((opt = getopt(argc, argv, "u:s:")) != -1) {
+        switch (opt) {
+        case 'u':
+            usec = atoi(optarg);
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: pool [-u usec] [-s size] uri nclients nworkers nummsgs\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nclients = atoi(argv[optind+1]);
+    int nworkers = atoi(argv[optind+2]);
+    int nummsgs  = atoi(argv[optind+3]);
+    int perClient = nummsgs/nclients;
+
+    auto context = checkError(zmq_ctx_new(), "Making ZMQ context");
+    std::latch bound(1);
+    std::thread brokerThread(broker, uri, context, std::ref(bound));
+    bound.wait();
+
+    std::vector<int> handled(nworkers);
+    std::vector<std::thread*> workers;
+    for (int i = 0; i < nworkers; i++) {
+        workers.push_back(new std::thread(worker, context, size, usec, std::ref(handled[i])));
+    }
+    std::latch start(nclients + 1);
+    std::vector<std::thread*> clients;
+    for (int i = 0; i < nclients; i++) {
+        clients.push_back(new std::thread(
+            client, uri, context, perClient, size, std::ref(start)
+        ));
+    }
+    start.arrive_and_wait();
+    double cpuStart = processCpuSeconds();
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (auto p : clients) {
+        p->join();
+        delete p;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double cpuSecs = processCpuSeconds() - cpuStart;
+
+    checkError(zmq_ctx_shutdown(context), "Shutting down context");
+    brokerThread.join();
+    for (auto p : workers) {
+        p->join();
+        delete p;
+    }
+    checkError(zmq_ctx_term(context), "Terminating ZMQ context");
+
+    int total = perClient*nclients;
+    double secs = (double)std::chrono::duration_cast<std::chrono::microseconds>(end - begin)
+        .count()/1.0e6;
+    auto minmax = std::minmax_element(handled.begin(), handled.end());
+
+    std::cout << "Workers:      " << nworkers << std::endl;
+    std::cout << "Seconds:      " << secs << std::endl;
+    std::cout << "Requests:     " << total << std::endl;
+    std::cout << "Requests/sec: " << (double)total/secs << std::endl;
+    std::cout << "RTT usec:     " << secs*1.0e6*nclients/total << std::endl;
+    std::cout << "CPU secs:     " << cpuSecs << std::endl;
+    std::cout << "Per worker:   " << *minmax.first << " - " << *minmax.second
+        << " (includes " << nclients << " untimed)\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,439 @@
+/**
+ * proxychain.cpp
+ *    Times chains of zmq_proxy hops between a sender and a receiver, to see
+ * what each hop (edge, aggregation, core...) adds:
+ *
+ *    sender -> proxy 0 -> proxy 1 -> ... -> proxy n-1 -> receiver
+ *
+ * Proxy i binds its frontend on the i'th endpoint and connects its backend
+ * to the next; the receiver binds the n'th (see endpoints.h).  Patterns:
+ *
+ * *  push   - PUSH -> [PULL proxy PUSH]... -> PULL.
+ * *  pub    - XPUB -> [XSUB proxy XPUB]... -> SUB.  The sender waits for the
+ *             receiver's subscription to make its way up the chain.
+ * *  router - DEALER -> [ROUTER proxy DEALER]... -> REP, which echoes.  Times
+ *             are round trips, so every hop is crossed twice.
+ *
+ * Each chain length from 0 (sender straight to receiver) to nhops is built
+ * in turn and timed twice:
+ *
+ * *  Latency - nprobes messages one at a time (the next isn't sent until the
+ *    last has arrived) carrying their send time.
+ * *  Throughput - nummsgs as fast as the chain takes them (router keeps
+ *    WINDOW requests outstanding).
+ *
+ * Usage:
+ *    proxychain [-t pattern] [-c cores] [-l nprobes] uri nhops nummsgs size
+ * Where:
+ *    -t  - push (default), pub or router.
+ *    -c  - comma separated cores to pin proxy threads to, proxy i on the
+ *          i'th (round robin).  Default: not pinned.
+ *    -l  - latency probes per chain (default 1000).
+ *    uri - base endpoint.
+ *    nhops - longest chain.
+ *    nummsgs - messages for the throughput timing.
+ *    size - message size (at least 9: a type byte and the send time).
+ *
+ * One line is reported per chain: latency p50 and p99 in usec, p50 added per
+ * hop over the chain with no proxies, msgs/sec, and messages lost (pub).
+ *
+ * @note this is not production code; missing parameters will segfault.
+ */
+#include <thread>
+#include <latch>
+#include <atomic>
+#include <zmq.h>
+#include <pthread.h>
+#include <sched.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "monitor.h"
+#include "endpoints.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+enum Pattern {PUSH, PUB, ROUTER};
+
+// Message types (first byte), then the send time:
+
+static const char PROBE = 0;
+static const char DATA  = 1;
+static const char END   = 2;
+static const size_t STAMP_OFFSET = 1;
+static const size_t HEADER_SIZE  = STAMP_OFFSET + sizeof(int64_t);
+
+static const int WINDOW = 100;          // Outstanding router requests.
+static const int WARMUP = 10;           // Probes not counted.
+
+// steady_clock nanoseconds:
+
+static int64_t
+now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+/**
+ * pin
+ *    Pin the calling thread to a core.
+ */
+static void
+pin(int core) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    int status = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (status) {
+        std::cerr << "Failed pinning to core " << core << " " << strerror(status) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+/**
+ * makeSocket
+ *    Make a socket that won't hold up zmq_ctx_term.  Linger is set now since
+ * setsockopt fails with ETERM once the context is shut down.
+ */
+static void*
+makeSocket(void* ctx, int type) {
+    auto socket = checkError(zmq_socket(ctx, type), "Making socket");
+    int linger(0);
+    checkError(zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    return socket;
+}
+/**
+ * proxy
+ *    One hop: runs zmq_proxy until the context is shut down.
+ *
+ * @param ctx - shared context.
+ * @param pattern - which sockets.
+ * @param frontend - endpoint to bind.
+ * @param backend - endpoint to connect to.
+ * @param core - core to pin to, -1 for none.
+ * @param ready - latch we count down once bound and connected.
+ */
+static void
+proxy(
+    void* ctx, Pattern pattern, std::string frontend, std::string backend, int core,
+    std::latch& ready
+) {
+    if (core >= 0) pin(core);
+    static const int types[3][2] = {
+        {ZMQ_PULL, ZMQ_PUSH}, {ZMQ_XSUB, ZMQ_XPUB}, {ZMQ_ROUTER, ZMQ_DEALER}
+    };
+    auto in  = makeSocket(ctx, types[pattern][0]);
+    auto out = makeSocket(ctx, types[pattern][1]);
+    checkError(zmq_bind(in, frontend.c_str()), "Binding proxy frontend");
+    checkError(zmq_connect(out, backend.c_str()), "Connecting proxy backend");
+    ready.count_down();
+
+    zmq_proxy(in, out, nullptr);               // Returns on zmq_ctx_shutdown.
+    zmq_close(in);
+    zmq_close(out);
+}
+
+// What the receiver saw:
+
+struct Received {
+    std::atomic<int> probes{0};
+    std::vector<double> latencies;       // usec, warmup included.
+    int data = 0;
+    std::chrono::steady_clock::time_point finished;
+    std::atomic<bool> done{false};       // finished is set.
+};
+/**
+ * receiver
+ *    End of a push or pub chain: timestamps probes, counts data until END.
+ */
+static void
+receiver(void* ctx, Pattern pattern, std::string uri, Received& got, std::latch& ready) {
+    auto socket = makeSocket(ctx, pattern == PUB ? ZMQ_SUB : ZMQ_PULL);
+    if (pattern == PUB) {
+        checkError(zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "", 0), "Subscribing");
+    }
+    checkError(zmq_bind(socket, uri.c_str()), "Binding receiver");
+    ready.count_down();
+
+    while (true) {
+        zmq_msg_t msg;
+        zmq_msg_init(&msg);
+        checkError(zmq_msg_recv(&msg, socket, 0), "Receiving");
+        const char* data = static_cast<const char*>(zmq_msg_data(&msg));
+        char type = *data;
+        if (type == PROBE) {
+            int64_t stamp;
+            memcpy(&stamp, data + STAMP_OFFSET, sizeof(stamp));
+            got.latencies.push_back((now() - stamp)/1000.0);
+            got.probes++;
+        } else if (type == DATA) {
+            got.data++;
+        }
+        zmq_msg_close(&msg);
+        if (type == END) break;
+    }
+    got.finished = std::chrono::steady_clock::now();
+    got.done = true;
+    zmq_close(socket);
+}
+/**
+ * echoer
+ *    End of a router chain: sends every request back until the context is
+ * shut down.
+ */
+static void
+echoer(void* ctx, std::string uri, std::latch& ready) {
+    auto socket = makeSocket(ctx, ZMQ_REP);
+    checkError(zmq_bind(socket, uri.c_str()), "Binding echoer");
+    ready.count_down();
+    while (true) {
+        zmq_msg_t msg;
+        zmq_msg_init(&msg);
+        if (zmq_msg_recv(&msg, socket, 0) < 0 || zmq_msg_send(&msg, socket, 0) < 0) {
+            zmq_msg_close(&msg);
+            break;
+        }
+    }
+    if (zmq_errno() != ETERM) {
+        checkError(-1, "Echoing");
+    }
+    zmq_close(socket);
+}
+
+// A chain's timings:
+
+struct ChainTimes {
+    std::vector<double> latencies;       // usec.
+    double msgsPerSec;
+    int    lost;
+};
+/**
+ * stamp
+ *    Make message a type with the current time.
+ */
+static void
+stamp(char* message, char type) {
+    *message = type;
+    int64_t t = now();
+    memcpy(message + STAMP_OFFSET, &t, sizeof(t));
+}
+/**
+ * request, reply
+ *    Router chains: a DEALER request is [empty][message], and so is the
+ * reply; reply returns the send time it carries.
+ */
+static void
+request(void* socket, const char* message, int size) {
+    checkError(zmq_send(socket, "", 0, ZMQ_SNDMORE), "Sending delimiter");
+    checkError(zmq_send(socket, message, size, 0), "Sending request");
+}
+static int64_t
+reply(void* socket, char* buffer, int size) {
+    checkError(zmq_recv(socket, buffer, 0, 0), "Receiving delimiter");
+    checkError(zmq_recv(socket, buffer, size, 0), "Receiving reply");
+    int64_t sent;
+    memcpy(&sent, buffer + STAMP_OFFSET, sizeof(sent));
+    return sent;
+}
+
+/**
+ * timeChain
+ *    Build a chain of nhops proxies, time it and tear it down.
+ */
+static ChainTimes
+timeChain(
+    Pattern pattern, const std::string& uri, int nhops, const std::vector<int>& cores,
+    int nprobes, int nummsgs, int size
+) {
+    ChainTimes times;
+    auto ctx = checkError(zmq_ctx_new(), "Making context");
+
+    // From the receiving end back, so every connect has something bound:
+
+    std::latch ready(nhops + 1);
+    Received got;
+    std::thread* end;
+    if (pattern == ROUTER) {
+        end = new std::thread(echoer, ctx, nthEndpoint(uri, nhops), std::ref(ready));
+    } else {
+        end = new std::thread(
+            receiver, ctx, pattern, nthEndpoint(uri, nhops), std::ref(got), std::ref(ready)
+        );
+    }
+    std::vector<std::thread*> proxies;
+    for (int i = nhops - 1; i >= 0; i--) {
+        int core = cores.empty() ? -1 : cores[i % cores.size()];
+        proxies.push_back(new std::thread(
+            proxy, ctx, pattern, nthEndpoint(uri, i), nthEndpoint(uri, i + 1), core,
+            std::ref(ready)
+        ));
+    }
+    ready.wait();
+    static const int senders[3] = {ZMQ_PUSH, ZMQ_XPUB, ZMQ_DEALER};
+    auto sender = makeSocket(ctx, senders[pattern]);
+    if (pattern == PUB) {
+        int verbose(1);
+        checkError(
+            zmq_setsockopt(sender, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose)),
+            "Setting ZMQ_XPUB_VERBOSE"
+        );
+    }
+    checkError(zmq_connect(sender, uri.c_str()), "Connecting sender");
+    if (pattern == PUB) {
+        waitForSubscribers(sender, 1);          // Up the whole chain.
+    }
+
+    char* message = new char[size];
+    memset(message, 0, size);
+
+    // Latency, one probe at a time:
+
+    for (int i = 0; i < WARMUP + nprobes; i++) {
+        stamp(message, PROBE);
+        if (pattern == ROUTER) {
+            request(sender, message, size);
+            int64_t sent = reply(sender, message, size);
+            if (i >= WARMUP) times.latencies.push_back((now() - sent)/1000.0);
+        } else {
+            checkError(zmq_send(sender, message, size, 0), "Sending probe");
+            while (got.probes.load() <= i) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    if (pattern != ROUTER) {
+        times.latencies.assign(got.latencies.begin() + WARMUP, got.latencies.end());
+    }
+
+    // Throughput:
+
+    auto start = std::chrono::steady_clock::now();
+    stamp(message, DATA);
+    if (pattern == ROUTER) {
+        int sent(0);
+        int received(0);
+        while (received < nummsgs) {
+            while (sent < nummsgs && sent - received < WINDOW) {
+                request(sender, message, size);
+                sent++;
+            }
+            reply(sender, message, size);
+            received++;
+        }
+        times.msgsPerSec = nummsgs/std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+        times.lost = 0;
+    } else {
+        for (int i = 0; i < nummsgs; i++) {
+            checkError(zmq_send(sender, message, size, 0), "Sending data");
+        }
+        *message = END;                         // Until the receiver has one.
+        while (!got.done.load()) {
+            if (zmq_send(sender, message, size, ZMQ_DONTWAIT) < 0 && zmq_errno() != EAGAIN) {
+                checkError(-1, "Sending end");
+            }
+            usleep(100);
+        }
+        end->join();
+        times.msgsPerSec = got.data/std::chrono::duration<double>(got.finished - start).count();
+        times.lost = nummsgs - got.data;
+    }
+
+    zmq_close(sender);
+    checkError(zmq_ctx_shutdown(ctx), "Shutting down context");
+    if (pattern == ROUTER) end->join();
+    delete end;
+    for (auto p : proxies) {
+        p->join();
+        delete p;
+    }
+    checkError(zmq_ctx_term(ctx), "Terminating context");
+    delete []message;
+    return times;
+}
+
+int main(int argc, char** argv) {
+    std::string pattern("push");
+    std::vector<int> cores;
+    int nprobes(1000);
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:l:")) != -1) {
+        switch (opt) {
+        case 't':
+            pattern = optarg;
+            break;
+        case 'c':
+            for (char* core = strtok(optarg, ","); core; core = strtok(nullptr, ",")) {
+                cores.push_back(atoi(core));
+            }
+            break;
+        case 'l':
+            nprobes = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: proxychain [-t push|pub|router] [-c cores] [-l nprobes] "
+                << "uri nhops nummsgs size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nhops   = atoi(argv[optind+1]);
+    int nummsgs = atoi(argv[optind+2]);
+    int size    = atoi(argv[optind+3]);
+    Pattern kind(PUSH);
+    if (pattern == "pub") {
+        kind = PUB;
+    } else if (pattern == "router") {
+        kind = ROUTER;
+    } else if (pattern != "push") {
+        std::cerr << "Unknown pattern " << pattern << " (push, pub or router)\n";
+        exit(EXIT_FAILURE);
+    }
+    if (size < (int)HEADER_SIZE) size = HEADER_SIZE;
+    if (nprobes < 1) nprobes = 1;
+
+    std::cout << "Pattern:   " << pattern << (kind == ROUTER ? " (round trips)" : "")
+        << " size: " << size << " pinned: " << (cores.empty() ? "no" : "yes") << std::endl;
+    double direct(0);
+    for (int hops = 0; hops <= nhops; hops++) {
+        ChainTimes times = timeChain(kind, uri, hops, cores, nprobes, nummsgs, size);
+        auto& l = times.latencies;
+        std::sort(l.begin(), l.end());
+        double p50 = l[l.size()/2];
+        if (hops == 0) direct = p50;
+        std::cout << "Hops: " << hops << " latency usec p50: " << p50
+            << " p99: " << l[(l.size()*99)/100];
+        if (hops > 0) {
+            std::cout << " per hop: " << (p50 - direct)/hops;
+        }
+        std::cout << " msgs/sec: " << times.msgsPerSec;
+        if (kind == PUB) {
+            std::cout << " lost: " << times.lost;
+        }
+        std::cout << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
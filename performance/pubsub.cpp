@@ -5,9 +5,36 @@
  * subscsribe to all messages.
  * 
  * Usage:
- *    pubsub uri nummsgs numsubscribers size
+ *    pubsub [-p] [-a] [-m] [-l] [-s usec] [-c delivery [-t ntopics] [-w usec]] uri nummsgs numsubscribers size
  * 
  * Where:
+ *    -p  - count cycles, instructions, LLC misses, context switches and
+ *          page faults for the publisher and (summed) subscribers (see perfcounters.h).
+ *    -a  - count allocations for the publisher, the (summed) subscribers and
+ *          the whole process (see allocstats.h; needs make ALLOCSTATS=1).
+ *    -m  - sample the process's RSS and heap while timing and report the
+ *          baseline, peak and steady state, and what connecting each
+ *          subscriber (socket, pipes and thread) cost (see memory.h).
+ *    -l  - lossless: the publisher sets ZMQ_XPUB_NODROP so a full subscriber
+ *          queue makes sends fail with EAGAIN instead of dropping; the
+ *          publisher retries and the report adds the time it spent blocked.
+ *    -s  - the first subscriber is slow: it spends usec of CPU on each
+ *          message.  With -l or -s the report adds what each subscriber
+ *          received and its delivered rate, slow one and the rest apart.
+ *    -c  - latest value delivery for price feeds, one of:
+ *          full     - every message is processed (the baseline).
+ *          conflate - the SUB sets ZMQ_CONFLATE: it keeps only the newest
+ *                     message, whatever its topic.
+ *          topics   - the subscriber drains what's queued into a table of the
+ *                     newest message per topic and processes each of those
+ *                     once (application conflation; ZMQ_CONFLATE can't do
+ *                     this for multi-topic feeds).
+ *          Messages then carry their send time and a topic and the report
+ *          adds staleness (the age of each value when a subscriber gets to
+ *          it), updates processed and subscriber CPU.  size must be >= 13.
+ *    -t  - with -c, topics published round robin (default 1).
+ *    -w  - with -c, microseconds of CPU a subscriber spends on each value
+ *          (default 0); makes subscribers slow.
  *    uri - is the communications endpoint URI.
  *    nummsgs - are the minimum number of publications that will be done.
  *    numsubscdribers - the number of subscsribers to spin off.
@@ -40,6 +67,8 @@
  * 
  * @note - observationally, with high rates of pub/sub on sockets (unix and tcp), 
  * delivery seems to be pretty lossy.
+ * @note - the publisher is an XPUB so it can wait for every subscription to
+ * arrive before timing starts (see waitForSubscribers in monitor.h).
  * 
  */
 
@@ -55,6 +84,12 @@
 #include <vector>
 #include <sstream>
 #include <chrono>
+#include <algorithm>
+#include "perfcounters.h"
+#include "allocstats.h"
+#include "cputime.h"
+#include "monitor.h"
+#include "memory.h"
 
 // check error for int returns.
 static int checkError(int status, const char* doing) {
@@ -133,6 +168,40 @@ ignore(void* socket, int flags = 0) {
     }
     return result;
 }
+/**
+ * Blocking
+ *    Where a lossless publisher waited for subscribers.
+ */
+struct Blocking {
+    double secs = 0;       // Between first EAGAIN and the send going through.
+    int    sends = 0;      // Sends that got EAGAIN.
+};
+/**
+ * sendLossless
+ *    Send on a ZMQ_XPUB_NODROP socket: EAGAIN means some subscriber's queue
+ * is full, so retry (yielding, there's no POLLOUT that means "every pipe has
+ * room") until it goes, timing the wait.
+ *
+ * @param socket - the publisher.
+ * @param data   - the message.
+ * @param len    - its size.
+ * @param blocked - accumulates the waits.
+ */
+static void
+sendLossless(void* socket, void* data, size_t len, Blocking& blocked) {
+    int status = zmq_send(socket, data, len, ZMQ_DONTWAIT);
+    if (status >= 0) return;
+    if (zmq_errno() != EAGAIN) checkError(status, "Sending data on socket.");
+
+    auto start = std::chrono::steady_clock::now();
+    blocked.sends++;
+    do {
+        std::this_thread::yield();
+        status = zmq_send(socket, data, len, ZMQ_DONTWAIT);
+    } while (status < 0 && zmq_errno() == EAGAIN);
+    checkError(status, "Sending data on socket.");
+    blocked.secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 /**
  *  setBuffering
  *    Set send/receive buffers to 2MBytes.
@@ -160,7 +229,193 @@ setBuffering(void* socket) {
     
 }
 
+// Latest value messages: done flag, send stamp, topic.
+
+static const size_t STAMP_OFFSET = 1;
+static const size_t TOPIC_OFFSET = STAMP_OFFSET + sizeof(int64_t);
+static const size_t QUOTE_SIZE   = TOPIC_OFFSET + sizeof(uint32_t);
+
+// Most queued messages the topics subscriber takes before processing them
+// (ZMQ's default receive high water mark):
+
+static const int MAX_DRAIN = 1000;
+
+enum Delivery {FULL, CONFLATE, TOPICS};
+
+// steady_clock nanoseconds:
+
+static int64_t
+now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+/**
+ * spin
+ *    Use CPU for some microseconds (a subscriber's "work").
+ */
+static void
+spin(int usec) {
+    if (usec <= 0) return;
+    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(usec);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+/**
+ * LatestStats
+ *    What one latest value subscriber saw.
+ */
+struct LatestStats {
+    std::vector<double> staleness;    // usec per processed value.
+    int    received = 0;              // Messages received.
+    int    processed = 0;             // Values processed.
+    int    missed = 0;                // Topics never processed.
+    double cpuSecs = 0;               // Thread CPU receiving and processing.
+};
+/**
+ * process
+ *    "Process" a value: note how old it is and do the work.
+ */
+static void
+process(zmq_msg_t& msg, int usec, LatestStats& stats, std::vector<char>& seen, int ntopics) {
+    const char* data = static_cast<const char*>(zmq_msg_data(&msg));
+    int64_t stamp;
+    uint32_t topic;
+    memcpy(&stamp, data + STAMP_OFFSET, sizeof(stamp));
+    memcpy(&topic, data + TOPIC_OFFSET, sizeof(topic));
+    stats.staleness.push_back((double)(now() - stamp)/1000.0);
+    seen[topic % ntopics] = 1;
+    spin(usec);
+    stats.processed++;
+}
+/**
+ * latestSubscriber
+ *    Subscriber for -c.  Shutdown is done as in subscriber.
+ *
+ * @param delivery - FULL, CONFLATE or TOPICS.
+ * @param ntopics - Number of topics published.
+ * @param usec - Work per value.
+ * @param stats - What we saw.
+ *
+ * Other parameters are as for subscriber.
+ */
+static void
+latestSubscriber(
+    std::string uri, void* ctx, std::latch& done, std::latch& exitlatch,
+    bool perf, PerfTotals& totals, bool allocs, AllocTotals& allocTotals,
+    Delivery delivery, int ntopics, int usec, LatestStats& stats
+) {
+    auto socket = checkError(
+        zmq_socket(ctx, ZMQ_SUB),
+        "Creating subscriber socket."
+    );
+    setBuffering(socket);
+    if (delivery == CONFLATE) {
+        int conflate(1);
+        checkError(
+            zmq_setsockopt(socket, ZMQ_CONFLATE, &conflate, sizeof(conflate)),
+            "Setting ZMQ_CONFLATE"
+        );
+    }
+    checkError(
+        zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "", 0),
+        "Setting up subscription"
+    );
+    checkError(
+        zmq_connect(socket, uri.c_str()),
+        "Connecting to publisher."
+    );
+    std::vector<char> seen(ntopics);
+    PerfCounters counters(perf);
+    AllocCounter allocCounter(allocs);
+    double cpuStart = threadCpuSeconds();
+    counters.start();
+    allocCounter.start();
+    if (delivery != TOPICS) {
+        // Process what arrives; with ZMQ_CONFLATE that's only ever the newest:
+
+        while (true) {
+            zmq_msg_t msg;
+            checkError(zmq_msg_init(&msg), "Initializing message");
+            checkError(zmq_msg_recv(&msg, socket, 0), "Receiving message");
+            if (*static_cast<uint8_t*>(zmq_msg_data(&msg))) {
+                zmq_msg_close(&msg);
+                break;
+            }
+            stats.received++;
+            process(msg, usec, stats, seen, ntopics);
+            zmq_msg_close(&msg);
+        }
+    } else {
+        // Wait for a message, take what else is queued into the newest
+        // value per topic (zmq_msg_move, no copies) then process those:
+
+        std::vector<zmq_msg_t> latest(ntopics);
+        std::vector<char>      dirty(ntopics);
+        for (auto& m : latest) zmq_msg_init(&m);
+        bool finished(false);
+        while (!finished) {
+            int flags(0);
+            for (int n = 0; n < MAX_DRAIN; n++) {
+                zmq_msg_t msg;
+                checkError(zmq_msg_init(&msg), "Initializing message");
+                int status = zmq_msg_recv(&msg, socket, flags);
+                if (status < 0 && zmq_errno() == EAGAIN) {
+                    zmq_msg_close(&msg);
+                    break;
+                }
+                checkError(status, "Receiving message");
+                flags = ZMQ_DONTWAIT;
+                const char* data = static_cast<const char*>(zmq_msg_data(&msg));
+                if (*data) {
+                    zmq_msg_close(&msg);
+                    finished = true;
+                    break;
+                }
+                stats.received++;
+                uint32_t topic;
+                memcpy(&topic, data + TOPIC_OFFSET, sizeof(topic));
+                topic %= ntopics;
+                zmq_msg_move(&latest[topic], &msg);      // Replaces the older value.
+                dirty[topic] = 1;
+                zmq_msg_close(&msg);
+            }
+            for (int t = 0; t < ntopics; t++) {
+                if (dirty[t]) {
+                    process(latest[t], usec, stats, seen, ntopics);
+                    dirty[t] = 0;
+                }
+            }
+        }
+        for (auto& m : latest) zmq_msg_close(&m);
+    }
+    allocCounter.stop();
+    counters.stop();
+    stats.cpuSecs = threadCpuSeconds() - cpuStart;
+    totals.add(counters.read());
+    allocTotals.add(allocCounter.read());
+    for (auto s : seen) {
+        if (!s) stats.missed++;
+    }
 
+    done.count_down();
+    while(!done.try_wait()) {
+        ignore(socket, ZMQ_DONTWAIT);
+    }
+    exitlatch.arrive_and_wait();
+    checkError(
+        zmq_close(socket),
+        "Closing subscsriber socket."
+    );
+}
+/**
+ * DeliveryStats
+ *    What a subscriber got, and when it saw the end.
+ */
+struct DeliveryStats {
+    int received = 0;
+    std::chrono::high_resolution_clock::time_point finished;
+};
 /**
  *  subscriber:
  *     -  Set up the subscription to the publisher.
@@ -171,10 +426,20 @@ setBuffering(void* socket) {
  * @param done - references a latch that we will signal when we get the done message
  * @param exitlatch - references a latch that we will signal to know when it's ok to
  * tear down the subscription and exit.
+ * @param perf - True to count performance events.
+ * @param totals - Where our performance counts are summed.
+ * @param allocs - True to count allocations.
+ * @param allocTotals - Where our allocation counts are summed.
+ * @param usec - CPU to spend on each message (-s).
+ * @param delivered - What we got.
  * @note  This function is normally a thread.
  */
 static void
-subscriber(std::string uri, void* ctx, std::latch& done, std::latch& exitlatch) {
+subscriber(
+    std::string uri, void* ctx, std::latch& done, std::latch& exitlatch,
+    bool perf, PerfTotals& totals, bool allocs, AllocTotals& allocTotals,
+    int usec, DeliveryStats& delivered
+) {
     // set up as a subscriber:
 
     auto socket = checkError(
@@ -194,9 +459,20 @@ subscriber(std::string uri, void* ctx, std::latch& done, std::latch& exitlatch)
 
     // Get messages until there's a non-zero first byte:
     int got(0);
+    PerfCounters counters(perf);
+    AllocCounter allocCounter(allocs);
+    counters.start();
+    allocCounter.start();
     while(ignore(socket) == 0) {
         got++;
+        spin(usec);
     }
+    allocCounter.stop();
+    counters.stop();
+    delivered.received = got;
+    delivered.finished = std::chrono::high_resolution_clock::now();
+    totals.add(counters.read());
+    allocTotals.add(allocCounter.read());
     // start the dance to complete..signal done and recieve
     // until all have done that:
 
@@ -223,10 +499,63 @@ subscriber(std::string uri, void* ctx, std::latch& done, std::latch& exitlatch)
  *  main - the publisher.
  */
 int main(int argc, char** argv) {
-    std::string uri(argv[1]);
-    int minmsgs = atoi(argv[2]);
-    int numsubs = atoi(argv[3]);
-    int msgsize = atoi(argv[4]);
+    bool perf(false);
+    bool allocs(false);
+    bool memory(false);
+    bool lossless(false);
+    int slowUsec(-1);
+    std::string delivery;
+    int ntopics(1);
+    int usec(0);
+    int opt;
+    while ((opt = getopt(argc, argv, "pamls:c:t:w:")) != -1) {
+        switch (opt) {
+        case 'p':
+            perf = true;
+            break;
+        case 'a':
+            allocs = true;
+            break;
+        case 'm':
+            memory = true;
+            break;
+        case 'l':
+            lossless = true;
+            break;
+        case 's':
+            slowUsec = atoi(optarg);
+            break;
+        case 'c':
+            delivery = optarg;
+            break;
+        case 't':
+            ntopics = atoi(optarg);
+            break;
+        case 'w':
+            usec = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: pubsub [-p] [-a] [-m] [-l] [-s usec] [-c delivery [-t ntopics] [-w usec]] "
+                << "uri nummsgs numsubscribers size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int minmsgs = atoi(argv[optind+1]);
+    int numsubs = atoi(argv[optind+2]);
+    int msgsize = atoi(argv[optind+3]);
+    bool latestValue = !delivery.empty();
+    Delivery mode(FULL);
+    if (delivery == "conflate") {
+        mode = CONFLATE;
+    } else if (delivery == "topics") {
+        mode = TOPICS;
+    } else if (latestValue && delivery != "full") {
+        std::cerr << "Unknown delivery " << delivery << " (full, conflate or topics)\n";
+        exit(EXIT_FAILURE);
+    }
+    if (latestValue && msgsize < (int)QUOTE_SIZE) msgsize = QUOTE_SIZE;
+    if (ntopics < 1) ntopics = 1;
 
     // Set up ZMQ and the publication socket>
 
@@ -235,44 +564,107 @@ int main(int argc, char** argv) {
         "Creating ZMQ context"
     );
     auto socket = checkError(
-        zmq_socket(context, ZMQ_PUB),
+        zmq_socket(context, ZMQ_XPUB),      // A PUB that tells us about subscriptions.
         "Creating publication socket."
     );
     setBuffering(socket);
+    int verbose(1);
+    checkError(
+        zmq_setsockopt(socket, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose)),
+        "Asking for every subscription"
+    );
+    if (lossless) {
+        int nodrop(1);
+        checkError(
+            zmq_setsockopt(socket, ZMQ_XPUB_NODROP, &nodrop, sizeof(nodrop)),
+            "Setting ZMQ_XPUB_NODROP"
+        );
+    }
     checkError(
         zmq_bind(socket, uri.c_str()), 
         "Binding the publisher to the endpoint"
     );
     // Now we can start the subscsribers.
 
+    MemorySample unconnected = memoryNow();
+    MemorySampler sampler(memory);
     std::latch  done(numsubs);
     std::latch  exitlatch(numsubs+1);
     std::vector<std::thread*> subscribers;
+    PerfTotals subscriberCounts;
+    AllocTotals subscriberAllocs;
+    std::vector<LatestStats> latestStats(numsubs);
+    std::vector<DeliveryStats> deliveries(numsubs);
     for (int i =0; i < numsubs; i++) {
+        if (latestValue) {
+            subscribers.push_back(
+                new std::thread(
+                    latestSubscriber, uri, context, std::ref(done), std::ref(exitlatch),
+                    perf, std::ref(subscriberCounts), allocs, std::ref(subscriberAllocs),
+                    mode, ntopics, usec, std::ref(latestStats[i])
+                )
+            );
+            continue;
+        }
         subscribers.push_back(
-            new std::thread(subscriber, uri, context, std::ref(done), std::ref(exitlatch))
+            new std::thread(
+                subscriber, uri, context, std::ref(done), std::ref(exitlatch),
+                perf, std::ref(subscriberCounts), allocs, std::ref(subscriberAllocs),
+                (i == 0) ? slowUsec : 0, std::ref(deliveries[i])
+            )
         );
     }
-    sleep(1);                       // Wait for them all to start.
+    waitForSubscribers(socket, numsubs);   // Else they miss the start.
+    MemorySample peered = memoryNow();
 
     // Time the sends until all subscribers are ready to exit:
 
     int sent(0);
+    Blocking blocked;
     char* msg = new char[msgsize];
-    *msg = 0;                                   // Not a done.
+    memset(msg, 0, msgsize);                    // Not a done.
 
+    PerfCounters counters(perf);
+    AllocCounter allocCounter(allocs);
+    AllocCounter processAllocs(allocs, true);
     auto start = std::chrono::high_resolution_clock::now();
+    counters.start();
+    allocCounter.start();
+    processAllocs.start();
+    sampler.start();
     for (int i =0; i < minmsgs; i++) {
-        send(socket, msg, msgsize);
+        if (latestValue) {
+            int64_t stamp = now();
+            uint32_t topic = i % ntopics;
+            memcpy(msg + STAMP_OFFSET, &stamp, sizeof(stamp));
+            memcpy(msg + TOPIC_OFFSET, &topic, sizeof(topic));
+        }
+        if (lossless) {
+            sendLossless(socket, msg, msgsize, blocked);
+        } else {
+            send(socket, msg, msgsize);
+        }
         sent++;
     }
     // end messages until donlatch is readh:
 
     *msg = 0xff;                              // done mesg.
     while(!done.try_wait()) {
-        send(socket, msg, msgsize);
-        sent++;
+        if (!lossless) {
+            send(socket, msg, msgsize);
+            sent++;
+        } else if (zmq_send(socket, msg, msgsize, ZMQ_DONTWAIT) >= 0) {
+            sent++;
+        } else if (zmq_errno() == EAGAIN) {
+            std::this_thread::yield();          // A slow subscriber's still full.
+        } else {
+            checkError(-1, "Sending done message.");
+        }
     }
+    sampler.stop();
+    processAllocs.stop();
+    allocCounter.stop();
+    counters.stop();
     auto end = std::chrono::high_resolution_clock::now();  // All msgs received.
 
     // Synchronize the shutdown of the threads:
@@ -308,6 +700,70 @@ int main(int argc, char** argv) {
     std::cout << "Pubs:      " << sent << std::endl;
     std::cout << "Msgs/sec:  " << (double)sent/secs << std::endl;
     std::cout << "kb/sec:    " << kb/secs << std::endl;
+    if (perf) {
+        reportPerfCounts("Publisher", counters.read(), sent, kb);
+        reportPerfCounts("Subscribers", subscriberCounts.get(), sent, kb);
+    }
+    if (allocs) {
+        reportAllocCounts("Publisher", allocCounter.read(), sent);
+        reportAllocCounts("Subscribers", subscriberAllocs.get(), sent);
+        reportAllocCounts("Process", processAllocs.read(), sent);
+    }
+    if (memory) {
+        reportMemory(sampler.read());
+        reportMemoryPer("subscriber connection", peered - unconnected, numsubs);
+    }
+    if (!latestValue && (lossless || slowUsec >= 0)) {
+        std::cout << "Mode:      " << (lossless ? "lossless (ZMQ_XPUB_NODROP)" : "lossy") << std::endl;
+        if (lossless) {
+            std::cout << "Blocked secs: " << blocked.secs << " sends: " << blocked.sends
+                << " (" << 100.0*blocked.secs/secs << "%)" << std::endl;
+        }
+        int delivered(0);
+        for (auto& d : deliveries) delivered += d.received;
+        std::cout << "Delivered: " << delivered << " of " << minmsgs*numsubs << std::endl;
+        auto rate = [&](const DeliveryStats& d) {
+            return d.received/std::chrono::duration<double>(d.finished - start).count();
+        };
+        int first = (slowUsec >= 0 && numsubs > 1) ? 1 : 0;   // Others apart from the slow one.
+        if (first) {
+            std::cout << "Slow subscriber received: " << deliveries[0].received
+                << " msgs/sec: " << rate(deliveries[0]) << std::endl;
+        }
+        double slowest(0), fastest(0);
+        for (int i = first; i < numsubs; i++) {
+            double r = rate(deliveries[i]);
+            if (i == first || r < slowest) slowest = r;
+            if (i == first || r > fastest) fastest = r;
+        }
+        std::cout << (first ? "Others " : "Subscriber ") << "msgs/sec min: " << slowest
+            << " max: " << fastest << std::endl;
+    }
+    if (latestValue) {
+        std::vector<double> staleness;
+        int received(0), processed(0), missed(0);
+        double cpu(0);
+        for (auto& s : latestStats) {
+            staleness.insert(staleness.end(), s.staleness.begin(), s.staleness.end());
+            received  += s.received;
+            processed += s.processed;
+            missed    += s.missed;
+            cpu       += s.cpuSecs;
+        }
+        std::cout << "Delivery:  " << delivery << " topics: " << ntopics
+            << " work usec: " << usec << std::endl;
+        std::cout << "Received:  " << received << std::endl;
+        std::cout << "Processed: " << processed << std::endl;
+        std::cout << "Topics missed: " << missed << std::endl;
+        if (!staleness.empty()) {
+            std::sort(staleness.begin(), staleness.end());
+            size_t n = staleness.size();
+            std::cout << "Staleness usec p50: " << staleness[n/2]
+                << " p99: " << staleness[(n*99)/100]
+                << " max: " << staleness.back() << std::endl;
+        }
+        std::cout << "Subscriber CPU secs: " << cpu << std::endl;
+    }
 
     return EXIT_SUCCESS;
 
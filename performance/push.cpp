@@ -5,9 +5,29 @@
  * As such it's useful to time this for a range of receivers.
  * Therefor, usage is:
  * 
- *     push uri nummsgs numclients msgSize
+ *     push [-p] [-a] [-m] [-s] [-d payload] [-z algorithm] [-r strategy [-l nprobes]] uri nummsgs numclients msgSize
  * Where:
- *   uri - is  the communications endoint URI.
+ *   -p  - count cycles, instructions, LLC misses, context switches and
+ *         page faults for the pusher and (summed) pullers (see perfcounters.h).
+ *   -a  - count allocations for the pusher, the (summed) pullers and the
+ *         whole process (see allocstats.h; needs make ALLOCSTATS=1).
+ *   -m  - sample the process's RSS and heap while timing and report the
+ *         baseline, peak and steady state, and what connecting each puller
+ *         (socket, pipes and thread) cost (see memory.h).
+ *   -s  - secure the connections with CURVE (see curve.h).
+ *   -d  - what the messages contain: uninit (default), zeros, random, log or
+ *         file:path (see payload.h).
+ *   -z  - compress each message with lz4 or zstd[:level] and decompress
+ *         it in the puller (see compress.h).  Reports wire bytes too.
+ *   -r  - how pullers wait for messages: block (default), spin,
+ *         hybrid[:usec], poll or poller (see receive.h).  Before the timed
+ *         run the pusher then sends probes carrying their send time, one at
+ *         a time to idle pullers, and the report adds their push to pull
+ *         latency percentiles (msgsize must be at least 9) and the pullers'
+ *         CPU.
+ *   -l  - with -r, how many probes (default 1000).
+ *   uri - is  the communications endoint URI.  shm://name pushes through
+ *         a shared memory ring the pullers all consume from (see shmring.h).
  *   nummsgs - is  the minimum number of messagse that will be pushed
  *            (see completion below).
  *  numclients - is the number of clients that can receive pushes.
@@ -45,6 +65,7 @@
  */
 #include <thread>
 #include <latch>
+#include <atomic>
 #include <zmq.h>
 #include <iostream>
 #include <stdlib.h>
@@ -55,6 +76,17 @@
 #include <vector>
 #include <sstream>
 #include <chrono>
+#include <algorithm>
+#include "perfcounters.h"
+#include "monitor.h"
+#include "curve.h"
+#include "cputime.h"
+#include "shmring.h"
+#include "allocstats.h"
+#include "memory.h"
+#include "payload.h"
+#include "compress.h"
+#include "receive.h"
 
 // check error for int returns.
 static int checkError(int status, const char* doing) {
@@ -91,23 +123,43 @@ send(void* socket, void* data, size_t len) {
         "Sending data on socket."
     );
 }
+// First bytes of messages; anything else is a done message:
+
+static const int DATA  = 0;
+static const int PROBE = 1;
+
+// A probe isn't sent until the last one arrived and then PROBE_GAP_USEC
+// more, by when the pullers are waiting again (past hybrid's spin too):
+
+static const int PROBE_GAP_USEC = 1000;
+
+// steady_clock nanoseconds, for send stamps:
+
+static int64_t
+now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
 /**
  * ignoremsg
  *    Receive a message and ignore it.
  * 
  * @param socket - socket that receives the message.
+ * @param receiver - how we wait for it (see receive.h).
  * @param flags - flags for recvmsg - defaults to zero.
+ * @param stamp - if not null, gets the send stamp after the first byte.
  * @return int - value of the first byte of the message.
  * @note - we ensure the message is a single part message.
  * @note we allow errnos ofor EAGAIN but then the return
  * value is 0.
  */
 static int
-ignore(void* socket, int flags = 0) {
+ignore(void* socket, ReceiveStrategy& receiver, int flags = 0, int64_t* stamp = nullptr) {
     zmq_msg_t msg;
     checkError(zmq_msg_init(&msg), "Initializing message");
 
-    int status = zmq_recvmsg(socket, &msg, flags);
+    int status = receiver.receive(&msg, flags);
     if (status < 0 && zmq_errno() == EAGAIN) {
         return 0;
     }
@@ -120,6 +172,9 @@ ignore(void* socket, int flags = 0) {
         "Getting message data pointer"
     ));
     int result = *pData;
+    if (stamp && zmq_msg_size(&msg) >= 1 + sizeof(int64_t)) {
+        memcpy(stamp, pData + 1, sizeof(int64_t));
+    }
     checkError(zmq_msg_close(&msg), "Freeing message"); // free msg
     int more;
     size_t morelen(sizeof(more));
@@ -133,6 +188,39 @@ ignore(void* socket, int flags = 0) {
     }
     return result;
 }
+/**
+ * expand
+ *    Receive a compressed message and decompress it; the compressed
+ * counterpart of ignore.
+ *
+ * @param socket - socket that receives the message.
+ * @param compressor - decompresses it.
+ * @param buffer - where the message is decompressed to.
+ * @param size - size of buffer.
+ * @param receiver - how we wait for it (see receive.h).
+ * @param flags - flags for recvmsg - defaults to zero.
+ * @return int - value of the first byte of the decompressed message
+ *               (0 on EAGAIN, as for ignore).
+ */
+static int
+expand(
+    void* socket, Compressor& compressor, char* buffer, size_t size,
+    ReceiveStrategy& receiver, int flags = 0
+) {
+    zmq_msg_t msg;
+    checkError(zmq_msg_init(&msg), "Initializing message");
+
+    int status = receiver.receive(&msg, flags);
+    if (status < 0 && zmq_errno() == EAGAIN) {
+        return 0;
+    }
+    checkError(status, "Receiving message part.");
+    compressor.decompress(
+        static_cast<const char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg), buffer, size
+    );
+    checkError(zmq_msg_close(&msg), "Freeing message");
+    return *reinterpret_cast<uint8_t*>(buffer);
+}
 /**
  *  setBuffering
  *    Set send/receive buffers to 2MBytes.
@@ -167,9 +255,28 @@ setBuffering(void* socket) {
  * @param ctx - ZMQ shared context.
  * @param done - Latch to signal when we've got the 'first' done msg.
  * @param exitlatch - Latch to signel we're ready to teardown.
+ * @param perf - True to count performance events.
+ * @param totals - Where our performance counts are summed.
+ * @param allocs - True to count allocations.
+ * @param allocTotals - Where our allocation counts are summed.
+ * @param connected - Latch we count down once we've connected.
+ * @param curve - CURVE keys, if enabled we're a client.
+ * @param compression - Compression specification, empty for none.
+ * @param msgsize - Size of the (decompressed) messages.
+ * @param strategy - How we wait for messages (see receive.h).
+ * @param latencies - If stamped is true, each probe's latency in usec.
+ * @param stamped - True if probes are sent.
+ * @param probesGot - Probes received by all the pullers.
+ * @param cpuSecs - CPU seconds this thread used receiving, after the probes.
  */
 static void 
-puller(std::string uri, void* ctx, std::latch& done, std::latch& exitlatch) {
+puller(
+    std::string uri, void* ctx, std::latch& done, std::latch& exitlatch,
+    bool perf, PerfTotals& totals, bool allocs, AllocTotals& allocTotals,
+    std::latch& connected, const Curve& curve, std::string compression, int msgsize,
+    std::string strategy, std::vector<double>& latencies, bool stamped,
+    std::atomic<int>& probesGot, double& cpuSecs
+) {
      // Set up to pull from  uri
 
      void * socket = checkError(
@@ -177,26 +284,60 @@ puller(std::string uri, void* ctx, std::latch& done, std::latch& exitlatch) {
         "Creating pull socket."
      );
      setBuffering(socket);
+     curve.client(socket);
      checkError(
         zmq_connect(socket, uri.c_str()), 
         "Connecting to pusher."
      );  
+     connected.count_down();
+     Compressor compressor(compression);
+     char* buffer = compressor.enabled() ? new char[msgsize] : nullptr;
+     ReceiveStrategy receiver(strategy);
+     receiver.attach(socket);
+     int64_t stamp(0);
+     auto receive = [&](int flags) {
+        if (compressor.enabled()) {
+            int result = expand(socket, compressor, buffer, msgsize, receiver, flags);
+            if (stamped) memcpy(&stamp, buffer + 1, sizeof(stamp));
+            return result;
+        }
+        return ignore(socket, receiver, flags, stamped ? &stamp : nullptr);
+     };
 
-     // Receieve messages with wait until the done message.
-     while(ignore(socket) == 0) {
-
+     // Receieve messages with wait until the done message.  The counts
+     // restart after each probe, so only the timed stream is counted.
+     PerfCounters counters(perf);
+     AllocCounter allocCounter(allocs);
+     double cpuStart = threadCpuSeconds();
+     counters.start();
+     allocCounter.start();
+     int kind;
+     while((kind = receive(0)) == DATA || kind == PROBE) {
+        if (kind == PROBE) {
+            latencies.push_back((double)(now() - stamp)/1000.0);
+            cpuStart = threadCpuSeconds();
+            counters.start();
+            allocCounter.start();
+            probesGot++;
+        }
      }
+     allocCounter.stop();
+     counters.stop();
+     cpuSecs = threadCpuSeconds() - cpuStart;
+     totals.add(counters.read());
+     allocTotals.add(allocCounter.read());
      done.count_down();   // We're done.
 
     // Recieve/drop messgaes with no wait until 
     // done...ignore errors on the rcvmsg.
 
      while(!done.try_wait()) {
-        ignore(socket, ZMQ_DONTWAIT);
+        receive(ZMQ_DONTWAIT);
      }
      // Ready to tear down when everyone else is:
 
      exitlatch.arrive_and_wait();
+     delete []buffer;
 
      checkError(
         zmq_close(socket),
@@ -204,13 +345,232 @@ puller(std::string uri, void* ctx, std::latch& done, std::latch& exitlatch) {
      );
 }
 
+/**
+ * report
+ *    Print the results.
+ * @param sent - Messages pushed.
+ * @param msgsize - Their size.
+ * @param secs - Time taken.
+ * @param cpuSecs - CPU seconds the process used.
+ * @param perf - True if performance events were counted.
+ * @param pusher - Counts for the pusher.
+ * @param pullers - Counts summed over the pullers.
+ * @param allocs - True if allocations were counted.
+ * @param pusherAllocs - Allocations by the pusher.
+ * @param pullerAllocs - Allocations summed over the pullers.
+ * @param processAllocs - Allocations by all threads (ZMQ's too).
+ * @param wireBytes - Compressed bytes sent, 0 if not compressing.
+ */
+static void
+report(
+    int sent, int msgsize, double secs, double cpuSecs, bool perf,
+    const PerfCounts& pusher, const PerfCounts& pullers, bool allocs,
+    const AllocCounts& pusherAllocs, const AllocCounts& pullerAllocs,
+    const AllocCounts& processAllocs, double wireBytes = 0
+) {
+    double kb = (double)(sent)*(double)(msgsize)/1024.0;
+
+    std::cout << "Seconds:    " << secs << std::endl;
+    std::cout << "Messages:   " << sent << std::endl;
+    std::cout << "msgs/sec:   " << (double)sent/secs << std::endl;
+    std::cout << "kb/sec      " << kb/secs << std::endl;
+    std::cout << "CPU secs:   " << cpuSecs << std::endl;
+    std::cout << "Cores/Gbps: " << cpuSecs/(kb*1024.0*8.0/1.0e9) << std::endl;
+    if (wireBytes > 0) {
+        reportCompression(kb*1024.0, wireBytes, secs);
+    }
+    if (perf) {
+        reportPerfCounts("Pusher", pusher, sent, kb);
+        reportPerfCounts("Pullers", pullers, sent, kb);
+    }
+    if (allocs) {
+        reportAllocCounts("Pusher", pusherAllocs, sent);
+        reportAllocCounts("Pullers", pullerAllocs, sent);
+        reportAllocCounts("Process", processAllocs, sent);
+    }
+}
+/**
+ * shmPuller
+ *    puller for shm:// endpoints; all pullers take messages from the
+ * same ring.  Completion is done as for ZMQ.
+ *
+ * @param uri - the ring's endpoint.
+ * @param done - Latch to signal when we've got the 'first' done msg.
+ * @param exitlatch - Latch to signel we're ready to teardown.
+ * @param perf - True to count performance events.
+ * @param totals - Where our performance counts are summed.
+ * @param allocs - True to count allocations.
+ * @param allocTotals - Where our allocation counts are summed.
+ */
+static void
+shmPuller(
+    std::string uri, std::latch& done, std::latch& exitlatch, bool perf, PerfTotals& totals,
+    bool allocs, AllocTotals& allocTotals
+) {
+    ShmRing* ring = ShmRing::open(uri);
+
+    PerfCounters counters(perf);
+    AllocCounter allocCounter(allocs);
+    counters.start();
+    allocCounter.start();
+    while (ring->ignore() == 0) {
+    }
+    allocCounter.stop();
+    counters.stop();
+    totals.add(counters.read());
+    allocTotals.add(allocCounter.read());
+    done.count_down();
+
+    while (!done.try_wait()) {
+        ring->ignore(false);
+    }
+    exitlatch.arrive_and_wait();
+    delete ring;
+}
+/**
+ * pushShm
+ *    main for shm:// endpoints.
+ *
+ * @note the pusher must not wait for space when sending done messages:
+ * once the pullers stop draining the ring it could wait forever.
+ */
+static int
+pushShm(
+    std::string uri, int nummsgs, int numclients, int msgsize, bool perf, bool allocs,
+    const std::string& payload
+) {
+    ShmRing* ring = ShmRing::create(uri, msgsize, ShmRing::defaultSlots(msgsize));
+
+    std::latch done(numclients);
+    std::latch exitlatch(numclients+1);
+    std::vector<std::thread*> pullers;
+    PerfTotals pullerCounts;
+    AllocTotals pullerAllocs;
+    for (int i =0; i < numclients; i++) {
+        pullers.push_back(
+            new std::thread(
+                shmPuller, uri, std::ref(done), std::ref(exitlatch),
+                perf, std::ref(pullerCounts), allocs, std::ref(pullerAllocs)
+            )
+        );
+    }
+    char* message = new char[msgsize];
+    fillPayload(message, msgsize, payload);
+    *message = 0;
+    int sent(0);
+
+    PerfCounters counters(perf);
+    AllocCounter allocCounter(allocs);
+    AllocCounter processAllocs(allocs, true);
+    double cpuStart = processCpuSeconds();
+    auto start = std::chrono::high_resolution_clock::now();
+    counters.start();
+    allocCounter.start();
+    processAllocs.start();
+    while(sent < nummsgs) {
+        ring->send(message, msgsize);
+        sent++;
+    }
+    *message = 0xff;
+    while(!done.try_wait()) {
+        if (ring->send(message, msgsize, false)) {
+            sent++;
+        }
+    }
+    processAllocs.stop();
+    allocCounter.stop();
+    counters.stop();
+    auto end = std::chrono::high_resolution_clock::now();
+    double cpuSecs = processCpuSeconds() - cpuStart;
+    exitlatch.arrive_and_wait();
+
+    for (auto p : pullers) {
+        p->join();
+        delete p;
+    }
+    delete []message;
+    delete ring;
+
+    double ms = (double)std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+        .count();
+    report(
+        sent, msgsize, ms/1000.0, cpuSecs, perf, counters.read(), pullerCounts.get(),
+        allocs, allocCounter.read(), pullerAllocs.get(), processAllocs.read()
+    );
+    return EXIT_SUCCESS;
+}
+
 // entry point, main is the pusher.
 
 int main (int argc, char**argv) {
-    std::string uri(argv[1]);
-    int nummsgs = atoi(argv[2]);
-    int numclients = atoi(argv[3]);
-    int msgsize = atoi(argv[4]);
+    bool perf(false);
+    bool allocs(false);
+    bool memory(false);
+    bool secure(false);
+    std::string payload("uninit");
+    std::string compression;
+    std::string strategy;
+    int nprobes(1000);
+    int opt;
+    while ((opt = getopt(argc, argv, "pamsd:z:r:l:")) != -1) {
+        switch (opt) {
+        case 'p':
+            perf = true;
+            break;
+        case 'a':
+            allocs = true;
+            break;
+        case 'm':
+            memory = true;
+            break;
+        case 's':
+            secure = true;
+            break;
+        case 'd':
+            payload = optarg;
+            break;
+        case 'z':
+            compression = optarg;
+            break;
+        case 'r':
+            strategy = optarg;
+            break;
+        case 'l':
+            nprobes = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: push [-p] [-a] [-m] [-s] [-d payload] [-z algorithm] "
+                "[-r strategy [-l nprobes]] uri nummsgs numclients msgsize\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nummsgs = atoi(argv[optind+1]);
+    int numclients = atoi(argv[optind+2]);
+    int msgsize = atoi(argv[optind+3]);
+    if (secure && (isInproc(uri) || isShm(uri))) {
+        std::cerr << "Warning: CURVE has no effect on inproc and shm transports\n";
+    }
+    if (isShm(uri)) {
+        if (!compression.empty()) {
+            std::cerr << "Warning: compression is not done on shm transports\n";
+        }
+        if (!strategy.empty()) {
+            std::cerr << "Warning: receive strategies don't apply to shm transports\n";
+        }
+        if (memory) {
+            std::cerr << "Warning: memory isn't sampled on shm transports\n";
+        }
+        return pushShm(uri, nummsgs, numclients, msgsize, perf, allocs, payload);
+    }
+    Curve curve(secure);
+    Compressor compressor(compression);      // Validates the spec too.
+    ReceiveStrategy receiver(strategy);      // Ditto.
+    bool stamped = !strategy.empty() && msgsize >= 1 + (int)sizeof(int64_t);
+    if (!strategy.empty() && !stamped) {
+        std::cerr << "Warning: messages are too small to carry send times, no latencies\n";
+    }
+    if (nprobes < 1) nprobes = 1;
 
     // Set up the pusher:
 
@@ -223,39 +583,118 @@ int main (int argc, char**argv) {
         "Creating push socket"
     );
     setBuffering(socket);
+    auto monitor = new SocketMonitor(ctx, socket, ZMQ_EVENT_HANDSHAKE_SUCCEEDED);
+    curve.server(socket);
     checkError(
         zmq_bind(socket, uri.c_str()),
         "Binding push to URI"
     );
 
+    MemorySample unconnected = memoryNow();
+    MemorySampler sampler(memory);
+
     // start the threads.
 
     std::latch done(numclients);
     std::latch exitlatch(numclients+1);   //pusher waits here too.
+    std::latch connected(numclients);
     std::vector<std::thread*> pullers;
+    PerfTotals pullerCounts;
+    AllocTotals pullerAllocs;
+    std::vector<std::vector<double>> latencies(numclients);
+    std::vector<double> pullerCpu(numclients);
+    std::atomic<int> probesGot(0);
     for (int i =0; i < numclients; i++) {
         pullers.push_back(
-            new std::thread(puller, uri, ctx, std::ref(done), std::ref(exitlatch))
+            new std::thread(
+                puller, uri, ctx, std::ref(done), std::ref(exitlatch),
+                perf, std::ref(pullerCounts), allocs, std::ref(pullerAllocs),
+                std::ref(connected), std::cref(curve), compression, msgsize,
+                strategy, std::ref(latencies[i]), stamped, std::ref(probesGot),
+                std::ref(pullerCpu[i])
+            )
         );
     }
-    usleep(5000);                     // wait a half sec for everyone to connect.
+    // Don't start until every puller is connected, otherwise the first ones
+    // to connect get more than their share of the messages:
+
+    waitForPeers(*monitor, uri, numclients, connected);
+    MemorySample peered = memoryNow();
+    delete monitor;                   // Its socket must be closed before zmq_ctx_term.
     char* message = new char[msgsize];
+    fillPayload(message, msgsize, payload);
     *message = 0;       // not an exit msg.
     int sent(0);        // total sends.
+    size_t wireSize = compressor.bound(msgsize);
+    char* wire = compressor.enabled() ? new char[wireSize] : nullptr;
+    double wireBytes(0);
+
+    // Probe the receive strategy: one message in flight to idle pullers, so
+    // the latency is the wakeup, not queueing behind the stream:
+
+    if (stamped) {
+        for (int i = 0; i < nprobes; i++) {
+            int64_t stamp = now();
+            *message = PROBE;
+            memcpy(message + 1, &stamp, sizeof(stamp));
+            if (wire) {
+                send(socket, wire, compressor.compress(message, msgsize, wire, wireSize));
+            } else {
+                send(socket, message, msgsize);
+            }
+            while (probesGot < i + 1) {
+                std::this_thread::yield();
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(PROBE_GAP_USEC));
+        }
+        *message = DATA;
+    }
     // start timing and sending messages:
 
+    PerfCounters counters(perf);
+    AllocCounter allocCounter(allocs);
+    AllocCounter processAllocs(allocs, true);
+    double cpuStart = processCpuSeconds();
     auto start = std::chrono::high_resolution_clock::now();
+    counters.start();
+    sampler.start();
+    allocCounter.start();
+    processAllocs.start();
     while(sent < nummsgs) {    // Non exit messages
-        send(socket, message, msgsize);
+        if (wire) {
+            size_t n = compressor.compress(message, msgsize, wire, wireSize);
+            send(socket, wire, n);
+            wireBytes += n;
+        } else {
+            send(socket, message, msgsize);
+        }
         sent++;
     }
     // send done messages until the done latch is satisfied:
+    // Don't block on a full pipe: once the last puller is done nobody
+    // reads and a blocked send would never return.
+
     *message = 0xff;         // Done messages.
+    char*  doneMsg = message;
+    size_t doneSize = msgsize;
+    if (wire) {
+        doneSize = compressor.compress(message, msgsize, wire, wireSize);
+        doneMsg = wire;
+    }
     while(!done.try_wait()) {
-        send(socket, message, msgsize);
-        sent++;               // count these too.
+        if (zmq_send(socket, doneMsg, doneSize, ZMQ_DONTWAIT) >= 0) {
+            sent++;               // count these too.
+            if (wire) wireBytes += doneSize;
+        } else if (zmq_errno() != EAGAIN) {
+            checkError(-1, "Sending done message");
+        }
     }
+    processAllocs.stop();
+    allocCounter.stop();
+    counters.stop();
+    sampler.stop();
     auto end = std::chrono::high_resolution_clock::now();
+    double cpuSecs = processCpuSeconds() - cpuStart;
     exitlatch.arrive_and_wait();      // Wait for all of us before tearing down:
 
     // Tear down the communications:
@@ -275,19 +714,37 @@ int main (int argc, char**argv) {
         delete p;
     }
     delete []message;
+    delete []wire;
 
     // Comput timings/statistics.
     auto duration= end - start;
     double ms = (double)std::chrono::duration_cast<std::chrono::milliseconds>(duration)
         .count();
 
-    double secs = ms/1000.0;
-    double kb = (double)(sent)*(double)(msgsize)/1024.0;
-
-    std::cout << "Seconds:    " << secs << std::endl;
-    std::cout << "Messages:   " << sent << std::endl;
-    std::cout << "msgs/sec:   " << (double)sent/secs << std::endl;
-    std::cout << "kb/sec      " << kb/secs << std::endl;
+    report(
+        sent, msgsize, ms/1000.0, cpuSecs, perf, counters.read(), pullerCounts.get(),
+        allocs, allocCounter.read(), pullerAllocs.get(), processAllocs.read(), wireBytes
+    );
+    if (memory) {
+        reportMemory(sampler.read());
+        reportMemoryPer("puller connection", peered - unconnected, numclients);
+    }
+    if (!strategy.empty()) {
+        std::vector<double> all;
+        double cpu(0);
+        for (int i = 0; i < numclients; i++) {
+            all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+            cpu += pullerCpu[i];
+        }
+        std::cout << "Receive:    " << strategy << std::endl;
+        if (!all.empty()) {
+            std::sort(all.begin(), all.end());
+            size_t n = all.size();
+            std::cout << "Probe latency usec p50: " << all[n/2] << " p99: " << all[(n*99)/100]
+                << " max: " << all.back() << " (" << n << " probes)" << std::endl;
+        }
+        std::cout << "Puller CPU secs: " << cpu << " usec/msg: " << cpu*1.0e6/sent << std::endl;
+    }
 
     // success:
 
@@ -0,0 +1,318 @@
+/**
+ * radio.cpp
+ *    Times the draft RADIO/DISH sockets.  RADIO/DISH is publish/subscribe
+ * with groups instead of topic prefixes and, unlike PUB/SUB, it can run
+ * over udp:// which is what we'd use for lossy telemetry.  The program
+ * takes the same arguments and prints the same report as pubsub.cpp so the
+ * two can be compared cell for cell.
+ *
+ * Usage:
+ *    radio uri nummsgs numdishes size
+ *
+ * Where:
+ *    uri - is the communications endpoint URI.
+ *    nummsgs - are the minimum number of messages the radio sends.
+ *    numdishes - the number of dish threads.
+ *    size - the size of the messages.
+ *
+ * For tcp, ipc and inproc the radio binds uri and the dishes connect, just
+ * like pubsub.  udp is connectionless and a radio can't bind it; so dish i
+ * binds nthEndpoint(uri, i) (see endpoints.h) and the radio connects to
+ * each of them.  Use a numeric address e.g. udp://127.0.0.1:3000.
+ *
+ * A udp datagram carries the group and the body and libzmq won't send more
+ * than MAX_UDP_BYTES of them; larger sizes are refused for udp.
+ *
+ * Termination is the pubsub dance (see pubsub.cpp): data messages have a
+ * zero first byte, done messages 0xff and the radio sends done messages
+ * until all dishes have seen one.  Since there's no XPUB/monitor to tell us
+ * when a dish has joined, the radio first sends HELLO messages (first byte
+ * 1) until every dish has received one.
+ *
+ * Since the transport may drop messages, we also report the average
+ * number of data messages each dish received and the loss rate.
+ *
+ * @note RADIO/DISH are draft sockets: libzmq must be built with draft APIs
+ * and the program compiled with -DZMQ_BUILD_DRAFT_API (make draft).
+ * @note this is not production quality code so a missing parameter will probably
+ * result in a segfault.
+ */
+
+#include <thread>
+#include <latch>
+#include <atomic>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <chrono>
+#include "endpoints.h"
+
+#ifndef ZMQ_RADIO
+#error "RADIO/DISH need the libzmq draft API: compile with -DZMQ_BUILD_DRAFT_API"
+#endif
+
+static const char* GROUP = "timing";
+static const size_t MAX_UDP_BYTES = 8192;  // libzmq's udp datagram buffer.
+
+static const uint8_t DATA  = 0;
+static const uint8_t HELLO = 1;
+static const uint8_t DONE  = 0xff;
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/**
+ * send
+ *    Send a message to the group.
+ *
+ * @param socket - the radio socket.
+ * @param data   - Pointer to the message body.
+ * @param len    - size of the message.
+ */
+static void
+send(void* socket, void* data, size_t len) {
+    zmq_msg_t msg;
+    checkError(zmq_msg_init_size(&msg, len), "Allocating message");
+    memcpy(zmq_msg_data(&msg), data, len);
+    checkError(zmq_msg_set_group(&msg, GROUP), "Setting message group");
+    checkError(zmq_msg_send(&msg, socket, 0), "Sending data on socket.");
+}
+/**
+ * ignore
+ *    Receive a message and ignore all but its first byte.
+ *
+ * @param socket - socket that receives the message.
+ * @param flags - receive flags e.g. ZMQ_DONTWAIT.
+ * @return int - the first byte of the message, -1 if ZMQ_DONTWAIT and
+ *               there was no message.
+ * @note RADIO/DISH messages are always single part.
+ */
+static int
+ignore(void* socket, int flags = 0) {
+    zmq_msg_t msg;
+    checkError(zmq_msg_init(&msg), "Initializing message");
+    if (zmq_msg_recv(&msg, socket, flags) < 0) {
+        if (zmq_errno() == EAGAIN && (flags & ZMQ_DONTWAIT)) {
+            zmq_msg_close(&msg);
+            return -1;
+        }
+        checkError(-1, "Receiving message");
+    }
+    int result = *reinterpret_cast<uint8_t*>(zmq_msg_data(&msg));
+    checkError(zmq_msg_close(&msg), "Freeing message");
+    return result;
+}
+/**
+ *  setBuffering
+ *    Set send/receive buffers to 2MBytes.
+ * @param socket
+ *
+ */
+static void
+setBuffering(void* socket) {
+    int maxSize = 1024*1024*2;     // 2mbytes.
+    checkError(
+        zmq_setsockopt(socket, ZMQ_SNDBUF, &maxSize, sizeof(int)),
+        "Setting send buffer size"
+    );
+    checkError(
+        zmq_setsockopt(socket, ZMQ_RCVBUF, &maxSize, sizeof(int)),
+        "Setting receive buffer size"
+    );
+    int64_t maxMsg = 1024*1024*2;
+    checkError(
+        zmq_setsockopt(socket, ZMQ_MAXMSGSIZE, &maxMsg, sizeof(maxMsg)),
+        "Setting max message size"
+    );
+}
+/**
+ * isUdp
+ *   @return bool - true if the endpoint is udp.
+ */
+static bool
+isUdp(const std::string& uri) {
+    return uri.compare(0, 6, "udp://") == 0;
+}
+
+/**
+ *  dish:
+ *     -  Join the group, bind (udp) or connect to the radio.
+ *     -  Count down the ready latch on the first HELLO.
+ *     -  Count data messages until a done message.
+ *     -  Do the pubsub dance to shut down.
+ * @param uri - endpoint to bind (udp) or connect to.
+ * @param ctx - ZMQ context object pointer.
+ * @param ready - latch counted down when we've heard the radio.
+ * @param done - latch we count down when we get the done message.
+ * @param exitlatch - latch everyone arrives at before tearing down.
+ * @param received - total of the data messages the dishes got.
+ * @note  This function is normally a thread.
+ */
+static void
+dish(
+    std::string uri, void* ctx, std::latch& ready, std::latch& done,
+    std::latch& exitlatch, std::atomic<int64_t>& received
+) {
+    auto socket = checkError(
+        zmq_socket(ctx, ZMQ_DISH),
+        "Creating dish socket."
+    );
+    setBuffering(socket);
+    checkError(zmq_join(socket, GROUP), "Joining group");
+    if (isUdp(uri)) {
+        checkError(zmq_bind(socket, uri.c_str()), "Binding dish.");
+    } else {
+        checkError(zmq_connect(socket, uri.c_str()), "Connecting to radio.");
+    }
+    // Data only starts once everyone has had a HELLO:
+
+    ignore(socket);
+    ready.count_down();
+
+    int64_t got(0);
+    int first;
+    while ((first = ignore(socket)) != DONE) {
+        if (first == DATA) got++;
+    }
+    received += got;
+
+    done.count_down();
+    while(!done.try_wait()) {
+        ignore(socket, ZMQ_DONTWAIT);   // Ignore messages until all are done.
+    }
+    exitlatch.arrive_and_wait();
+
+    checkError(
+        zmq_close(socket),
+        "Closing dish socket."
+    );
+}
+/**
+ *  main - the radio.
+ */
+int main(int argc, char** argv) {
+    std::string uri(argv[1]);
+    int minmsgs = atoi(argv[2]);
+    int numdishes = atoi(argv[3]);
+    int msgsize = atoi(argv[4]);
+    bool udp = isUdp(uri);
+    if (udp && msgsize + strlen(GROUP) + 1 > MAX_UDP_BYTES) {
+        std::cerr << "udp messages are limited to "
+            << MAX_UDP_BYTES - strlen(GROUP) - 1 << " bytes\n";
+        exit(EXIT_FAILURE);
+    }
+
+    auto context = checkError(
+        zmq_ctx_new(),
+        "Creating ZMQ context"
+    );
+    auto socket = checkError(
+        zmq_socket(context, ZMQ_RADIO),
+        "Creating radio socket."
+    );
+    setBuffering(socket);
+    if (!udp) {
+        checkError(
+            zmq_bind(socket, uri.c_str()),
+            "Binding the radio to the endpoint"
+        );
+    }
+    // Start the dishes; for udp they bind so we connect to each:
+
+    std::latch  ready(numdishes);
+    std::latch  done(numdishes);
+    std::latch  exitlatch(numdishes+1);
+    std::atomic<int64_t> received(0);
+    std::vector<std::thread*> dishes;
+    for (int i =0; i < numdishes; i++) {
+        std::string endpoint = udp ? nthEndpoint(uri, i) : uri;
+        dishes.push_back(
+            new std::thread(
+                dish, endpoint, context, std::ref(ready), std::ref(done),
+                std::ref(exitlatch), std::ref(received)
+            )
+        );
+        if (udp) {
+            checkError(
+                zmq_connect(socket, endpoint.c_str()),
+                "Connecting the radio to a dish"
+            );
+        }
+    }
+    char* msg = new char[msgsize];
+    *msg = HELLO;
+    while (!ready.try_wait()) {
+        send(socket, msg, msgsize);
+        usleep(1000);
+    }
+
+    // Time the sends until all dishes are ready to exit:
+
+    int sent(0);
+    *msg = DATA;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i =0; i < minmsgs; i++) {
+        send(socket, msg, msgsize);
+        sent++;
+    }
+    *msg = DONE;
+    while(!done.try_wait()) {
+        send(socket, msg, msgsize);
+        sent++;
+    }
+    auto end = std::chrono::high_resolution_clock::now();  // All msgs received.
+
+    exitlatch.arrive_and_wait();
+    delete []msg;
+    for (auto p : dishes) {
+        p->join();
+        delete p;
+    }
+    checkError(
+        zmq_close(socket),
+        "Closing radio socket"
+    );
+    checkError(
+        zmq_ctx_term(context),
+        "Terminating ZMQ Context."
+    );
+
+    // report the results.
+
+    auto duration = end - start;
+    double ms = (double)(std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+        .count());
+    double secs = ms/1000.0;
+    double kb   = double(sent)*double(msgsize)/1024.0;
+    double perDish = double(received)/numdishes;
+
+    std::cout << "Seconds:   " << secs << std::endl;
+    std::cout << "Pubs:      " << sent << std::endl;
+    std::cout << "Msgs/sec:  " << (double)sent/secs << std::endl;
+    std::cout << "kb/sec:    " << kb/secs << std::endl;
+    std::cout << "Received:  " << perDish << " per dish" << std::endl;
+    std::cout << "Loss:      " << 1.0 - perDish/minmsgs << std::endl;
+
+    return EXIT_SUCCESS;
+}
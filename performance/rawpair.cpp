@@ -0,0 +1,145 @@
+/**
+ * rawpair.cpp
+ *    pair.cpp's ping-pong over plain sockets (see rawsocket.h).  This is
+ * the ceiling that pair's (and req's) tcp and ipc numbers can be compared
+ * with.
+ *
+ * Usage:
+ *    rawpair [-e] uri nummsgs size
+ *
+ * Where:
+ *     -e  - use non-blocking sockets and epoll rather than blocking I/O.
+ *     uri - tcp:// or ipc:// endpoint the main thread listens on.
+ *     nummsgs - is the number of send/receive pairs done.
+ *     size - is the size of the 'large' message.
+ *
+ * As in pair, two sets of timings are done:
+ *
+ * *  main sends messages of ```size``` and gets back single byte
+ * messages.
+ *  * main sends messages 1 byte long and gets back 'size' messages.
+ *
+ * and the report is the same: time, msgs/sec, KB/sec, round trip time,
+ * CPU seconds and Cores/Gbps.
+ */
+#include <thread>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include "rawsocket.h"
+#include "cputime.h"
+
+/**
+ * peer
+ *    The peer thread for the pair.
+ * @param uri - endpoint to connect to.
+ * @param useEpoll - true for the epoll mode.
+ * @param nmsgs - Number of messages to exchange.
+ * @param recvsize - Size of the messages we get.
+ * @param size - Size of the messages we will return.
+ */
+static void
+peer(std::string uri, bool useEpoll, int nmsgs, int recvsize, int size) {
+    FrameSocket socket(rawConnect(uri), useEpoll);
+    char* in  = new char[recvsize];
+    char* msg = new char[size];
+    memset(msg, 0, size);
+
+    for (int i = 0; i < nmsgs; i++) {
+        socket.recv(in, recvsize);
+        socket.send(msg, size);
+    }
+    delete []in;
+    delete []msg;
+}
+
+/**
+ *  run
+ *     Runs one of the timings.
+ * @param uri - the endpoint.
+ * @param listener - listening socket on uri.
+ * @param useEpoll - true for the epoll mode.
+ * @param nummsgs - Number send/receive pairs.
+ * @param mainsize - Size of the messages we will send.
+ * @param thrsize - size of the messags the thread will send us.
+ * @param cpuSecs - CPU seconds the process used.
+ * @return double precision seconds the send/recieves took.
+ */
+static double
+run(
+    std::string uri, int listener, bool useEpoll, int nummsgs, int mainsize, int thrsize,
+    double& cpuSecs
+) {
+    std::thread peerThread(peer, uri, useEpoll, nummsgs, mainsize, thrsize);
+    FrameSocket socket(rawAccept(listener), useEpoll);
+
+    char* sendmsg = new char[mainsize];
+    char* in      = new char[thrsize];
+    memset(sendmsg, 0, mainsize);
+    double cpuStart = processCpuSeconds();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i =0; i < nummsgs; i++) {
+        socket.send(sendmsg, mainsize);         // send
+        socket.recv(in, thrsize);               // reply.
+    }
+    peerThread.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    cpuSecs = processCpuSeconds() - cpuStart;
+    delete []sendmsg;
+    delete []in;
+
+    auto chronoDuration = end - start;
+    double ms =
+        (double)std::chrono::duration_cast<std::chrono::milliseconds>(chronoDuration)
+        .count();                       // Milliseconds.
+    return ms/1000.0;            // seconds.
+}
+/**
+ * main
+ *   We are a peer and time the message exchanges.
+ */
+int main(int argc, char** argv) {
+    bool useEpoll(false);
+    int opt;
+    while ((opt = getopt(argc, argv, "e")) != -1) {
+        switch (opt) {
+        case 'e':
+            useEpoll = true;
+            break;
+        default:
+            std::cerr << "Usage: rawpair [-e] uri nummsgs size\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nummsgs = atoi(argv[optind+1]);
+    int size  =  atoi(argv[optind+2]);
+
+    int listener = rawListen(uri);
+    double cpu1, cpu2;
+    double duration1 = run(uri, listener, useEpoll, nummsgs, size, 1, cpu1); // 'big' send, small return.
+    double duration2 = run(uri, listener, useEpoll, nummsgs, 1, size, cpu2); // small send, 'big' return.
+    close(listener);
+    rawUnlink(uri);
+
+    std::cout << "Big sends small replies\n";
+    std::cout << "Time    :  " << duration1 << std::endl;
+    std::cout << "Msgs/sec:  " << (double)nummsgs/duration1 << std::endl;
+    std::cout << "KB/sec  :  " << (double)size*(double)nummsgs/(1024.0*duration1) << std::endl;
+    std::cout << "RTT usec:  " << duration1*1.0e6/nummsgs << std::endl;
+    std::cout << "CPU secs:  " << cpu1 << std::endl;
+    std::cout << "Cores/Gbps: " << cpu1/((double)size*(double)nummsgs*8.0/1.0e9) << std::endl;
+
+    std::cout << "Small sends, big replies\n";
+    std::cout << "Time    :  " << duration2 << std::endl;
+    std::cout << "Msgs/sec:  " << (double)nummsgs/duration2 << std::endl;
+    std::cout << "KB/sec  :  " << (double)size*(double)nummsgs/(1024.0*duration2) << std::endl;
+    std::cout << "RTT usec:  " << duration2*1.0e6/nummsgs << std::endl;
+    std::cout << "CPU secs:  " << cpu2 << std::endl;
+    std::cout << "Cores/Gbps: " << cpu2/((double)size*(double)nummsgs*8.0/1.0e9) << std::endl;
+
+    return EXIT_SUCCESS;
+}
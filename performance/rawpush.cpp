@@ -0,0 +1,195 @@
+/**
+ *  rawpush.cpp
+ *    The push/pull stream of push.cpp over plain sockets (see rawsocket.h).
+ * This is the ceiling push.cpp's tcp and ipc numbers can be compared with.
+ *
+ *     rawpush [-e] uri nummsgs numclients msgsize
+ * Where:
+ *   -e  - use non-blocking sockets and epoll rather than blocking I/O.
+ *   uri - tcp:// or ipc:// endpoint the pusher listens on.
+ *   nummsgs - is the number of messages that will be pushed.
+ *   numclients - is the number of pullers.
+ *   msgsize - is the size of all messages that will be pushed.
+ *
+ * Like ZMQ's PUSH the messages are dealt out round robin.  In blocking mode
+ * that's strict, the pusher waits for a slow puller.  In epoll mode a frame
+ * goes to the next puller whose socket has room, which is what PUSH does
+ * when a pipe is full; only when every socket is full do we epoll_wait.
+ *
+ * Once all messages are sent, every puller is sent an empty frame and
+ * timing stops when all pullers have received theirs.  Unlike push there's
+ * no done message dance; a stream socket doesn't lose anything.
+ *
+ * Reported as for push: seconds, messages, msgs/sec, kb/sec, CPU seconds
+ * and Cores/Gbps.
+ *
+ * @note this is not production code so not specifying all parameters
+ *    probably results in a segfault.
+ */
+#include <thread>
+#include <latch>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <chrono>
+#include "rawsocket.h"
+#include "cputime.h"
+
+/**
+ * puller
+ *    Thread that is one puller.
+ *
+ * @param uri - endpoint of the pusher.
+ * @param useEpoll - true for the epoll mode.
+ * @param size - size of the messages.
+ * @param connected - Latch we count down once we've connected.
+ */
+static void
+puller(std::string uri, bool useEpoll, int size, std::latch& connected) {
+    FrameSocket socket(rawConnect(uri), useEpoll);
+    connected.count_down();
+
+    char* message = new char[size];
+    while (socket.recv(message, size) != 0) {
+    }
+    delete []message;
+}
+
+// entry point, main is the pusher.
+
+int main (int argc, char**argv) {
+    bool useEpoll(false);
+    int opt;
+    while ((opt = getopt(argc, argv, "e")) != -1) {
+        switch (opt) {
+        case 'e':
+            useEpoll = true;
+            break;
+        default:
+            std::cerr << "Usage: rawpush [-e] uri nummsgs numclients msgsize\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nummsgs = atoi(argv[optind+1]);
+    int numclients = atoi(argv[optind+2]);
+    int msgsize = atoi(argv[optind+3]);
+
+    int listener = rawListen(uri);
+
+    // start the pullers and accept their connections:
+
+    std::latch connected(numclients);
+    std::vector<std::thread*> pullers;
+    for (int i =0; i < numclients; i++) {
+        pullers.push_back(
+            new std::thread(puller, uri, useEpoll, msgsize, std::ref(connected))
+        );
+    }
+    std::vector<FrameSocket*> sockets;
+    int epoll(-1);
+    if (useEpoll) {
+        epoll = epoll_create1(0);
+        if (epoll < 0) rawFail("Creating epoll instance");
+    }
+    for (int i = 0; i < numclients; i++) {
+        sockets.push_back(new FrameSocket(rawAccept(listener), useEpoll));
+        if (useEpoll) {
+            struct epoll_event ev;
+            ev.events = EPOLLOUT;
+            ev.data.u32 = i;
+            if (epoll_ctl(epoll, EPOLL_CTL_ADD, sockets.back()->fd(), &ev) < 0) {
+                rawFail("Registering with epoll");
+            }
+        }
+    }
+    connected.wait();
+
+    char* message = new char[msgsize];
+    memset(message, 0, msgsize);
+    int sent(0);
+    double cpuStart = processCpuSeconds();
+    auto start = std::chrono::high_resolution_clock::now();
+    if (useEpoll) {
+        std::vector<bool> busy(numclients, false);     // Partly sent frame.
+        std::vector<bool> blocked(numclients, false);  // Socket is full.
+        int nblocked(0);
+        int next(0);
+        std::vector<struct epoll_event> events(numclients);
+        while (sent < nummsgs) {
+            if (nblocked == numclients) {
+                int n = epoll_wait(epoll, events.data(), numclients, -1);
+                if (n < 0 && errno != EINTR) rawFail("Waiting in epoll");
+                for (int i = 0; i < n; i++) {
+                    blocked[events[i].data.u32] = false;
+                    nblocked--;
+                }
+                continue;
+            }
+            while (blocked[next]) {
+                next = (next + 1) % numclients;
+            }
+            if (!busy[next]) {
+                sockets[next]->start(message, msgsize);
+                busy[next] = true;
+                sent++;
+            }
+            if (sockets[next]->flush()) {
+                busy[next] = false;
+            } else {
+                blocked[next] = true;
+                nblocked++;
+            }
+            next = (next + 1) % numclients;
+        }
+        for (int i = 0; i < numclients; i++) {    // Finish partial frames.
+            while (busy[i] && !sockets[i]->flush()) {
+                sockets[i]->wait(EPOLLOUT);
+            }
+        }
+    } else {
+        while (sent < nummsgs) {
+            sockets[sent % numclients]->send(message, msgsize);
+            sent++;
+        }
+    }
+    // Tell the pullers we're done; time until they've all seen it:
+
+    for (auto s : sockets) {
+        s->send(nullptr, 0);
+    }
+    for (auto p : pullers) {
+        p->join();
+        delete p;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double cpuSecs = processCpuSeconds() - cpuStart;
+
+    for (auto s : sockets) {
+        delete s;
+    }
+    if (epoll >= 0) close(epoll);
+    close(listener);
+    rawUnlink(uri);
+    delete []message;
+
+    // Compute timings/statistics.
+    auto duration= end - start;
+    double ms = (double)std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+        .count();
+
+    double secs = ms/1000.0;
+    double kb   = (double)sent*(double)msgsize/1024.0;
+
+    std::cout << "Seconds:    " << secs << std::endl;
+    std::cout << "Messages:   " << sent << std::endl;
+    std::cout << "msgs/sec:   " << (double)sent/secs << std::endl;
+    std::cout << "kb/sec      " << kb/secs << std::endl;
+    std::cout << "CPU secs:   " << cpuSecs << std::endl;
+    std::cout << "Cores/Gbps: " << cpuSecs/(kb*1024.0*8.0/1.0e9) << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,383 @@
+/**
+ * rawsocket.h
+ *    Plain POSIX stream sockets for the raw baselines (rawpair, rawpush).
+ * These do what libzmq's tcp and ipc engines do, minus libzmq, so the ZMQ
+ * timings can be given as a fraction of what the kernel allows.
+ *
+ * Endpoints use the ZMQ syntax so the same scripts can drive both:
+ *
+ * *  tcp://host:port - AF_INET with TCP_NODELAY (as libzmq sets it).
+ * *  ipc://path      - AF_UNIX stream socket.
+ *
+ * Messages are framed as a 4 byte (network order) length followed by the
+ * data.  A zero length frame is used by the programs as an end marker.
+ *
+ * FrameSocket does the framing over a connected socket in one of two modes:
+ *
+ * *  blocking - plain blocking read/writev.
+ * *  epoll    - the socket is non-blocking and, when it would block, we
+ *               wait in epoll_wait, which is how libzmq's I/O threads work.
+ *
+ * Receives are buffered like libzmq's decoder: a read takes as much as
+ * the kernel has so several small frames cost one system call.
+ */
+#ifndef RAWSOCKET_H
+#define RAWSOCKET_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <iostream>
+
+/**
+ * rawFail
+ *    Report a failed system call and exit.
+ */
+inline void
+rawFail(const char* doing) {
+    std::cerr << "Failed " << doing << " " << strerror(errno) << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * rawAddress
+ *    Turn a tcp:// or ipc:// URI into a socket address.
+ * @param uri - the endpoint.
+ * @param addr - filled in with the address.
+ * @return socklen_t - length of the address.
+ * @note "*" as a tcp host means any interface.
+ */
+inline socklen_t
+rawAddress(const std::string& uri, struct sockaddr_storage& addr) {
+    memset(&addr, 0, sizeof(addr));
+    if (uri.compare(0, 6, "ipc://") == 0) {
+        auto un = reinterpret_cast<struct sockaddr_un*>(&addr);
+        std::string path = uri.substr(6);
+        if (path.size() >= sizeof(un->sun_path)) {
+            std::cerr << "ipc path too long: " << path << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path.c_str());
+        return sizeof(struct sockaddr_un);
+    }
+    if (uri.compare(0, 6, "tcp://") == 0) {
+        auto colon = uri.rfind(':');
+        std::string host = uri.substr(6, colon - 6);
+        std::string port = uri.substr(colon + 1);
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = host == "*" ? AI_PASSIVE : 0;
+        struct addrinfo* result;
+        int status = getaddrinfo(host == "*" ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+        if (status) {
+            std::cerr << "Failed resolving " << uri << " " << gai_strerror(status) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        memcpy(&addr, result->ai_addr, result->ai_addrlen);
+        socklen_t len = result->ai_addrlen;
+        freeaddrinfo(result);
+        return len;
+    }
+    std::cerr << "Raw sockets only support tcp:// and ipc:// endpoints, not " << uri << std::endl;
+    exit(EXIT_FAILURE);
+}
+/**
+ * rawSetup
+ *    Options for a new connection: 2MByte buffers like setBuffering in
+ * the ZMQ programs and, for tcp, no Nagle.
+ */
+inline void
+rawSetup(int fd) {
+    int size = 1024*1024*2;
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0) {
+        rawFail("Setting send buffer size");
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+        rawFail("Setting receive buffer size");
+    }
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len) == 0 &&
+        addr.ss_family == AF_INET) {
+        int on = 1;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+            rawFail("Setting TCP_NODELAY");
+        }
+    }
+}
+/**
+ * rawListen
+ *    Make a listening socket on an endpoint (ipc paths are replaced).
+ * @return int - the listening file descriptor.
+ */
+inline int
+rawListen(const std::string& uri) {
+    struct sockaddr_storage addr;
+    socklen_t len = rawAddress(uri, addr);
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) rawFail("Creating listen socket");
+    if (addr.ss_family == AF_UNIX) {
+        unlink(reinterpret_cast<struct sockaddr_un*>(&addr)->sun_path);
+    } else {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len) < 0) {
+        rawFail("Binding listen socket");
+    }
+    if (listen(fd, 128) < 0) rawFail("Listening");
+    return fd;
+}
+/**
+ * rawAccept
+ *    Accept a connection on a listening socket.
+ * @return int - the connection's file descriptor.
+ */
+inline int
+rawAccept(int listener) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) rawFail("Accepting connection");
+    rawSetup(fd);
+    return fd;
+}
+/**
+ * rawConnect
+ *    Connect to a listening endpoint.
+ * @return int - the connection's file descriptor.
+ */
+inline int
+rawConnect(const std::string& uri) {
+    struct sockaddr_storage addr;
+    socklen_t len = rawAddress(uri, addr);
+    if (addr.ss_family == AF_INET &&
+        reinterpret_cast<struct sockaddr_in*>(&addr)->sin_addr.s_addr == htonl(INADDR_ANY)) {
+        reinterpret_cast<struct sockaddr_in*>(&addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) rawFail("Creating connect socket");
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), len) < 0) {
+        rawFail("Connecting");
+    }
+    rawSetup(fd);
+    return fd;
+}
+/**
+ * rawUnlink
+ *    Remove an ipc endpoint's file once we're done with it.
+ */
+inline void
+rawUnlink(const std::string& uri) {
+    if (uri.compare(0, 6, "ipc://") == 0) {
+        unlink(uri.substr(6).c_str());
+    }
+}
+
+/**
+ * FrameSocket
+ *    Sends and receives length prefixed frames on a connected socket.
+ * The socket is owned (closed on destruction).
+ */
+class FrameSocket {
+    int         m_fd;
+    int         m_epoll;           // -1 in blocking mode.
+    uint32_t    m_events;          // Events we're registered for.
+
+    // Frame being sent; the header and data go out in one writev:
+
+    uint32_t    m_header;
+    const char* m_data;
+    size_t      m_length;
+    size_t      m_offset;          // Bytes of header+data written so far.
+
+    // Receive buffer:
+
+    char*       m_in;
+    size_t      m_inStart;
+    size_t      m_inEnd;
+    static const size_t IN_SIZE = 64*1024;
+public:
+    /**
+     * constructor
+     * @param fd - connected socket.
+     * @param useEpoll - true for non-blocking I/O waiting in epoll_wait.
+     */
+    FrameSocket(int fd, bool useEpoll) :
+        m_fd(fd), m_epoll(-1), m_events(0), m_header(0), m_data(nullptr),
+        m_length(0), m_offset(0), m_in(new char[IN_SIZE]), m_inStart(0), m_inEnd(0)
+    {
+        if (useEpoll) {
+            int flags = fcntl(fd, F_GETFL);
+            if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+                rawFail("Making socket non-blocking");
+            }
+            m_epoll = epoll_create1(0);
+            if (m_epoll < 0) rawFail("Creating epoll instance");
+        }
+    }
+    ~FrameSocket() {
+        close(m_fd);
+        if (m_epoll >= 0) close(m_epoll);
+        delete []m_in;
+    }
+    FrameSocket(const FrameSocket&) = delete;
+    FrameSocket& operator=(const FrameSocket&) = delete;
+
+    int fd() const { return m_fd; }
+
+    /**
+     * start
+     *    Start sending a frame.  The data must stay valid until flush
+     * returns true.
+     */
+    void start(const void* data, uint32_t length) {
+        m_header = htonl(length);
+        m_data = reinterpret_cast<const char*>(data);
+        m_length = length;
+        m_offset = 0;
+    }
+    /**
+     * flush
+     *    Write what we can of the frame being sent.
+     * @return bool - true if the frame is all written, false if the socket
+     *                would block (epoll mode only).
+     */
+    bool flush() {
+        size_t total = sizeof(m_header) + m_length;
+        while (m_offset < total) {
+            struct iovec iov[2];
+            int n(0);
+            if (m_offset < sizeof(m_header)) {
+                iov[n].iov_base = reinterpret_cast<char*>(&m_header) + m_offset;
+                iov[n].iov_len  = sizeof(m_header) - m_offset;
+                n++;
+                iov[n].iov_base = const_cast<char*>(m_data);
+                iov[n].iov_len  = m_length;
+            } else {
+                iov[n].iov_base = const_cast<char*>(m_data) + (m_offset - sizeof(m_header));
+                iov[n].iov_len  = total - m_offset;
+            }
+            n++;
+            ssize_t nw = writev(m_fd, iov, n);
+            if (nw < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+                if (errno == EINTR) continue;
+                rawFail("Writing frame");
+            }
+            m_offset += nw;
+        }
+        return true;
+    }
+    /**
+     * send
+     *    Send a whole frame, waiting as needed.
+     */
+    void send(const void* data, uint32_t length) {
+        start(data, length);
+        while (!flush()) {
+            wait(EPOLLOUT);
+        }
+    }
+    /**
+     * recv
+     *    Receive a frame.
+     * @param buffer - where the frame's data goes.
+     * @param size - size of buffer; longer frames are an error.
+     * @return uint32_t - length of the frame.
+     */
+    uint32_t recv(char* buffer, size_t size) {
+        uint32_t length;
+        fill(reinterpret_cast<char*>(&length), sizeof(length));
+        length = ntohl(length);
+        if (length > size) {
+            std::cerr << "Frame of " << length << " bytes is bigger than the buffer\n";
+            exit(EXIT_FAILURE);
+        }
+        fill(buffer, length);
+        return length;
+    }
+    /**
+     * wait
+     *    Wait until the socket is readable or writable.
+     * @param events - EPOLLIN or EPOLLOUT.
+     * @note no-op in blocking mode.
+     */
+    void wait(uint32_t events) {
+        if (m_epoll < 0) return;
+        if (m_events != events) {
+            struct epoll_event ev;
+            ev.events = events;
+            ev.data.fd = m_fd;
+            if (epoll_ctl(m_epoll, m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, m_fd, &ev) < 0) {
+                rawFail("Registering with epoll");
+            }
+            m_events = events;
+        }
+        struct epoll_event ev;
+        while (epoll_wait(m_epoll, &ev, 1, -1) < 0) {
+            if (errno != EINTR) rawFail("Waiting in epoll");
+        }
+    }
+private:
+    /**
+     * fill
+     *    Copy the next n received bytes to dest.  Small amounts come via the
+     * receive buffer, large ones are read directly.
+     */
+    void fill(char* dest, size_t n) {
+        while (n > 0) {
+            if (m_inStart == m_inEnd) {
+                if (n >= IN_SIZE) {
+                    size_t got = readSome(dest, n);
+                    dest += got;
+                    n    -= got;
+                    continue;
+                }
+                m_inStart = 0;
+                m_inEnd = readSome(m_in, IN_SIZE);
+            }
+            size_t chunk = m_inEnd - m_inStart;
+            if (chunk > n) chunk = n;
+            memcpy(dest, m_in + m_inStart, chunk);
+            m_inStart += chunk;
+            dest      += chunk;
+            n         -= chunk;
+        }
+    }
+    /**
+     * readSome
+     *    Read at least one byte, waiting as needed.
+     */
+    size_t readSome(char* dest, size_t max) {
+        while (true) {
+            ssize_t nr = read(m_fd, dest, max);
+            if (nr > 0) return nr;
+            if (nr == 0) {
+                std::cerr << "Peer closed the connection\n";
+                exit(EXIT_FAILURE);
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait(EPOLLIN);
+            } else if (errno != EINTR) {
+                rawFail("Reading frame");
+            }
+        }
+    }
+};
+
+#endif
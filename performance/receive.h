@@ -0,0 +1,142 @@
+/**
+ * receive.h
+ *    Selectable ways of waiting for a message in the timing programs.
+ *
+ * Blocking in zmq_msg_recv costs the least CPU but each message that
+ * arrives while we're asleep pays for a wakeup.  Spinning avoids the wakeup
+ * at the cost of a core.  Which is right depends on the service, so pair and
+ * push can receive with any of:
+ *
+ * *  block    - zmq_msg_recv with no flags (what they always did).
+ * *  spin     - zmq_msg_recv with ZMQ_DONTWAIT until a message arrives.
+ * *  hybrid[:usec] - spin for usec (default 50) then block.
+ * *  poll     - zmq_poll on the socket, then receive.
+ * *  poller   - zmq_poller_wait on a poller holding the socket, then
+ *               receive.  zmq_poller is draft API: needs make POLLER=1
+ *               and a libzmq built with drafts.
+ *
+ * A ReceiveStrategy keeps per-thread state (the poller), so each thread
+ * makes its own from the same specification and attaches its socket.
+ */
+#ifndef RECEIVE_H
+#define RECEIVE_H
+
+#include <zmq.h>
+#include <errno.h>
+#include <string>
+#include <iostream>
+#include <stdlib.h>
+#include <chrono>
+
+class ReceiveStrategy {
+    enum Kind {BLOCK, SPIN, HYBRID, POLL, POLLER};
+    Kind        m_kind;
+    int         m_spinUsec;
+    void*       m_socket;
+    void*       m_poller;
+    std::string m_name;
+public:
+    /**
+     * constructor
+     * @param spec - strategy name[:usec], empty for block.
+     */
+    ReceiveStrategy(const std::string& spec) :
+        m_kind(BLOCK), m_spinUsec(50), m_socket(nullptr), m_poller(nullptr),
+        m_name(spec.empty() ? "block" : spec)
+    {
+        std::string name(m_name.substr(0, m_name.find(':')));
+        if (m_name.find(':') != std::string::npos) {
+            m_spinUsec = atoi(m_name.substr(m_name.find(':') + 1).c_str());
+        }
+        if (name == "block") {
+            m_kind = BLOCK;
+        } else if (name == "spin") {
+            m_kind = SPIN;
+        } else if (name == "hybrid") {
+            m_kind = HYBRID;
+        } else if (name == "poll") {
+            m_kind = POLL;
+        } else if (name == "poller") {
+#ifdef ZMQ_HAVE_POLLER
+            m_kind = POLLER;
+#else
+            std::cerr << "poller support was not built in (make POLLER=1)\n";
+            exit(EXIT_FAILURE);
+#endif
+        } else {
+            std::cerr << "Unknown receive strategy " << name
+                << " (block, spin, hybrid[:usec], poll or poller)\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    ~ReceiveStrategy() {
+#ifdef ZMQ_HAVE_POLLER
+        if (m_poller) zmq_poller_destroy(&m_poller);
+#endif
+    }
+    ReceiveStrategy(const ReceiveStrategy&) = delete;
+    ReceiveStrategy& operator=(const ReceiveStrategy&) = delete;
+
+    /**
+     * attach
+     *    Say which socket we'll receive from.  Must be called before receive.
+     */
+    void attach(void* socket) {
+        m_socket = socket;
+#ifdef ZMQ_HAVE_POLLER
+        if (m_kind == POLLER) {
+            m_poller = zmq_poller_new();
+            if (!m_poller || zmq_poller_add(m_poller, socket, nullptr, ZMQ_POLLIN) < 0) {
+                std::cerr << "Failed to make poller: " << zmq_strerror(zmq_errno()) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+#endif
+    }
+    /**
+     * receive
+     *    Receive a message from the attached socket.
+     * @param msg - initialized message to receive into.
+     * @param flags - ZMQ_DONTWAIT receives without waiting whatever the
+     *                strategy.
+     * @return int - as for zmq_msg_recv.
+     */
+    int receive(zmq_msg_t* msg, int flags = 0) {
+        if (m_kind == BLOCK || (flags & ZMQ_DONTWAIT)) {
+            return zmq_msg_recv(msg, m_socket, flags);
+        }
+        if (m_kind == HYBRID) {
+            auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(m_spinUsec);
+            do {
+                int status = zmq_msg_recv(msg, m_socket, ZMQ_DONTWAIT);
+                if (status >= 0 || zmq_errno() != EAGAIN) return status;
+            } while (std::chrono::steady_clock::now() < until);
+            return zmq_msg_recv(msg, m_socket, 0);
+        }
+        while (true) {
+            if (m_kind == POLL) {
+                zmq_pollitem_t item = {m_socket, 0, ZMQ_POLLIN, 0};
+                if (zmq_poll(&item, 1, -1) < 0) return -1;
+            }
+#ifdef ZMQ_HAVE_POLLER
+            if (m_kind == POLLER) {
+                zmq_poller_event_t event;
+                if (zmq_poller_wait(m_poller, &event, -1) < 0) return -1;
+            }
+#endif
+            // SPIN, or readable (which can be a false alarm):
+
+            int status = zmq_msg_recv(msg, m_socket, ZMQ_DONTWAIT);
+            if (status >= 0 || zmq_errno() != EAGAIN) return status;
+        }
+    }
+    /**
+     * name
+     *   @return const std::string& - the specification, "block" by default.
+     */
+    const std::string& name() const {
+        return m_name;
+    }
+};
+
+#endif
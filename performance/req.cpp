@@ -6,8 +6,15 @@
  * application point of view, we only have one REQuestor in our timings.
  * 
  * Usage:
- *    req uri numreq bigsize
+ *    req [-p] [-s] [-r rate [-e] [-u usec]] uri numreq bigsize
  * Where:
+ *    -p  count cycles, instructions, LLC misses, context switches and
+ *        page faults for the requestor and replier (see perfcounters.h).
+ *    -s  secure the connection with CURVE (see curve.h).
+ *    -r  open loop: send requests at rate per second (see below).
+ *    -e  with -r, exponentially distributed gaps between requests (a
+ *        Poisson process) rather than a fixed interval.
+ *    -u  with -r, the replier spends usec of CPU on each request.
  *    uri is the URI of the communications endpoint
  *    numreq  is the number of requests that will be done
  *    bigsize is the size of the 'big' message.
@@ -18,6 +25,16 @@
  * 
  * Since each req is delivered reliably and requires a response, 
  * there's not trickiness needed to synchronize the ending.
+ *
+ * This is closed loop: a slow reply holds up the next request so the
+ * requestor backs off just when the replier is struggling, and the latency
+ * of the requests it didn't send is never measured (coordinated omission).
+ * With -r, a DEALER instead sends bigsize requests on a schedule fixed in
+ * advance whatever the replies are doing, and latency is measured from when
+ * each request was due to be sent, not when it actually went.  Replies are
+ * 16 bytes.  Run at increasing rates to find where p99 turns up: the
+ * capacity of the replier.  The uncorrected latency (from the actual send)
+ * is reported as well to show what closed loop timing would have hidden.
  * 
  * @note Thisis not production code so a missing parameter is going to likely 
  * segfault and a wonky one will do undefined things (e.g. bigsize <- 0) 
@@ -34,6 +51,12 @@
 #include <vector>
 #include <sstream>
 #include <chrono>
+#include <random>
+#include <algorithm>
+#include "perfcounters.h"
+#include "monitor.h"
+#include "curve.h"
+#include "cputime.h"
 
 // check error for int returns.
 static int checkError(int status, const char* doing) {
@@ -148,20 +171,31 @@ setBuffering(void* socket) {
  * @param ctx - ZMQ context needed to create the socket.
  * @param size - Size of the response we send.   The contents is nothing
  *             in particular.
+ * @param perf - True to count performance events.
+ * @param counts - Where our performance counts end up.
+ * @param listening - Latch we count down once we're bound.
+ * @param curve - CURVE keys, if enabled we're the server.
  */
 static void
-replier(std::string uri, void* ctx, int size) {
+replier(
+    std::string uri, void* ctx, int size, bool perf, PerfCounts& counts,
+    std::latch& listening, const Curve& curve
+) {
     auto socket = checkError(
         zmq_socket(ctx, ZMQ_REP),
         "Making replier socket."
     );
     setBuffering(socket);
+    curve.server(socket);
     checkError(
         zmq_bind(socket, uri.c_str()), 
         "binding replier socket"
     );
+    listening.count_down();
     // ready to go:
     char* replymsg = new char[size];
+    PerfCounters counters(perf);
+    counters.start();
     
     while(ignore(socket) == 0) {
         
@@ -171,6 +205,8 @@ replier(std::string uri, void* ctx, int size) {
     // THe last reply for the request that  made ignore true:
 
     send(socket, replymsg, size);
+    counters.stop();
+    counts = counters.read();
 
     // cleanup:
 
@@ -188,10 +224,19 @@ replier(std::string uri, void* ctx, int size) {
  * @param nreq - Number of requests that will be sent.
  * @param reqsize - size of the request.
  * @param repsize - size of the reply.
+ * @param perf - True to count performance events.
+ * @param reqCounts - Performance counts for the requestor.
+ * @param repCounts - Performance counts for the replier thread.
+ * @param curve - CURVE keys, if enabled we're the client.
+ * @param cpuSecs - CPU seconds the process (including ZMQ's I/O threads) used.
  * @returns double -the number of seconds in the timed part.
  */
 static double
-requestor(std::string uri, int nreq, int reqsize, int repsize) {
+requestor(
+    std::string uri, int nreq, int reqsize, int repsize,
+    bool perf, PerfCounts& reqCounts, PerfCounts& repCounts,
+    const Curve& curve, double& cpuSecs
+) {
     auto context = checkError (
         zmq_ctx_new(), 
         "Making shared ZMQ context object."
@@ -199,24 +244,36 @@ requestor(std::string uri, int nreq, int reqsize, int repsize) {
 
     // Start the REP thread which does the listen:
 
-    std::thread replythread(replier, uri, context, repsize);
-    sleep(1);                            // So it can be listening:
+    std::latch listening(1);
+    std::thread replythread(
+        replier, uri, context, repsize, perf, std::ref(repCounts), std::ref(listening),
+        std::cref(curve)
+    );
 
     auto socket = checkError(
         zmq_socket(context, ZMQ_REQ),
         "Making request socket"
     );
+    auto monitor = new SocketMonitor(context, socket, ZMQ_EVENT_HANDSHAKE_SUCCEEDED);
+    curve.client(socket);
+    listening.wait();                   // Connect won't need to retry.
     checkError(
         zmq_connect(socket, uri.c_str()), 
         "Connecting to the replier"
     );
+    std::latch connected(0);            // We're the only peer and we're connected.
+    waitForPeers(*monitor, uri, 1, connected);
+    delete monitor;                     // Its socket must be closed before zmq_ctx_term.
 
     char* request  = new char[reqsize];
     *request = 0;
 
     // Start timing and doing the REQ/REP dance:
 
+    PerfCounters counters(perf);
+    double cpuStart = processCpuSeconds();
     auto start = std::chrono::high_resolution_clock::now();
+    counters.start();
     for (int i =0; i < nreq; i++) {
         send(socket, request, reqsize);
         ignore(socket);
@@ -226,8 +283,12 @@ requestor(std::string uri, int nreq, int reqsize, int repsize) {
             *request = 0xff;
         }
     }
+    counters.stop();
     replythread.join();
     auto end = std::chrono::high_resolution_clock::now();
+    cpuSecs = processCpuSeconds() - cpuStart;
+    reqCounts = counters.read();
+    delete []request;
 
     // Tear down zmq:
 
@@ -248,15 +309,304 @@ requestor(std::string uri, int nreq, int reqsize, int repsize) {
         .count();
     return ms/1000.0;                    // Seconds.
 }
+// Open loop requests start with when they were due and when they went:
+
+struct Stamps {
+    int64_t due;          // steady_clock nanoseconds.
+    int64_t sent;
+};
+
+static int64_t
+now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+/**
+ * spin
+ *    Use CPU for some microseconds (the replier's "work").
+ */
+static void
+spin(int usec) {
+    if (usec <= 0) return;
+    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(usec);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+/**
+ * setUnlimited
+ *    No high water marks: a REP drops replies that hit one and an open
+ * loop requestor can get well ahead of its replies.
+ */
+static void
+setUnlimited(void* socket) {
+    int hwm(0);
+    checkError(zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm)), "Setting send hwm");
+    checkError(zmq_setsockopt(socket, ZMQ_RCVHWM, &hwm, sizeof(hwm)), "Setting receive hwm");
+}
+/**
+ * echoer
+ *    The open loop replier: return the Stamps from each request until the
+ * context is shut down.
+ *
+ * @param usec - CPU to spend on each request.
+ *
+ * Other parameters are as for replier.
+ */
+static void
+echoer(
+    std::string uri, void* ctx, int usec, bool perf, PerfCounts& counts,
+    std::latch& listening, const Curve& curve
+) {
+    auto socket = checkError(
+        zmq_socket(ctx, ZMQ_REP),
+        "Making replier socket."
+    );
+    setBuffering(socket);
+    setUnlimited(socket);
+    curve.server(socket);
+    checkError(
+        zmq_bind(socket, uri.c_str()),
+        "binding replier socket"
+    );
+    listening.count_down();
+    PerfCounters counters(perf);
+    counters.start();
+    Stamps stamps;
+    while (zmq_recv(socket, &stamps, sizeof(stamps), 0) >= 0) {   // Truncates the rest.
+        spin(usec);
+        if (zmq_send(socket, &stamps, sizeof(stamps), 0) < 0) break;
+    }
+    if (zmq_errno() != ETERM) {
+        checkError(-1, "Echoing request");
+    }
+    counters.stop();
+    counts = counters.read();
+    int linger(0);
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(socket);
+}
+/**
+ * receiveReply
+ *    Receive an open loop reply (empty delimiter then the Stamps) if
+ * there is one.
+ * @param socket - the DEALER.
+ * @param stamps - where the Stamps go.
+ * @return bool - false if there was no reply waiting.
+ */
+static bool
+receiveReply(void* socket, Stamps& stamps) {
+    char delimiter;
+    int status = zmq_recv(socket, &delimiter, sizeof(delimiter), ZMQ_DONTWAIT);
+    if (status < 0 && zmq_errno() == EAGAIN) {
+        return false;
+    }
+    checkError(status, "Receiving reply delimiter");
+    checkError(zmq_recv(socket, &stamps, sizeof(stamps), 0), "Receiving reply");
+    return true;
+}
+/**
+ * openLoop
+ *    Does the open loop timing.
+ *
+ * @param uri - Communications end point to use.
+ * @param nreq - Number of requests that will be sent.
+ * @param reqsize - size of the request (at least sizeof(Stamps)).
+ * @param rate - requests per second offered.
+ * @param poisson - True for exponential gaps between requests.
+ * @param usec - replier CPU per request.
+ * @param perf - True to count performance events.
+ * @param reqCounts - Performance counts for the requestor.
+ * @param repCounts - Performance counts for the replier thread.
+ * @param curve - CURVE keys, if enabled we're the client.
+ * @param cpuSecs - CPU seconds the process used.
+ * @param latencies - usec from each request being due to its reply.
+ * @param uncorrected - usec from each request being sent to its reply.
+ * @return double - seconds from the first request being due to the last reply.
+ */
+static double
+openLoop(
+    std::string uri, int nreq, int reqsize, double rate, bool poisson, int usec,
+    bool perf, PerfCounts& reqCounts, PerfCounts& repCounts, const Curve& curve,
+    double& cpuSecs, std::vector<double>& latencies, std::vector<double>& uncorrected
+) {
+    auto context = checkError (
+        zmq_ctx_new(),
+        "Making shared ZMQ context object."
+    );
+    std::latch listening(1);
+    std::thread replythread(
+        echoer, uri, context, usec, perf, std::ref(repCounts), std::ref(listening),
+        std::cref(curve)
+    );
+    auto socket = checkError(
+        zmq_socket(context, ZMQ_DEALER),
+        "Making request socket"
+    );
+    setBuffering(socket);
+    setUnlimited(socket);
+    auto monitor = new SocketMonitor(context, socket, ZMQ_EVENT_HANDSHAKE_SUCCEEDED);
+    curve.client(socket);
+    listening.wait();
+    checkError(
+        zmq_connect(socket, uri.c_str()),
+        "Connecting to the replier"
+    );
+    std::latch connected(0);
+    waitForPeers(*monitor, uri, 1, connected);
+    delete monitor;
+
+    char* request = new char[reqsize];
+    memset(request, 0, reqsize);
+    std::mt19937_64 random(1);
+    std::exponential_distribution<double> gaps(rate);     // Seconds.
+    latencies.clear();
+    uncorrected.clear();
+    latencies.reserve(nreq);
+    uncorrected.reserve(nreq);
+
+    PerfCounters counters(perf);
+    double cpuStart = processCpuSeconds();
+    int64_t start = now();
+    double due = start;                   // Nanoseconds; double so gaps don't round away.
+    int sent(0), received(0);
+    counters.start();
+    while (received < nreq) {
+        int64_t t = now();
+        if (sent < nreq && t >= (int64_t)due) {
+            // Send even if we're late; the lateness counts against latency.
+
+            Stamps stamps = {(int64_t)due, t};
+            memcpy(request, &stamps, sizeof(stamps));
+            checkError(zmq_send(socket, "", 0, ZMQ_SNDMORE), "Sending delimiter");
+            send(socket, request, reqsize);
+            sent++;
+            due += (poisson ? gaps(random) : 1.0/rate)*1.0e9;
+            continue;
+        }
+        Stamps stamps;
+        bool got(false);
+        while (receiveReply(socket, stamps)) {
+            int64_t arrived = now();
+            latencies.push_back((double)(arrived - stamps.due)/1000.0);
+            uncorrected.push_back((double)(arrived - stamps.sent)/1000.0);
+            received++;
+            got = true;
+        }
+        if (got) continue;
+
+        // Nothing to do; wait for a reply until the next request is due.
+        // zmq_poll's timeout is in ms so the last part is a yielding spin
+        // (which shows up in CPU secs at rates over 1000/sec):
+
+        long timeout = -1;
+        if (sent < nreq) {
+            timeout = ((int64_t)due - now())/1000000;
+            if (timeout < 0) timeout = 0;
+        }
+        zmq_pollitem_t item = {socket, 0, ZMQ_POLLIN, 0};
+        checkError(zmq_poll(&item, 1, timeout), "Polling for replies");
+        if (timeout == 0) {
+            std::this_thread::yield();
+        }
+    }
+    counters.stop();
+    int64_t end = now();
+    cpuSecs = processCpuSeconds() - cpuStart;
+    reqCounts = counters.read();
+    delete []request;
+
+    // The echoer doesn't know how many requests there are; shutting the
+    // context down gets it out of zmq_recv with ETERM:
+
+    int linger(0);
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    checkError(zmq_close(socket), "Closing request socket");
+    checkError(zmq_ctx_shutdown(context), "Shutting down context");
+    replythread.join();
+    checkError(
+        zmq_ctx_term(context),
+        "Terminating ZMQ context"
+    );
+    return (double)(end - start)/1.0e9;
+}
 // Main is the requestor that way we can control the flow.
 
 int main(int argc, char** argv) {
-    std::string uri(argv[1]);
-    int nreq = atoi(argv[2]);
-    int bigsize = atoi(argv[3]);
+    bool perf(false);
+    bool secure(false);
+    double rate(0);
+    bool poisson(false);
+    int usec(0);
+    int opt;
+    while ((opt = getopt(argc, argv, "psr:eu:")) != -1) {
+        switch (opt) {
+        case 'p':
+            perf = true;
+            break;
+        case 's':
+            secure = true;
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'e':
+            poisson = true;
+            break;
+        case 'u':
+            usec = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: req [-p] [-s] [-r rate [-e] [-u usec]] uri numreq bigsize\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nreq = atoi(argv[optind+1]);
+    int bigsize = atoi(argv[optind+2]);
+    if (secure && isInproc(uri)) {
+        std::cerr << "Warning: CURVE has no effect on inproc transports\n";
+    }
+    Curve curve(secure);
 
-    double bigsecs = requestor(uri, nreq, bigsize, 1);
-    double smallsecs = requestor(uri, nreq, 1, bigsize);
+    if (rate > 0) {
+        int reqsize = bigsize < (int)sizeof(Stamps) ? (int)sizeof(Stamps) : bigsize;
+        PerfCounts reqCounts, repCounts;
+        double cpuSecs;
+        std::vector<double> latencies, uncorrected;
+        double secs = openLoop(
+            uri, nreq, reqsize, rate, poisson, usec, perf, reqCounts, repCounts, curve,
+            cpuSecs, latencies, uncorrected
+        );
+        std::sort(latencies.begin(), latencies.end());
+        std::sort(uncorrected.begin(), uncorrected.end());
+        size_t n = latencies.size();
+        double kb = (double)reqsize*(double)nreq/1024.0;
+
+        std::cout << "Open loop " << (poisson ? "poisson" : "fixed") << " arrivals, request size "
+            << reqsize << " reply size " << sizeof(Stamps) << std::endl;
+        std::cout << "Seconds:     " << secs << std::endl;
+        std::cout << "Offered/sec: " << rate << std::endl;
+        std::cout << "Req/sec:     " << (double)nreq/secs << std::endl;
+        std::cout << "Latency usec p50: " << latencies[n/2]
+            << " p99: " << latencies[(n*99)/100]
+            << " p99.9: " << latencies[(n*999)/1000]
+            << " max: " << latencies.back() << std::endl;
+        std::cout << "Uncorrected usec p50: " << uncorrected[n/2]
+            << " p99: " << uncorrected[(n*99)/100]
+            << " max: " << uncorrected.back() << std::endl;
+        std::cout << "CPU secs:    " << cpuSecs << std::endl;
+        if (perf) {
+            reportPerfCounts("Requestor", reqCounts, nreq, kb);
+            reportPerfCounts("Replier", repCounts, nreq, kb);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    PerfCounts bigReq, bigRep, smallReq, smallRep;
+    double bigcpu, smallcpu;
+    double bigsecs = requestor(uri, nreq, bigsize, 1, perf, bigReq, bigRep, curve, bigcpu);
+    double smallsecs = requestor(uri, nreq, 1, bigsize, perf, smallReq, smallRep, curve, smallcpu);
 
     // Compute the timings:
 
@@ -266,9 +616,23 @@ int main(int argc, char** argv) {
     std::cout << "Seconds:     " << bigsecs << std::endl;
     std::cout << "Req/sec:     " << (double)nreq/bigsecs << std::endl;
     std::cout << "KB/sec:      " << kb/bigsecs << std::endl;
+    std::cout << "RTT usec:    " << bigsecs*1.0e6/nreq << std::endl;
+    std::cout << "CPU secs:    " << bigcpu << std::endl;
+    std::cout << "Cores/Gbps:  " << bigcpu/(kb*1024.0*8.0/1.0e9) << std::endl;
+    if (perf) {
+        reportPerfCounts("Requestor", bigReq, nreq, kb);
+        reportPerfCounts("Replier", bigRep, nreq, kb);
+    }
 
     std::cout << "Request size 1 reply size " << bigsize << std::endl;
     std::cout << "Seconds:     " << smallsecs << std::endl;
     std::cout << "Req/sec:     " << (double)nreq/smallsecs << std::endl;
     std::cout << "KB/sec:      " << kb/smallsecs << std::endl;
+    std::cout << "RTT usec:    " << smallsecs*1.0e6/nreq << std::endl;
+    std::cout << "CPU secs:    " << smallcpu << std::endl;
+    std::cout << "Cores/Gbps:  " << smallcpu/(kb*1024.0*8.0/1.0e9) << std::endl;
+    if (perf) {
+        reportPerfCounts("Requestor", smallReq, nreq, kb);
+        reportPerfCounts("Replier", smallRep, nreq, kb);
+    }
 }
\ No newline at end of file
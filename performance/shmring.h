@@ -0,0 +1,277 @@
+/**
+ * shmring.h
+ *    A shared memory ring buffer "transport" to compare ipc:// and inproc://
+ * against.  It's what a custom same-host fast path would look like:
+ *
+ * *  The ring lives in a POSIX shared memory object (shm_open + mmap) so
+ *    it works between processes as well as between threads.
+ * *  It's a bounded queue of fixed size slots in the style of Dmitry
+ *    Vyukov's MPMC queue: every slot has a sequence number that says
+ *    whether it's free for the producer or full for a consumer.  There's a
+ *    single producer, any number of consumers (they claim slots with a
+ *    compare and swap), so it serves as SPSC for pair and multi-consumer
+ *    for push.
+ * *  Nothing is locked.  A side that finds the ring empty (full) spins
+ *    briefly and then sleeps in a futex; the other side only makes the
+ *    wake system call if someone is actually sleeping.
+ *
+ * send/ignore mirror the helpers of the same name in the timing programs.
+ * Messages are copied into the slot like zmq_send copies; ignore looks at
+ * the message in place and frees the slot, like ignore's zmq_msg_close.
+ *
+ * Endpoints are written shm://name.  ShmRing::create makes (replacing) the
+ * object /name; ShmRing::open maps an existing one.  The creator unlinks it
+ * on destruction.
+ */
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <iostream>
+
+/**
+ * isShm
+ *   @param uri - an endpoint URI.
+ *   @return bool - true if the endpoint is a shared memory ring.
+ */
+inline bool
+isShm(const std::string& uri) {
+    return uri.compare(0, 6, "shm://") == 0;
+}
+
+/**
+ * ShmRing
+ *    One direction of shared memory communication.
+ */
+class ShmRing {
+    // The start of the shared object.  Producer and consumer fields are
+    // on separate cache lines so they don't false share.
+
+    struct Header {
+        uint64_t                  slotSize;      // Bytes of data per slot.
+        uint64_t                  nslots;        // Power of two.
+        uint64_t                  stride;        // Bytes between slots.
+        alignas(64) std::atomic<uint64_t> head;  // Next slot to fill.
+        alignas(64) std::atomic<uint64_t> tail;  // Next slot to empty.
+        alignas(64) std::atomic<uint32_t> dataSeq;      // futex: bumped on each send.
+        std::atomic<uint32_t>     dataWaiters;
+        alignas(64) std::atomic<uint32_t> spaceSeq;     // futex: bumped on each receive.
+        std::atomic<uint32_t>     spaceWaiters;
+    };
+    // Each slot is a sequence number, the message length and the data:
+
+    static const size_t SEQ_OFFSET  = 0;
+    static const size_t LEN_OFFSET  = 8;
+    static const size_t DATA_OFFSET = 16;
+    static const int    SPINS = 1000;    // Polls before sleeping in a futex.
+
+    std::string m_name;
+    bool        m_owner;
+    size_t      m_size;
+    Header*     m_header;
+    char*       m_slots;
+public:
+    /**
+     * create
+     *    Make a new ring.
+     * @param uri - shm://name.
+     * @param slotSize - Largest message.
+     * @param nslots - Slots in the ring; rounded up to a power of two.
+     * @return ShmRing* - the ring, delete it when done.
+     */
+    static ShmRing* create(const std::string& uri, size_t slotSize, size_t nslots) {
+        size_t n(1);
+        while (n < nslots) n *= 2;
+        size_t stride = (DATA_OFFSET + slotSize + 63) & ~size_t(63);
+        size_t size = sizeof(Header) + n*stride;
+
+        std::string name = objectName(uri);
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) fail("Creating shared memory");
+        if (ftruncate(fd, size) < 0) fail("Sizing shared memory");
+        ShmRing* ring = new ShmRing(name, true, fd, size);
+
+        Header* h = ring->m_header;
+        h->slotSize = slotSize;
+        h->nslots   = n;
+        h->stride   = stride;
+        new (&h->head) std::atomic<uint64_t>(0);
+        new (&h->tail) std::atomic<uint64_t>(0);
+        new (&h->dataSeq) std::atomic<uint32_t>(0);
+        new (&h->dataWaiters) std::atomic<uint32_t>(0);
+        new (&h->spaceSeq) std::atomic<uint32_t>(0);
+        new (&h->spaceWaiters) std::atomic<uint32_t>(0);
+        for (size_t i = 0; i < n; i++) {
+            new (ring->seq(i)) std::atomic<uint64_t>(i);
+        }
+        return ring;
+    }
+    /**
+     * defaultSlots
+     *    Enough slots to buffer about what setBuffering gives a socket
+     * (2MBytes) but at least 16.
+     */
+    static size_t defaultSlots(size_t slotSize) {
+        size_t n = (2*1024*1024)/(slotSize + DATA_OFFSET);
+        return n < 16 ? 16 : n;
+    }
+    /**
+     * open
+     *    Map a ring someone else created.
+     * @param uri - shm://name.
+     * @return ShmRing* - the ring, delete it when done.
+     */
+    static ShmRing* open(const std::string& uri) {
+        std::string name = objectName(uri);
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) fail("Opening shared memory");
+        struct stat info;
+        if (fstat(fd, &info) < 0) fail("Getting shared memory size");
+        return new ShmRing(name, false, fd, info.st_size);
+    }
+    ~ShmRing() {
+        munmap(m_header, m_size);
+        if (m_owner) {
+            shm_unlink(m_name.c_str());
+        }
+    }
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    /**
+     * send
+     *    Copy a message into the ring.
+     * @param data - the message.
+     * @param len  - its size, at most the slot size.
+     * @param wait - if false return rather than wait for a free slot.
+     * @return bool - false if wait was false and the ring was full.
+     * @note there's only one producer per ring.
+     */
+    bool send(const void* data, size_t len, bool wait = true) {
+        if (len > m_header->slotSize) {
+            std::cerr << "Message of " << len << " bytes won't fit a "
+                << m_header->slotSize << " byte slot\n";
+            exit(EXIT_FAILURE);
+        }
+        uint64_t pos = m_header->head.load(std::memory_order_relaxed);
+        size_t   index = pos & (m_header->nslots - 1);
+        auto     slotSeq = seq(index);
+
+        int spins(0);
+        while (slotSeq->load(std::memory_order_acquire) != pos) {  // Full.
+            if (!wait) return false;
+            if (++spins > SPINS) {
+                sleep(m_header->spaceSeq, m_header->spaceWaiters, [&]() {
+                    return slotSeq->load(std::memory_order_acquire) == pos;
+                });
+            }
+        }
+        char* slot = m_slots + index*m_header->stride;
+        *reinterpret_cast<uint32_t*>(slot + LEN_OFFSET) = len;
+        memcpy(slot + DATA_OFFSET, data, len);
+        m_header->head.store(pos + 1, std::memory_order_relaxed);
+        slotSeq->store(pos + 1, std::memory_order_release);
+        wake(m_header->dataSeq, m_header->dataWaiters);
+        return true;
+    }
+    /**
+     * ignore
+     *    Take a message out of the ring and throw it away.
+     * @param wait - if false return rather than wait for a message.
+     * @return int - the first byte of the message (0 if it's empty),
+     *               -1 if wait was false and the ring was empty.
+     */
+    int ignore(bool wait = true) {
+        int spins(0);
+        while (true) {
+            uint64_t pos = m_header->tail.load(std::memory_order_relaxed);
+            size_t   index = pos & (m_header->nslots - 1);
+            auto     slotSeq = seq(index);
+            uint64_t s = slotSeq->load(std::memory_order_acquire);
+            if (s == pos + 1) {
+                if (m_header->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    char* slot = m_slots + index*m_header->stride;
+                    int result =
+                        *reinterpret_cast<uint32_t*>(slot + LEN_OFFSET) ?
+                        *reinterpret_cast<uint8_t*>(slot + DATA_OFFSET) : 0;
+                    slotSeq->store(pos + m_header->nslots, std::memory_order_release);
+                    wake(m_header->spaceSeq, m_header->spaceWaiters);
+                    return result;
+                }
+            } else if (s < pos + 1) {                              // Empty.
+                if (!wait) return -1;
+                if (++spins > SPINS) {
+                    sleep(m_header->dataSeq, m_header->dataWaiters, [&]() {
+                        return slotSeq->load(std::memory_order_acquire) == pos + 1 ||
+                            m_header->tail.load(std::memory_order_relaxed) != pos;
+                    });
+                }
+            }
+            // else another consumer took it, try the next slot.
+        }
+    }
+private:
+    ShmRing(const std::string& name, bool owner, int fd, size_t size) :
+        m_name(name), m_owner(owner), m_size(size)
+    {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) fail("Mapping shared memory");
+        close(fd);
+        m_header = reinterpret_cast<Header*>(p);
+        m_slots  = reinterpret_cast<char*>(p) + sizeof(Header);
+    }
+    std::atomic<uint64_t>* seq(size_t index) {
+        return reinterpret_cast<std::atomic<uint64_t>*>(
+            m_slots + index*m_header->stride + SEQ_OFFSET
+        );
+    }
+    /**
+     * sleep
+     *    Sleep in the futex unless ready() becomes true.  We register as a
+     * waiter before the final check so a waker either sees us or we see
+     * its change.
+     */
+    template<typename Ready>
+    static void sleep(std::atomic<uint32_t>& futex, std::atomic<uint32_t>& waiters, Ready ready) {
+        waiters.fetch_add(1);
+        uint32_t value = futex.load();
+        if (!ready()) {
+            syscall(
+                SYS_futex, reinterpret_cast<uint32_t*>(&futex), FUTEX_WAIT, value,
+                nullptr, nullptr, 0
+            );
+        }
+        waiters.fetch_sub(1);
+    }
+    static void wake(std::atomic<uint32_t>& futex, std::atomic<uint32_t>& waiters) {
+        futex.fetch_add(1);
+        if (waiters.load() > 0) {
+            syscall(
+                SYS_futex, reinterpret_cast<uint32_t*>(&futex), FUTEX_WAKE, INT32_MAX,
+                nullptr, nullptr, 0
+            );
+        }
+    }
+    static std::string objectName(const std::string& uri) {
+        return "/" + uri.substr(6);
+    }
+    static void fail(const char* doing) {
+        std::cerr << "Failed " << doing << " " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+};
+
+#endif
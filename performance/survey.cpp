@@ -0,0 +1,323 @@
+/**
+ * survey.cpp
+ *    Times the survey pattern built from a PUB (surveys out) and a
+ * PULL (answers back).  See ../survey.cpp for the example.
+ *
+ * Usage:
+ *    survey [-d percent] [-w usec] uri nrespondents nsurveys deadline
+ * Where:
+ *    -d  - Percentage of surveys each respondent declines (default 0).
+ *    -w  - Respondents think for a random 0..usec before answering
+ *          (default 0) so some answers miss the deadline.
+ *    uri - Endpoint of the surveyor's PUB.  The PULL binds the next
+ *          endpoint (see endpoints.h).
+ *    nrespondents - Number of respondent threads.
+ *    nsurveys - Number of surveys timed.
+ *    deadline - Milliseconds the surveyor waits for answers.
+ *
+ * A survey ends at the deadline or as soon as every respondent has
+ * answered.  The surveyor can't know who declined, so surveys with
+ * decliners always run to the deadline, just as in nng.
+ *
+ * Reported:
+ *   *  Surveys/sec.
+ *   *  Survey duration percentiles (send to end of survey).
+ *   *  Round trip percentiles: time to each on-time answer and to the
+ *      last on-time answer of each survey.
+ *   *  Completeness: on-time answers as a fraction of the respondents, and
+ *      of the answers actually sent (the rest arrived late).
+ *
+ * Messages are binary: a survey is {kind, survey id}, an answer
+ * {kind, survey id, respondent}.  Readiness is a PING survey repeated
+ * until all respondents have answered; shutdown is EXIT repeated until
+ * all have said BYE.
+ *
+ * @note this is not production code; missing parameters will segfault.
+ */
+#include <thread>
+#include <atomic>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "endpoints.h"
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static const uint32_t PING   = 1;
+static const uint32_t SURVEY = 2;
+static const uint32_t EXIT   = 3;
+
+// A respondent's two sockets' mailboxes and, except inproc, both ends of
+// its two connections:
+
+static const int FILES_PER_RESPONDENT = 6;
+static const int FILES_PER_INPROC_RESPONDENT = 2;
+
+struct Survey {
+    uint32_t kind;
+    uint32_t id;
+};
+struct Answer {
+    uint32_t kind;
+    uint32_t id;
+    uint32_t respondent;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double
+usec(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+/**
+ * receiveAnswer
+ *    Wait for an answer.
+ * @param socket - the PULL socket.
+ * @param timeout - milliseconds; 0 polls.
+ * @param answer - filled in with the answer if there is one.
+ * @return bool - true if there was an answer.
+ */
+static bool
+receiveAnswer(void* socket, long timeout, Answer& answer) {
+    zmq_pollitem_t item = {socket, 0, ZMQ_POLLIN, 0};
+    if (checkError(zmq_poll(&item, 1, timeout), "Polling for answers") == 0) {
+        return false;
+    }
+    checkError(zmq_recv(socket, &answer, sizeof(answer), 0), "Receiving answer");
+    return true;
+}
+
+/**
+ * respondent
+ *    Answers (or declines) surveys until an EXIT.
+ *
+ * @param surveyUri - surveyor's PUB endpoint.
+ * @param answerUri - surveyor's PULL endpoint.
+ * @param ctx - shared context.
+ * @param id - our respondent id.
+ * @param declinePercent - chance we decline a survey.
+ * @param thinkUsec - max think time before answering.
+ * @param sent - count of answers to real surveys we sent (shared).
+ */
+static void
+respondent(
+    std::string surveyUri, std::string answerUri, void* ctx, uint32_t id,
+    int declinePercent, int thinkUsec, std::atomic<int64_t>& sent
+) {
+    auto sub = checkError(zmq_socket(ctx, ZMQ_SUB), "Creating respondent SUB");
+    checkError(zmq_setsockopt(sub, ZMQ_SUBSCRIBE, "", 0), "Subscribing to surveys");
+    checkError(zmq_connect(sub, surveyUri.c_str()), "Connecting to surveyor");
+    auto push = checkError(zmq_socket(ctx, ZMQ_PUSH), "Creating respondent PUSH");
+    checkError(zmq_connect(push, answerUri.c_str()), "Connecting answer path");
+
+    unsigned int seed = id;
+    while (true) {
+        Survey survey;
+        checkError(zmq_recv(sub, &survey, sizeof(survey), 0), "Receiving survey");
+        Answer answer = {survey.kind, survey.id, id};
+        if (survey.kind == SURVEY) {
+            if ((int)(rand_r(&seed) % 100) < declinePercent) {
+                continue;
+            }
+            if (thinkUsec > 0) {
+                usleep(rand_r(&seed) % thinkUsec);
+            }
+            sent++;
+        }
+        checkError(zmq_send(push, &answer, sizeof(answer), 0), "Sending answer");
+        if (survey.kind == EXIT) break;
+    }
+    checkError(zmq_close(sub), "Closing respondent SUB");
+    checkError(zmq_close(push), "Closing respondent PUSH");
+}
+/**
+ * broadcastUntil
+ *    Send a survey of some kind every 10ms until n distinct respondents
+ * have answered one of that kind.  Other answers are counted as late.
+ * @return int64_t - number of late survey answers seen while doing this.
+ */
+static int64_t
+broadcastUntil(void* pub, void* pull, uint32_t kind, int n) {
+    std::vector<bool> heard(n, false);
+    int nheard(0);
+    int64_t late(0);
+    Survey survey = {kind, 0};
+    while (nheard < n) {
+        checkError(zmq_send(pub, &survey, sizeof(survey), 0), "Sending broadcast");
+        Answer answer;
+        while (receiveAnswer(pull, 10, answer)) {
+            if (answer.kind == kind && !heard[answer.respondent]) {
+                heard[answer.respondent] = true;
+                nheard++;
+            } else if (answer.kind == SURVEY) {
+                late++;
+            }
+        }
+    }
+    return late;
+}
+
+int main(int argc, char** argv) {
+    int declinePercent(0);
+    int thinkUsec(0);
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:")) != -1) {
+        switch (opt) {
+        case 'd':
+            declinePercent = atoi(optarg);
+            break;
+        case 'w':
+            thinkUsec = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: survey [-d percent] [-w usec] uri nrespondents nsurveys deadline\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nrespondents = atoi(argv[optind+1]);
+    int nsurveys = atoi(argv[optind+2]);
+    int deadline = atoi(argv[optind+3]);
+    std::string answerUri = nthEndpoint(uri, 1);
+
+    // Each respondent has a SUB and a PUSH, and on tcp and ipc both ends of
+    // both connections are in this process, so lots of respondents need
+    // lots of files:
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    int files = uri.compare(0, 9, "inproc://") == 0 ?
+        FILES_PER_INPROC_RESPONDENT : FILES_PER_RESPONDENT;
+    if (limit.rlim_cur < rlim_t(files*nrespondents + 64)) {
+        std::cerr << limit.rlim_cur << " files are too few for " << nrespondents
+            << " respondents (raise ulimit -Hn)\n";       // Else accepts fail quietly and we hang.
+        exit(EXIT_FAILURE);
+    }
+
+    auto context = checkError(zmq_ctx_new(), "Creating context");
+    checkError(
+        zmq_ctx_set(context, ZMQ_MAX_SOCKETS, 2*nrespondents + 16),
+        "Setting max sockets"
+    );
+    auto pub = checkError(zmq_socket(context, ZMQ_PUB), "Creating surveyor PUB");
+    checkError(zmq_bind(pub, uri.c_str()), "Binding surveyor PUB");
+    auto pull = checkError(zmq_socket(context, ZMQ_PULL), "Creating surveyor PULL");
+    checkError(zmq_bind(pull, answerUri.c_str()), "Binding surveyor PULL");
+
+    std::atomic<int64_t> sent(0);
+    std::vector<std::thread*> respondents;
+    for (int i = 0; i < nrespondents; i++) {
+        respondents.push_back(new std::thread(
+            respondent, uri, answerUri, context, i, declinePercent, thinkUsec, std::ref(sent)
+        ));
+    }
+    broadcastUntil(pub, pull, PING, nrespondents);
+
+    // Time the surveys:
+
+    std::vector<double> durations;        // usec.
+    std::vector<double> answerTimes;
+    std::vector<double> lastAnswerTimes;
+    int64_t onTime(0);
+    int64_t late(0);
+    int complete(0);
+
+    auto start = Clock::now();
+    for (uint32_t s = 1; s <= (uint32_t)nsurveys; s++) {
+        Survey survey = {SURVEY, s};
+        auto surveyStart = Clock::now();
+        auto end = surveyStart + std::chrono::milliseconds(deadline);
+        checkError(zmq_send(pub, &survey, sizeof(survey), 0), "Sending survey");
+
+        int answers(0);
+        double last(0);
+        while (answers < nrespondents) {
+            long remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+                end - Clock::now()
+            ).count();
+            Answer answer;
+            if (remaining <= 0 || !receiveAnswer(pull, (remaining + 999)/1000, answer)) {
+                break;
+            }
+            if (answer.kind != SURVEY || answer.id != s) {
+                if (answer.kind == SURVEY) late++;
+                continue;
+            }
+            last = usec(surveyStart, Clock::now());
+            answerTimes.push_back(last);
+            answers++;
+        }
+        durations.push_back(usec(surveyStart, Clock::now()));
+        if (answers > 0) lastAnswerTimes.push_back(last);
+        if (answers == nrespondents) complete++;
+        onTime += answers;
+    }
+    double secs = usec(start, Clock::now())/1.0e6;
+
+    // EXIT also sweeps up the stragglers from the last surveys:
+
+    late += broadcastUntil(pub, pull, EXIT, nrespondents);
+    for (auto p : respondents) {
+        p->join();
+        delete p;
+    }
+    checkError(zmq_close(pub), "Closing surveyor PUB");
+    checkError(zmq_close(pull), "Closing surveyor PULL");
+    checkError(zmq_ctx_term(context), "Terminating context");
+
+    // Report:
+
+    auto percentiles = [](const char* what, std::vector<double>& v) {
+        std::cout << what;
+        if (v.empty()) {
+            std::cout << " none\n";
+            return;
+        }
+        std::sort(v.begin(), v.end());
+        std::cout << " p50: " << v[v.size()/2] << " p99: " << v[(v.size()*99)/100]
+            << " max: " << v.back() << std::endl;
+    };
+    std::cout << "Respondents:      " << nrespondents << std::endl;
+    std::cout << "Seconds:          " << secs << std::endl;
+    std::cout << "Surveys/sec:      " << nsurveys/secs << std::endl;
+    percentiles("Survey usec:     ", durations);
+    percentiles("Answer RTT usec: ", answerTimes);
+    percentiles("Last answer usec:", lastAnswerTimes);
+    std::cout << "On time answers:  " << onTime << std::endl;
+    std::cout << "Late answers:     " << late << std::endl;
+    std::cout << "Answers sent:     " << sent << std::endl;
+    std::cout << "Completeness:     " << (double)onTime/((double)nsurveys*nrespondents)
+        << " of respondents, " << (sent ? (double)onTime/(double)sent : 0.0)
+        << " of answers sent\n";
+    std::cout << "Complete surveys: " << complete << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+/**
+ * topics.cpp
+ *    Times subscriber side topic dispatch (see ../dispatch.h) for a number
+ * of topics.  Four ways of finding a message's handler are compared:
+ *
+ * *  split - what pubsub.cpp's subscriber used to do: copy the message
+ *            into a std::string, split it into words with a stringstream
+ *            and look the first word up in a std::map.
+ * *  hash  - find the first word in place and look it up in a
+ *            std::unordered_map keyed by std::string_view.
+ * *  dispatcher - TopicDispatcher: the first word is a registered topic,
+ *            so it's found in the dispatcher's hash.
+ * *  prefix - TopicDispatcher with each topic registered without its last
+ *            character, so no word matches and every message walks the
+ *            trie to its longest matching prefix.
+ *
+ * Usage:
+ *    topics [-a] [-s size] ntopics nummsgs
+ * Where:
+ *    -a  - count allocations per message (see allocstats.h; needs
+ *          make ALLOCSTATS=1).
+ *    -s  - bytes of message body after the topic (default 64).
+ *    ntopics - number of registered topics, named like "prices.EQ.12345".
+ *    nummsgs - messages dispatched per method.
+ *
+ * Messages are built up front (topics chosen at random) and sit in memory
+ * as they would in a zmq_msg_t, so only the dispatch is timed; pubsub times
+ * the transport.  Every handler just counts its messages.
+ */
+#include <iostream>
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include <random>
+#include "../dispatch.h"
+#include "allocstats.h"
+
+// split a string into words (pubsub.cpp's original):
+
+static std::vector<std::string>
+splitLine(const std::string& line) {
+    std::stringstream strLine(line);
+    std::vector<std::string> result;
+
+    std::string word;
+    while (strLine >> word) {
+        result.push_back(word);
+    }
+    return result;
+}
+/**
+ * topicName
+ *    Topic n; a few shared prefixes like real feeds have.
+ */
+static std::string
+topicName(int n) {
+    static const char* classes[] = {"EQ", "FX", "FI", "CM"};
+    std::stringstream name;
+    name << "prices." << classes[n % 4] << "." << n;
+    return name.str();
+}
+/**
+ * time
+ *    Run a dispatch method over all the messages.
+ * @param messages - the messages.
+ * @param nummsgs - how many to dispatch (cycling through messages).
+ * @param allocs - True to count allocations.
+ * @param counts - allocation counts.
+ * @param dispatch - the method; takes a message view.
+ * @return double - seconds taken.
+ */
+template<typename Dispatch>
+static double
+time(
+    const std::vector<std::string>& messages, int nummsgs, bool allocs, AllocCounts& counts,
+    Dispatch dispatch
+) {
+    AllocCounter allocCounter(allocs);
+    auto start = std::chrono::high_resolution_clock::now();
+    allocCounter.start();
+    size_t n = messages.size();
+    for (int i = 0; i < nummsgs; i++) {
+        const std::string& m = messages[i % n];
+        dispatch(std::string_view(m.data(), m.size()));
+    }
+    allocCounter.stop();
+    auto end = std::chrono::high_resolution_clock::now();
+    counts = allocCounter.read();
+    return (double)std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+        .count()/1.0e6;
+}
+/**
+ * report
+ *    Print one method's results.
+ */
+static void
+report(
+    const char* method, double secs, int nummsgs, uint64_t handled, bool allocs,
+    const AllocCounts& counts
+) {
+    std::cout << method << std::endl;
+    std::cout << "Seconds:    " << secs << std::endl;
+    std::cout << "msgs/sec:   " << (double)nummsgs/secs << std::endl;
+    std::cout << "nsec/msg:   " << secs*1.0e9/nummsgs << std::endl;
+    if (handled != (uint64_t)nummsgs) {
+        std::cout << "Handled only " << handled << " messages!\n";
+    }
+    if (allocs) {
+        reportAllocCounts(method, counts, nummsgs);
+    }
+}
+
+int main(int argc, char** argv) {
+    bool allocs(false);
+    int  size(64);
+    int opt;
+    while ((opt = getopt(argc, argv, "as:")) != -1) {
+        switch (opt) {
+        case 'a':
+            allocs = true;
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: topics [-a] [-s size] ntopics nummsgs\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    int ntopics = atoi(argv[optind]);
+    int nummsgs = atoi(argv[optind+1]);
+
+    std::vector<std::string> topics;
+    for (int i = 0; i < ntopics; i++) {
+        topics.push_back(topicName(i));
+    }
+    // Enough distinct messages that they don't all sit in L1:
+
+    std::mt19937 random(1);
+    std::vector<std::string> messages;
+    std::string body(" " + std::string(size > 1 ? size - 1 : 0, 'x'));
+    for (int i = 0; i < 16384; i++) {
+        messages.push_back(topics[random() % ntopics] + body);
+    }
+    std::vector<uint64_t> counts(ntopics);
+    auto total = [&counts]() {
+        uint64_t sum(0);
+        for (auto c : counts) sum += c;
+        std::fill(counts.begin(), counts.end(), 0);
+        return sum;
+    };
+    AllocCounts allocCounts;
+
+    // split:
+
+    std::map<std::string, int> byName;
+    for (int i = 0; i < ntopics; i++) byName[topics[i]] = i;
+    double secs = time(messages, nummsgs, allocs, allocCounts, [&](std::string_view m) {
+        std::string message(m);
+        auto words = splitLine(message);
+        auto p = byName.find(words[0]);
+        if (p != byName.end()) counts[p->second]++;
+    });
+    report("split", secs, nummsgs, total(), allocs, allocCounts);
+
+    // hash:
+
+    std::unordered_map<std::string_view, int> byView;
+    for (int i = 0; i < ntopics; i++) byView[topics[i]] = i;
+    secs = time(messages, nummsgs, allocs, allocCounts, [&](std::string_view m) {
+        auto p = byView.find(m.substr(0, m.find(' ')));
+        if (p != byView.end()) counts[p->second]++;
+    });
+    report("hash", secs, nummsgs, total(), allocs, allocCounts);
+
+    // dispatcher:
+
+    TopicDispatcher dispatcher;
+    for (int i = 0; i < ntopics; i++) {
+        dispatcher.add(topics[i], [&counts, i](std::string_view, std::string_view) {
+            counts[i]++;
+        });
+    }
+    secs = time(messages, nummsgs, allocs, allocCounts, [&](std::string_view m) {
+        dispatcher.dispatch(m);
+    });
+    report("dispatcher", secs, nummsgs, total(), allocs, allocCounts);
+
+    // prefix (topics ending in the same digit but the last share a handler):
+
+    TopicDispatcher prefixes;
+    for (int i = 0; i < ntopics; i++) {
+        std::string_view topic(topics[i]);
+        prefixes.add(topic.substr(0, topic.size() - 1), [&counts, i](std::string_view, std::string_view) {
+            counts[i]++;
+        });
+    }
+    secs = time(messages, nummsgs, allocs, allocCounts, [&](std::string_view m) {
+        prefixes.dispatch(m);
+    });
+    report("prefix", secs, nummsgs, total(), allocs, allocCounts);
+
+    return EXIT_SUCCESS;
+}
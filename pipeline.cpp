@@ -0,0 +1,263 @@
+/**
+ * Shows a parallel task pipeline built from push/pull:
+ *
+ *    ventilator (PUSH) -> stage 0 workers (PULL/PUSH) -> ... -> sink (PULL)
+ *
+ * The ventilator hands out tasks, each stage's workers pull a task, work on
+ * it and push it on to the next stage, and the sink collects the results.
+ * PUSH load balances over the workers that are connected, PULL fair queues
+ * from all of them.
+ *
+ * Stages are joined by a streamer: a zmq_proxy from a bound PULL (where
+ * the previous stage's workers push) to a bound PUSH (where the next
+ * stage's workers pull), so workers only ever connect.
+ *
+ * Usage:
+ *    pipeline uri nstages nworkers ntasks usec
+ * Where:
+ *    uri - the ventilator binds here.  The streamers and sink bind the
+ *        following endpoints: the next ports for tcp, uri-n otherwise.
+ *    nstages - number of worker stages.
+ *    nworkers - workers in each stage.
+ *    ntasks - tasks to ventilate.
+ *    usec - how long each worker works on each task.
+ *
+ * Each task carries the time it was ventilated; the sink reports
+ * tasks/sec, the mean and worst completion latency and how many tasks
+ * each worker did.
+ *
+ * @note Workers don't know how many tasks there are.  Once the sink has
+ * every result the context is shut down, which makes their blocked
+ * receives (and the streamers) return ETERM.
+ * @note Over tcp the first worker to finish connecting can get a burst of
+ * tasks before the others are up; performance/pipeline waits for every
+ * connection before timing.
+ * @note this is not production code so we will segfault if a parameter is missing.
+ */
+#include <thread>
+#include <latch>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <chrono>
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// A task:
+
+struct Task {
+    int     id;
+    int64_t sent;       // steady_clock microseconds when ventilated.
+};
+
+static int64_t
+now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+/**
+ * nthEndpoint
+ *    The n'th endpoint after uri: next ports for tcp, uri-n otherwise.
+ */
+static std::string
+nthEndpoint(const std::string& uri, int n) {
+    if (n == 0) return uri;
+    if (uri.compare(0, 6, "tcp://") == 0) {
+        auto colon = uri.rfind(':');
+        int port = atoi(uri.substr(colon + 1).c_str());
+        return uri.substr(0, colon + 1) + std::to_string(port + n);
+    }
+    return uri + "-" + std::to_string(n);
+}
+// Stage s pulls from endpoint 2s and pushes to 2s+1:
+
+static std::string
+inputOf(const std::string& uri, int stage) {
+    return nthEndpoint(uri, 2*stage);
+}
+static std::string
+outputOf(const std::string& uri, int stage) {
+    return nthEndpoint(uri, 2*stage + 1);
+}
+
+/**
+ * makeSocket
+ *    Make a socket that won't linger.  That has to be done now: after the
+ * context is shut down zmq_setsockopt fails with ETERM.
+ */
+static void*
+makeSocket(void* ctx, int type, const char* doing) {
+    auto socket = checkError(zmq_socket(ctx, type), doing);
+    int linger(0);
+    checkError(zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)), "Setting linger");
+    return socket;
+}
+/**
+ * worker
+ *
+ * @param uri - base uri.
+ * @param ctx - ZMQ context shared among the threads.
+ * @param stage - the stage we're in.
+ * @param usec - how long to work on each task.
+ * @param connected - latch we count down when connected.
+ * @param done - where we put the number of tasks we did.
+ */
+static void
+worker(std::string uri, void* ctx, int stage, int usec, std::latch& connected, int& done) {
+    auto in = makeSocket(ctx, ZMQ_PULL, "Making worker pull socket");
+    auto out = makeSocket(ctx, ZMQ_PUSH, "Making worker push socket");
+    checkError(zmq_connect(in, inputOf(uri, stage).c_str()), "Connecting worker input");
+    checkError(zmq_connect(out, outputOf(uri, stage).c_str()), "Connecting worker output");
+    connected.count_down();
+
+    done = 0;
+    Task task;
+    while (zmq_recv(in, &task, sizeof(task), 0) >= 0) {
+        usleep(usec);                                     // "work".
+        if (zmq_send(out, &task, sizeof(task), 0) < 0) break;
+        done++;
+    }
+    if (zmq_errno() != ETERM) {
+        checkError(-1, "Passing on task");
+    }
+    checkError(zmq_close(in), "Closing worker pull socket");
+    checkError(zmq_close(out), "Closing worker push socket");
+}
+/**
+ * streamer
+ *    Joins stage - 1 to stage.
+ * @param uri - base uri.
+ * @param ctx - ZMQ context.
+ * @param stage - The stage we feed.
+ * @param bound - latch we count down when both sockets are bound.
+ */
+static void
+streamer(std::string uri, void* ctx, int stage, std::latch& bound) {
+    auto pull = makeSocket(ctx, ZMQ_PULL, "Making streamer pull socket");
+    auto push = makeSocket(ctx, ZMQ_PUSH, "Making streamer push socket");
+    checkError(zmq_bind(pull, outputOf(uri, stage - 1).c_str()), "Binding streamer pull");
+    checkError(zmq_bind(push, inputOf(uri, stage).c_str()), "Binding streamer push");
+    bound.count_down();
+
+    zmq_proxy(pull, push, nullptr);         // Until the context is shut down.
+
+    checkError(zmq_close(pull), "Closing streamer pull socket");
+    checkError(zmq_close(push), "Closing streamer push socket");
+}
+
+/**
+ * main - the ventilator and the sink.  See file comments for how this works.
+ */
+int main(int argc, char** argv) {
+    std::string uri(argv[1]);
+    int nstages = atoi(argv[2]);
+    int nworkers = atoi(argv[3]);
+    int ntasks = atoi(argv[4]);
+    int usec = atoi(argv[5]);
+
+    void* ctx = checkError(
+        zmq_ctx_new(),
+        "Failed to make shared zmq context"
+    );
+    // Bind the ventilator, the sink and the streamers:
+
+    auto ventilator = checkError(zmq_socket(ctx, ZMQ_PUSH), "Making ventilator socket");
+    checkError(zmq_bind(ventilator, inputOf(uri, 0).c_str()), "Binding ventilator");
+    auto sink = checkError(zmq_socket(ctx, ZMQ_PULL), "Making sink socket");
+    checkError(zmq_bind(sink, outputOf(uri, nstages - 1).c_str()), "Binding sink");
+
+    std::latch bound(nstages - 1);
+    std::vector<std::thread*> streamers;
+    for (int s = 1; s < nstages; s++) {
+        streamers.push_back(new std::thread(streamer, uri, ctx, s, std::ref(bound)));
+    }
+    bound.wait();
+
+    // Start the workers:
+
+    std::latch connected(nstages*nworkers);
+    std::vector<int> done(nstages*nworkers);
+    std::vector<std::thread*> workers;
+    for (int s = 0; s < nstages; s++) {
+        for (int w = 0; w < nworkers; w++) {
+            workers.push_back(new std::thread(
+                worker, uri, ctx, s, usec, std::ref(connected), std::ref(done[s*nworkers + w])
+            ));
+        }
+    }
+    connected.wait();
+
+    // Ventilate from a thread while we sink the results:
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread ventilatorThread([ventilator, ntasks]() {
+        for (int i = 0; i < ntasks; i++) {
+            Task task = {i, now()};
+            checkError(zmq_send(ventilator, &task, sizeof(task), 0), "Ventilating task");
+        }
+    });
+    double totalLatency(0), worstLatency(0);
+    for (int i = 0; i < ntasks; i++) {
+        Task task;
+        checkError(zmq_recv(sink, &task, sizeof(task), 0), "Sinking result");
+        double latency = (double)(now() - task.sent);
+        totalLatency += latency;
+        if (latency > worstLatency) worstLatency = latency;
+    }
+    auto end = std::chrono::steady_clock::now();
+    ventilatorThread.join();
+
+    // Tear down everything:
+
+    checkError(zmq_close(ventilator), "Closing ventilator socket");
+    checkError(zmq_close(sink), "Closing sink socket");
+    checkError(zmq_ctx_shutdown(ctx), "Shutting down context");
+    for (auto t : workers) {
+        t->join();
+        delete t;
+    }
+    for (auto t : streamers) {
+        t->join();
+        delete t;
+    }
+    checkError(
+        zmq_ctx_term(ctx),
+        "Terminating context."
+    );
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    std::cout << "Tasks/sec: " << ntasks/secs << std::endl;
+    std::cout << "Latency usec mean: " << totalLatency/ntasks
+        << " max: " << worstLatency << std::endl;
+    for (int s = 0; s < nstages; s++) {
+        std::cout << "Stage " << s << " tasks per worker:";
+        for (int w = 0; w < nworkers; w++) {
+            std::cout << " " << done[s*nworkers + w];
+        }
+        std::cout << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -15,7 +15,9 @@
  *   *  id % 3 == 2 'EVEN'
  * 
  * Subscribers keep processing messages until the part of the message after the
- * selector is "BYE" at which time they exist.alignas
+ * selector is "EXIT" at which time they exist.  Each message is handed, in
+ * place, to the handler for its topic by a TopicDispatcher (see dispatch.h)
+ * and the subscriber reports how many of each it got.
  * 
  * The publisher (main) will send alternatively ALL, ODD, EVEN messages until
  * nmsgs were sent at which time it will send
@@ -23,6 +25,12 @@
  * 
  * publisher will then  join the subscriber threads and then shutdown
  * the system.
+ *
+ * A subscriber that has connected still misses whatever is published before
+ * its subscription gets to the publisher.  Rather than sleeping and hoping,
+ * the publisher is an XPUB: a PUB that hands us each subscription (all of
+ * them, with ZMQ_XPUB_VERBOSE), so it waits for one per subscriber before
+ * publishing.
  */
 /**
  *  Shows how the req/rep pattern works.
@@ -50,6 +58,8 @@
 #include <unistd.h>
 #include <vector>
 #include <sstream>
+#include <string_view>
+#include "dispatch.h"
 
 // check error for int returns.
 static int checkError(int status, const char* doing) {
@@ -72,12 +82,14 @@ static void* checkError(void* p, const char* doing) {
 }
 
 /**
- *  utility to receive a message string.
+ * receiveAndDispatch
+ *    Receive a message and dispatch it without copying it out of the
+ * zmq message.
  * @param sock - socket to receive on.
- * @return std::string - message string received.
+ * @param dispatcher - finds the handler for the message's topic.
  */
-static std::string
-rcvString(void* sock) {
+static void
+receiveAndDispatch(void* sock, const TopicDispatcher& dispatcher) {
 
     // Get the message and require it to be a single part.
     zmq_msg_t msg;
@@ -97,16 +109,13 @@ rcvString(void* sock) {
         std::cerr << "Thought I was getting a single part message, got a multipart!\n";
         exit(EXIT_FAILURE);
     }
-    // Fetch the string from the message and output to stdout:
-    // Assumes the payload is a cstring.
-    std::string printme(reinterpret_cast<char*>(checkError(
-        zmq_msg_data(&msg),
-        "Failed to get message data."
-    )));
-    
+    // Messages are c strings; the view leaves out the null.
+    std::string_view message(
+        reinterpret_cast<const char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg) - 1
+    );
+    dispatcher.dispatch(message);
 
-    zmq_msg_close(&msg);   
-    return printme;
+    zmq_msg_close(&msg);
 }
 
 /**
@@ -134,20 +143,28 @@ sendString(void* sock, const char* mesg) {
     );
 
 }
-// split a string into words:
+/**
+ * waitForSubscribers
+ *    Wait until an XPUB has been given a number of subscriptions.
+ * @param sock - XPUB socket (ZMQ_XPUB_VERBOSE so duplicates aren't filtered).
+ * @param n - number of subscriptions to wait for.
+ */
+static void
+waitForSubscribers(void* sock, int n) {
+    int subscribed(0);
+    while (subscribed < n) {
+        zmq_msg_t msg;
+        checkError(zmq_msg_init(&msg), "Initializing message");
+        checkError(zmq_msg_recv(&msg, sock, 0), "Receiving subscription");
 
-static std::vector<std::string>
-splitLine(const std::string& line) {
-    std::stringstream strLine(line);
-    std::vector<std::string> result;
+        // First byte is 1 for subscribe, 0 for unsubscribe, then the topic:
 
-    std::string word;
-    while (strLine >> word) {
-        result.push_back(word);
+        if (zmq_msg_size(&msg) > 0 && *reinterpret_cast<uint8_t*>(zmq_msg_data(&msg)) == 1) {
+            subscribed++;
+        }
+        zmq_msg_close(&msg);
     }
-    return result;
 }
-
 // Empty string subsribes to all.
 
 static const char* subscriptions[3] = {
@@ -176,14 +193,29 @@ static void subscriber(std::string uri, void* ctx, int id) {
         zmq_connect(socket, uri.c_str()),
         "Connecting to publisher."
     );
-    while(true) {
+    // Handlers for the topics we get; subscribing to everything gets both:
+
+    bool done(false);
+    int  odd(0), even(0);
+    TopicDispatcher dispatcher;
+    if (id % 3 != 2) {
+        dispatcher.add("ODD", [&](std::string_view, std::string_view body) {
+            if (body == " EXIT") done = true;
+            else odd++;
+        });
+    }
+    if (id % 3 != 1) {
+        dispatcher.add("EVEN", [&](std::string_view, std::string_view body) {
+            if (body == " EXIT") done = true;
+            else even++;
+        });
+    }
+    while(!done) {
         // Get messages until the second word is EXIT
 
-        std::string message = rcvString(socket);
-        std::cerr << id << " got " << message << std::endl;
-        auto words = splitLine(message);
-        if (words[1] == "EXIT") break;  // Word 0 is our subscription string.
+        receiveAndDispatch(socket, dispatcher);
     }
+    std::cerr << id << " got " << odd << " ODD and " << even << " EVEN messages\n";
     // shutdown:
 
     checkError(
@@ -207,9 +239,14 @@ int main(int argc, char** argv) {
         "Creating shared zmq context"
     );
     auto socket = checkError(
-        zmq_socket(context, ZMQ_PUB),
+        zmq_socket(context, ZMQ_XPUB),
         "Creating publisher socket."
     );
+    int verbose(1);
+    checkError(
+        zmq_setsockopt(socket, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose)),
+        "Asking for all subscriptions"
+    );
     checkError(
         zmq_bind(socket, uri.c_str()),
         "Binding publisher."
@@ -221,7 +258,7 @@ int main(int argc, char** argv) {
     for (int i = 0; i < subscribers; i++) {
         subscriberThreads.push_back(new std::thread(subscriber, uri, context, i));
     }
-    sleep(1);     // wait for them to all be receiving.
+    waitForSubscribers(socket, subscribers);    // wait for them to all be receiving.
 
     for (int i = 0; i < responses; i++) {
         std::stringstream strResponse;
@@ -2,28 +2,56 @@
  *  Shows how the req/rep pattern works.
  * 
  * Usage:
- *    reqrep uri clients responses
+ *    reqrep [-w workers] uri clients responses
  * Where:
+ *    -w  - number of REP worker threads serving requests (default 1).
  *    uri - is the URI of the communications endpoint
  *    clients - number of requesters.
  *    reponses - number of resonses after which we'll be telling the
  *        clients to exit.
+ *
+ * The service is a worker pool rather than a single REP socket, so it can
+ * use more than one core:
+ *
+ *   REQ requesters -> ROUTER (uri) -> zmq_proxy -> DEALER (inproc) -> REP workers
+ *
+ * The ROUTER prefixes each request with the requester's identity and the
+ * DEALER passes that envelope through to whichever worker it picks; REP
+ * sends it back with the reply, so the ROUTER can route the reply to the
+ * right requester without the workers knowing anything about it.
  * 
  * @note this is not production code so we will segfault if a parameter is missing.
- * @note Since each REQ is paird with an REP, we know how to end:  just send
- * 'clients' number of EXIT reponses then join/shutdown.
+ * @note Since each REQ is paird with an REP, we know how to end:  the workers
+ * share a count of replies; once 'responses' have gone out every request
+ * is answered BYE, so each requester gets exactly one and exits.  Then the
+ * context is shut down, which makes the proxy and the workers return.
+ * @note Messages use the binary format in codec.h rather than strings:
+ * they're encoded straight into the zmq message and read in place.
  */
 #include <thread>
 #include <latch>
 #include <zmq.h>
 #include <iostream>
 #include <stdlib.h>
-#include <sstream>
 #include <string>
 #include <string.h>
 #include <unistd.h>
 #include <vector>
-#include <sstream>
+#include <string_view>
+#include <atomic>
+#include "codec.h"
+
+// Where the workers connect to the proxy:
+
+static const char* WORKERS_URI = "inproc://reqrep-workers";
+
+// Message types (codec::Header::type):
+
+enum MessageType : uint16_t {
+    REQUEST = 1,
+    REPLY   = 2,      // Keep going.
+    BYE     = 3       // Requester should exit.
+};
 
 // check error for int returns.
 static int checkError(int status, const char* doing) {
@@ -46,21 +74,15 @@ static void* checkError(void* p, const char* doing) {
 }
 
 /**
- *  utility to receive a message string.
+ * receive
+ *    Receive a message and require it to be a single part.
  * @param sock - socket to receive on.
- * @return std::string - message string received.
+ * @param msg - the message, read in place.
+ * @param text - the message's text field.
  */
-static std::string
-rcvString(void* sock) {
-
-    // Get the message and require it to be a single part.
-    zmq_msg_t msg;
-    checkError(zmq_msg_init(&msg), "Initializing message");
-
-    checkError(
-        zmq_recvmsg(sock, &msg, 0),
-        "Receiving message part."
-    );
+static void
+receive(void* sock, codec::InMessage& msg, std::string_view& text) {
+    checkError(msg.status(), "Receiving message part.");
     int more;
     size_t morelen(sizeof(more));
     checkError(
@@ -71,42 +93,10 @@ rcvString(void* sock) {
         std::cerr << "Thought I was getting a single part message, got a multipart!\n";
         exit(EXIT_FAILURE);
     }
-    // Fetch the string from the message and output to stdout:
-    // Assumes the payload is a cstring.
-    std::string printme(reinterpret_cast<char*>(checkError(
-        zmq_msg_data(&msg),
-        "Failed to get message data."
-    )));
-    
-
-    zmq_msg_close(&msg);   
-    return printme;
-}
-
-/**
- * sendString
- *    Send a string to a socket:alignas
- * @param sock - socket on which to send it.
- * @param msg = c ztring to send.
- * @note sadly, zmq_msg_init_data requires a void* which means a const cast
- * since we are capable of sending quoted strings.
- * @note since we dont' know the lifetime requirements of the data we're sending
- * we won't do a a zero copy of the data:
- */
-static void
-sendString(void* sock, const char* mesg) {
-    zmq_msg_t msg;
-    checkError(
-        zmq_msg_init_size(&msg, strlen(mesg) + 1),
-        "Failed to allocate message copy storage."
-    );
-    strcpy(reinterpret_cast<char*>(zmq_msg_data(&msg)), mesg);   // Copy message in.
-    
-    checkError(
-        zmq_sendmsg(sock, &msg, 0),    // I think this does a close eventually.
-        "Sending string message"
-    );
-
+    if (!msg.reader().next(text)) {
+        std::cerr << "Malformed message\n";
+        exit(EXIT_FAILURE);
+    }
 }
 
 /**
@@ -129,14 +119,17 @@ requester(std::string uri, void* ctx, int id) {
         "Connecting to server"
     );
 
+    uint64_t sequence(0);
     while (true) {
-        std::stringstream strReq;
-        strReq << "Request from " << id;
-        std::string req(strReq.str());
-        sendString(socket, req.c_str());
-        std::string reply = rcvString(socket);
-        std::cerr << id << " Response: " << reply << std::endl;
-        if (reply == "BYE") break;
+        checkError(
+            codec::send(socket, REQUEST, id, sequence++, {"Request"}),
+            "Sending request"
+        );
+        codec::InMessage reply(socket);
+        std::string_view text;
+        receive(socket, reply, text);
+        std::cerr << id << " Response: " << text << std::endl;
+        if (reply.header().type == BYE) break;
     }
 
     checkError(
@@ -145,27 +138,139 @@ requester(std::string uri, void* ctx, int id) {
     );
     // done.
 }
-// main is the replyer.
+/**
+ * broker
+ *    The front end: a ROUTER the requesters connect to, proxied to a
+ * DEALER the workers connect to.  Runs until the context is shut down.
+ *
+ * @param uri - uri the requesters connect to.
+ * @param ctx - shared context (the workers are inproc).
+ * @param bound - Latch we count down once both sockets are bound.
+ */
+static void
+broker(std::string uri, void* ctx, std::latch& bound) {
+    auto frontend = checkError(
+        zmq_socket(ctx, ZMQ_ROUTER),
+        "Making router socket"
+    );
+    auto backend = checkError(
+        zmq_socket(ctx, ZMQ_DEALER),
+        "Making dealer socket"
+    );
+    int linger(0);         // Now: once the context shuts down setsockopt fails.
+    checkError(
+        zmq_setsockopt(frontend, ZMQ_LINGER, &linger, sizeof(linger)),
+        "Setting router linger"
+    );
+    checkError(
+        zmq_setsockopt(backend, ZMQ_LINGER, &linger, sizeof(linger)),
+        "Setting dealer linger"
+    );
+    checkError(
+        zmq_bind(frontend, uri.c_str()),
+        "Binding ROUTER socket"
+    );
+    checkError(
+        zmq_bind(backend, WORKERS_URI),
+        "Binding DEALER socket"
+    );
+    bound.count_down();
+
+    zmq_proxy(frontend, backend, nullptr);     // Returns when the context shuts down.
+
+    checkError(zmq_close(frontend), "Closing router socket");
+    checkError(zmq_close(backend), "Closing dealer socket");
+}
+/**
+ * worker
+ *    One REP worker.  Replies until the context is shut down.
+ *
+ * @param ctx - shared context.
+ * @param id - worker number.
+ * @param replies - Replies sent by all workers so far.
+ * @param nreplies - Replies to send before saying BYE.
+ * @param handled - Where we put the number of requests we handled.
+ */
+static void
+worker(void* ctx, int id, std::atomic<int>& replies, int nreplies, int& handled) {
+    auto socket = checkError(
+        zmq_socket(ctx, ZMQ_REP),
+        "Making worker socket"
+    );
+    int linger(0);
+    checkError(
+        zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)),
+        "Setting worker linger"
+    );
+    checkError(
+        zmq_connect(socket, WORKERS_URI),
+        "Connecting worker"
+    );
+    handled = 0;
+    while (true) {
+        codec::InMessage req(socket);
+        if (req.status() < 0 && zmq_errno() == ETERM) {
+            break;                                  // Context shut down.
+        }
+        std::string_view text;
+        receive(socket, req, text);
+        handled++;
+        if (replies.fetch_add(1) < nreplies) {
+            std::cerr << "Worker " << id << " Request: " << text << " from " << req.header().id
+                << " #" << req.header().sequence << std::endl;
+            checkError(
+                codec::send(socket, REPLY, 0, req.header().sequence, {"Keep going for now"}),
+                "Sending reply"
+            );
+        } else {
+            checkError(
+                codec::send(socket, BYE, 0, req.header().sequence, {"BYE"}),
+                "Sending BYE"
+            );
+        }
+    }
+    checkError(
+        zmq_close(socket), "Closing worker socket"
+    );
+}
+
+// main sets up the service and the clients.
 
 int main(int argc, char** argv) {
-    std::string uri(argv[1]);
-    int nclients = atoi(argv[2]);
-    int nreplies = atoi(argv[3]);
+    int nworkers(1);
+    int opt;
+    while ((opt = getopt(argc, argv, "w:")) != -1) {
+        switch (opt) {
+        case 'w':
+            nworkers = atoi(optarg);
+            break;
+        default:
+            std::cerr << "Usage: reqrep [-w workers] uri clients responses\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    std::string uri(argv[optind]);
+    int nclients = atoi(argv[optind+1]);
+    int nreplies = atoi(argv[optind+2]);
 
     auto context = checkError(
         zmq_ctx_new(),
         "Creating context"
     );
-    // Make my REP socket and set it up to accept connections:
+    // Start the front end and the workers:
 
-    auto socket = checkError(
-        zmq_socket(context, ZMQ_REP), 
-        "Making reply socket"
-    );
-    checkError(
-        zmq_bind(socket, uri.c_str()), 
-        "Binding REP socket"
-    );
+    std::latch bound(1);
+    std::thread brokerThread(broker, uri, context, std::ref(bound));
+    bound.wait();
+
+    std::atomic<int> replies(0);
+    std::vector<int> handled(nworkers);
+    std::vector<std::thread*> workers;
+    for (int i = 0; i < nworkers; i++) {
+        workers.push_back(new std::thread(
+            worker, context, i, std::ref(replies), nreplies, std::ref(handled[i])
+        ));
+    }
 
     // Make the clients:
 
@@ -174,31 +279,24 @@ int main(int argc, char** argv) {
         reqThreads.push_back(new std::thread(requester, uri, context, i));
     }
 
-    // Handle the number of requests we've obligated ourself to.
-
-    for (int i = 0; i < nreplies; i++) {
-        std::string req = rcvString(socket);
-        std::cerr << "Request: " << req << std::endl;
-        sendString(socket, "Keep going for now");
-    }
-    // Now reply with BYE for each requestor.
-
-    for (int i =0; i < nclients; i++) {
-        std::string req = rcvString(socket);
-        sendString(socket, "BYE");
-    }
-    // Join the threads:
+    // Join the requesters; once they've all had their BYE we're done:
 
     for (auto p : reqThreads) {
         p->join();
         delete p;
     }
 
-    // Sutdown:
+    // Sutdown: blocking calls in the proxy and workers return ETERM.
 
     checkError(
-        zmq_close(socket), "CLosing pull socket"
+        zmq_ctx_shutdown(context), "shutting down context"
     );
+    brokerThread.join();
+    for (int i = 0; i < nworkers; i++) {
+        workers[i]->join();
+        delete workers[i];
+        std::cerr << "Worker " << i << " handled " << handled[i] << " requests\n";
+    }
     checkError(
         zmq_ctx_term(context), "terminating context"
     );
@@ -0,0 +1,288 @@
+/**
+ * Emulates the nanomsg/nng survey pattern with ZMQ sockets.  A surveyor
+ * asks every respondent a question and takes whatever answers arrive
+ * before a deadline.  Respondents may decline to answer.
+ *
+ * Built from:
+ *
+ * *  A PUB bound at uri that broadcasts surveys to the respondents' SUBs.
+ * *  A PULL bound at a second endpoint (next port for tcp, uri-1 otherwise)
+ *    that the respondents PUSH their answers to.
+ *
+ * Each survey carries an id and answers echo it, so answers to an earlier
+ * survey that straggle in after its deadline are recognized and dropped.
+ *
+ * Usage:
+ *    survey uri nrespondents nsurveys deadline
+ * Where:
+ *    uri - endpoint of the surveyor's PUB.
+ *    nrespondents - number of respondent threads.
+ *    nsurveys - number of surveys.
+ *    deadline - milliseconds the surveyor waits for answers.
+ *
+ * Respondent i declines survey s when (s + i) % 3 == 0 so each survey
+ * gets only some of the answers.
+ *
+ * @note Since PUB/SUB drops messages sent before a subscription arrives,
+ * the surveyor first sends PING surveys until everyone has answered one.
+ * To exit, it sends EXIT until every respondent has said BYE.
+ * @note this is not production code so we will segfault if a parameter is missing.
+ */
+#include <thread>
+#include <zmq.h>
+#include <iostream>
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <set>
+#include <chrono>
+
+// check error for int returns.
+static int checkError(int status, const char* doing) {
+    if (status < 0) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return status;
+}
+// check error for pointer returns:
+
+static void* checkError(void* p, const char* doing) {
+    if (!p) {
+        std::cerr << "Failed " << doing << " "
+            << zmq_strerror(zmq_errno()) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/**
+ *  utility to receive a message string.
+ * @param sock - socket to receive on.
+ * @return std::string - message string received.
+ */
+static std::string
+rcvString(void* sock) {
+
+    // Get the message and require it to be a single part.
+    zmq_msg_t msg;
+    checkError(zmq_msg_init(&msg), "Initializing message");
+
+    checkError(
+        zmq_recvmsg(sock, &msg, 0),
+        "Receiving message part."
+    );
+    int more;
+    size_t morelen(sizeof(more));
+    checkError(
+        zmq_getsockopt(sock, ZMQ_RCVMORE, &more, &morelen),
+        "Failed to get more flag"
+    );
+    if (more) {
+        std::cerr << "Thought I was getting a single part message, got a multipart!\n";
+        exit(EXIT_FAILURE);
+    }
+    // Fetch the string from the message and output to stdout:
+    // Assumes the payload is a cstring.
+    std::string printme(reinterpret_cast<char*>(checkError(
+        zmq_msg_data(&msg),
+        "Failed to get message data."
+    )));
+
+
+    zmq_msg_close(&msg);
+    return printme;
+}
+
+/**
+ * sendString
+ *    Send a string to a socket:
+ * @param sock - socket on which to send it.
+ * @param msg = c ztring to send.
+ */
+static void
+sendString(void* sock, const char* mesg) {
+    zmq_msg_t msg;
+    checkError(
+        zmq_msg_init_size(&msg, strlen(mesg) + 1),
+        "Failed to allocate message copy storage."
+    );
+    strcpy(reinterpret_cast<char*>(zmq_msg_data(&msg)), mesg);   // Copy message in.
+
+    checkError(
+        zmq_sendmsg(sock, &msg, 0),    // I think this does a close eventually.
+        "Sending string message"
+    );
+
+}
+/**
+ * secondEndpoint
+ *    The answer PULL's endpoint: next port for tcp, uri-1 otherwise.
+ */
+static std::string
+secondEndpoint(const std::string& uri) {
+    if (uri.compare(0, 6, "tcp://") == 0) {
+        auto colon = uri.rfind(':');
+        int port = atoi(uri.substr(colon + 1).c_str());
+        return uri.substr(0, colon + 1) + std::to_string(port + 1);
+    }
+    return uri + "-1";
+}
+/**
+ * pollString
+ *    Wait up to a timeout for a string.
+ * @param sock - socket to receive on.
+ * @param ms - milliseconds to wait.
+ * @param result - gets the string if there is one.
+ * @return bool - true if a string was received.
+ */
+static bool
+pollString(void* sock, long ms, std::string& result) {
+    zmq_pollitem_t item = {sock, 0, ZMQ_POLLIN, 0};
+    if (checkError(zmq_poll(&item, 1, ms), "Polling for answers") == 0) {
+        return false;
+    }
+    result = rcvString(sock);
+    return true;
+}
+
+/**
+ * respondent
+ *    Answers surveys until told to exit.
+ *
+ * Surveys look like "<kind> <survey-id>" where kind is PING, SURVEY or EXIT.
+ * Answers look like "<survey-id> <respondent-id> <text>".
+ *
+ * @param surveyUri - surveyor's PUB endpoint.
+ * @param answerUri - surveyor's PULL endpoint.
+ * @param ctx - shared context.
+ * @param id - our respondent id.
+ */
+static void
+respondent(std::string surveyUri, std::string answerUri, void* ctx, int id) {
+    auto sub = checkError(
+        zmq_socket(ctx, ZMQ_SUB),
+        "Creating respondent SUB"
+    );
+    checkError(zmq_setsockopt(sub, ZMQ_SUBSCRIBE, "", 0), "Subscribing to surveys");
+    checkError(zmq_connect(sub, surveyUri.c_str()), "Connecting to surveyor");
+    auto push = checkError(
+        zmq_socket(ctx, ZMQ_PUSH),
+        "Creating respondent PUSH"
+    );
+    checkError(zmq_connect(push, answerUri.c_str()), "Connecting answer path");
+
+    while (true) {
+        std::stringstream survey(rcvString(sub));
+        std::string kind;
+        int surveyId;
+        survey >> kind >> surveyId;
+
+        std::stringstream answer;
+        answer << surveyId << " " << id << " ";
+        if (kind == "EXIT") {
+            answer << "BYE";
+            sendString(push, answer.str().c_str());
+            break;
+        }
+        if (kind == "SURVEY" && (surveyId + id) % 3 == 0) {
+            continue;                               // Decline this one.
+        }
+        answer << "Respondent " << id << " is fine";
+        sendString(push, answer.str().c_str());
+    }
+    checkError(zmq_close(sub), "Closing respondent SUB");
+    checkError(zmq_close(push), "Closing respondent PUSH");
+}
+
+// main is the surveyor.
+
+int main(int argc, char** argv) {
+    std::string uri(argv[1]);
+    int nrespondents = atoi(argv[2]);
+    int nsurveys = atoi(argv[3]);
+    int deadline = atoi(argv[4]);
+    std::string answerUri = secondEndpoint(uri);
+
+    auto context = checkError(
+        zmq_ctx_new(),
+        "Creating context"
+    );
+    auto pub = checkError(
+        zmq_socket(context, ZMQ_PUB),
+        "Creating surveyor PUB"
+    );
+    checkError(zmq_bind(pub, uri.c_str()), "Binding surveyor PUB");
+    auto pull = checkError(
+        zmq_socket(context, ZMQ_PULL),
+        "Creating surveyor PULL"
+    );
+    checkError(zmq_bind(pull, answerUri.c_str()), "Binding surveyor PULL");
+
+    std::vector<std::thread*> respondents;
+    for (int i = 0; i < nrespondents; i++) {
+        respondents.push_back(new std::thread(respondent, uri, answerUri, context, i));
+    }
+    // PING until everyone has answered once:
+
+    std::set<std::string> heardFrom;
+    while ((int)heardFrom.size() < nrespondents) {
+        sendString(pub, "PING 0");
+        std::string answer;
+        while (pollString(pull, 10, answer)) {
+            std::stringstream fields(answer);
+            std::string surveyId, respondentId;
+            fields >> surveyId >> respondentId;
+            heardFrom.insert(respondentId);
+        }
+    }
+    // Do the surveys:
+
+    for (int s = 1; s <= nsurveys; s++) {
+        std::stringstream survey;
+        survey << "SURVEY " << s;
+        sendString(pub, survey.str().c_str());
+
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline);
+        int answers(0);
+        while (answers < nrespondents) {
+            long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                end - std::chrono::steady_clock::now()
+            ).count();
+            std::string answer;
+            if (remaining <= 0 || !pollString(pull, remaining, answer)) {
+                break;                             // Deadline.
+            }
+            std::stringstream fields(answer);
+            int surveyId;
+            fields >> surveyId;
+            if (surveyId != s) continue;            // Late answer to an old survey.
+            std::cout << "Survey " << s << " answer: " << answer << std::endl;
+            answers++;
+        }
+        std::cout << "Survey " << s << " got " << answers << " of "
+            << nrespondents << " answers\n";
+    }
+    // Get everyone to exit:
+
+    int byes(0);
+    while (byes < nrespondents) {
+        sendString(pub, "EXIT 0");
+        std::string answer;
+        while (pollString(pull, 10, answer)) {
+            if (answer.find("BYE") != std::string::npos) byes++;
+        }
+    }
+    for (auto p : respondents) {
+        p->join();
+        delete p;
+    }
+    checkError(zmq_close(pub), "Closing surveyor PUB");
+    checkError(zmq_close(pull), "Closing surveyor PULL");
+    checkError(zmq_ctx_term(context), "Terminating context");
+    return EXIT_SUCCESS;
+}